@@ -116,21 +116,6 @@ dcache_clean:
     isb
     bx lr
 
-@ Taking in the start address in r0, and the end address in r1 and cleans the 
-@ data cache between these two virtual addresses
-
-.global dcache_clean_range
-.type dcache_clean_range, %function
-dcache_clean_range:
-
-    bic r0, r0, #31              @ Align the start address by a cache line
-1:  
-    mcr p15, 0, r0, c7, c10, 1
-    add r0, r0, #32
-    cmp r0, r1
-    blt 1b
-    bx lr
-
 @ Invalidates the entrie L1 data cache
 @
 @ void dcache_invalidate(void)
@@ -155,31 +140,9 @@ dcache_invalidate:
     bne 1b
     bx lr
 
-@ Taking in the start address in r0, and the end address in r1 and invalidates
-@ the data cache between these two virtual addresses. This might invalidate
-@ additional bytes is the address is not aligned with a cache line
-@
-@ void dcache_invalidate_range(u32 start, u32 end)
-
-.global dcache_invalidate_range
-.type dcache_invalidate_range, %function
-dcache_invalidate_range:
-   
-    bic r0, r0, #31          @ Align by cache line
-1:  
-    mcr p15, 0, r0, c7, c6, 1
-    add r0, r0, #32
-    cmp r0, r1
-    blt 1b
-    dsb
-    isb
-    bx lr
-
-@ Taking in the start address in r0, and the end address in r1 and cleans
-@ the data cache between these two virtual addresses. This might clean
-@ additional bytes is the address is not aligned with a cache line
+@ Cleans and invalidates the entire L1 data cache
 @
-@ void dcache_clean_range(u32 start, u32 end)
+@ void dcache_clean_invalidate(void)
 
 .global dcache_clean_invalidate
 .type dcache_clean_invalidate, %function
@@ -200,17 +163,3 @@ dcache_clean_invalidate:
     cmp r0, #4
     bne 1b
     bx lr
-
-@ Taking in the start address in r0, and the end address in r1 and cleans and 
-@ and invalidates the data cache between these two virtual addresses
-.global dcache_clean_invalidate_range
-.type dcache_clean_invalidate_range, %function
-dcache_clean_invalidate_range:
-
-    bic r0, r0, #31          @ Align the start address by a cache line
-1:  
-    mcr p15, 0, r0, c7, c14, 1
-    add r0, r0, #32
-    cmp r0, r1
-    blt 1b
-    bx lr
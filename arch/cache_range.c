@@ -0,0 +1,125 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/cache.h>
+#include <citrus/mm.h>
+
+// Performs a cache maintenance operation on every cache line in a range
+#define cache_range_op(start, end, op)                        \
+    for (u32 addr = (start) & ~(CACHE_LINE - 1); addr < (end); \
+        addr += CACHE_LINE) {                                  \
+        asm volatile (op : : "r" (addr) : "memory");           \
+    }
+
+static inline void cache_barrier(void)
+{
+    asm volatile ("dsb" : : : "memory");
+}
+
+// The outer cache works on physical addresses. Ranges in the linear kernel
+// mapping are translated directly, everything else falls back to operating on
+// all the L2 ways. A plain invalidate can never fall back, since that would
+// discard dirty data belonging to the rest of the kernel
+static inline u8 outer_range_valid(u32 start, u32 end)
+{
+    return start >= KERNEL_START && end <= KERNEL_START + DDR_SIZE &&
+        end - start <= L2CACHE_RANGE_MAX;
+}
+
+static void outer_clean(u32 start, u32 end)
+{
+    if (outer_range_valid(start, end)) {
+        l2cache_clean_range(start - KERNEL_OFFSET, end - KERNEL_OFFSET);
+    } else {
+        l2cache_clean();
+    }
+}
+
+static void outer_clean_inv(u32 start, u32 end)
+{
+    if (outer_range_valid(start, end)) {
+        l2cache_clean_inv_range(start - KERNEL_OFFSET, end - KERNEL_OFFSET);
+    } else {
+        l2cache_clean_inv();
+    }
+}
+
+static void outer_inv(u32 start, u32 end)
+{
+    if (outer_range_valid(start, end)) {
+        l2cache_inv_range(start - KERNEL_OFFSET, end - KERNEL_OFFSET);
+    } else {
+        l2cache_clean_inv();
+    }
+}
+
+// Writes the dirty data in the range back to memory. The L1 is cleaned before
+// the L2, so that the lines written back from the L1 reaches the memory
+void clean_range(u32 start, u32 end)
+{
+    if (end - start > CACHE_RANGE_MAX) {
+        dcache_clean();
+    } else {
+        cache_range_op(start, end, "mcr p15, 0, %0, c7, c10, 1");
+    }
+    cache_barrier();
+    outer_clean(start, end);
+}
+
+// Discards the cached data in the range. The partial cache lines at the edges
+// are cleaned first, so that data outside the range is not lost. The L2 is
+// invalidated before the L1, so that the L1 can not refill from stale L2 lines
+void invalidate_range(u32 start, u32 end)
+{
+    if (end - start > CACHE_RANGE_MAX) {
+        dcache_clean_invalidate();
+        cache_barrier();
+        outer_clean_inv(start, end);
+        return;
+    }
+
+    if (start & (CACHE_LINE - 1)) {
+        cache_range_op(start, start + 1, "mcr p15, 0, %0, c7, c14, 1");
+        cache_barrier();
+        outer_clean_inv(start, start + 1);
+        start = (start + CACHE_LINE) & ~(CACHE_LINE - 1);
+    }
+    if (end & (CACHE_LINE - 1)) {
+        cache_range_op(end, end + 1, "mcr p15, 0, %0, c7, c14, 1");
+        cache_barrier();
+        outer_clean_inv(end, end + 1);
+        end &= ~(CACHE_LINE - 1);
+    }
+    if (start >= end) {
+        return;
+    }
+    outer_inv(start, end);
+    cache_range_op(start, end, "mcr p15, 0, %0, c7, c6, 1");
+    cache_barrier();
+}
+
+// Writes the dirty data in the range back to memory and discards it
+void clean_inv_range(u32 start, u32 end)
+{
+    if (end - start > CACHE_RANGE_MAX) {
+        dcache_clean_invalidate();
+    } else {
+        cache_range_op(start, end, "mcr p15, 0, %0, c7, c14, 1");
+    }
+    cache_barrier();
+    outer_clean_inv(start, end);
+}
+
+// Makes instructions written through the data cache visible to the instruction
+// fetch. The range is cleaned to the point of unification. The instruction
+// cache is invalidated as a whole, because it might hold the same code under
+// a user alias the range can not reach, and ICIALLU is only one operation
+void icache_sync_range(u32 start, u32 end)
+{
+    if (end - start > CACHE_RANGE_MAX) {
+        dcache_clean();
+    } else {
+        cache_range_op(start, end, "mcr p15, 0, %0, c7, c11, 1");
+        cache_barrier();
+    }
+    icache_invalidate();
+}
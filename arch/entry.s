@@ -174,6 +174,14 @@ kernel_entry:
     orr r4, r4, r1
     str r4, [r2, r3, LSL #2]
 
+    @ Map in the L2 cache controller. The physical address is in the user half
+    @ of the address space, so the registers are placed right below the vectors
+    mov r3, #0xA
+    mov r4, r3, LSL #20
+    orr r4, r4, r1
+    movw r3, #0xFFE
+    str r4, [r2, r3, LSL #2]
+
     @ We want to map in vectors in virtual DDR into the high vector fetch address
     @ at address 0xFFFF0000. We are using 2 levels of page tables because the 
     @ first level page table requires the page to be 1M aligned, thus increasing
@@ -221,8 +229,18 @@ kernel_entry:
     mcr p15, 0, r1, c3, c0, 0  @ Enable the domain 15
     mcr p15, 0, r0, c8, c7, 0  @ Invalidate the TLB cache (and uTLB)  
 
+    @ With TEX remap the memory type is given by TEX[0], C and B which index
+    @ the PRRR and NMRR registers. Index 0 to 4 keeps the meaning of the legacy
+    @ encodings used by the page tables. Index 5 is write-back write-allocate
+    @ in both the inner and the outer cache
+    ldr r1, =0x000A0AA4
+    mcr p15, 0, r1, c10, c2, 0 @ PRRR
+    ldr r1, =0x04E004E0
+    mcr p15, 0, r1, c10, c2, 1 @ NMRR
+
     mrc p15, 0, r1, c1, c0, 0
     orr r1, r1, #1
+    orr r1, r1, #(1 << 28)     @ TEX remap enable
     mcr p15, 0, r1, c1, c0, 0  @ Enable the MMU
 
     @ Clear the .bss
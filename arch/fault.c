@@ -5,6 +5,8 @@
 #include <citrus/sched.h>
 #include <citrus/panic.h>
 #include <citrus/regmap.h>
+#include <citrus/thread.h>
+#include <citrus/mm.h>
 
 // Performs a software reboot. This is called to avoid a manual hardware reset
 // when the CPU does not respond to the c-boot interrupt instruction
@@ -177,8 +179,51 @@ void prefetch_exception(u32 pc)
 
 extern struct rq rq;
 
+// Fault status codes from the DFSR
+#define FAULT_TRANSLATION_SECTION 0b000101
+#define FAULT_TRANSLATION_PAGE    0b000111
+#define FAULT_PERMISSION_PAGE     0b001111
+
+// The DFSR WnR bit is set if the abort was caused by a write
+#define DFSR_WNR (1 << 11)
+
+// Tries to resolve a data abort by demand paging or copy-on-write. Returns 1
+// if the faulting instruction can be restarted
+static u8 data_exception_resolve(void)
+{
+    u32 dfsr;
+    asm volatile ("mrc p15, 0, %0, c5, c0, 0" : "=r" (dfsr));
+
+    u32 status = (dfsr & 0xF) | (((dfsr >> 12) & 1) << 5) | 
+        (((dfsr >> 10) & 1) << 4);
+
+    struct thread* thread = get_curr_thread();
+    if (thread == NULL) {
+        return 0;
+    }
+
+    u32 dfar;
+    asm volatile ("mrc p15, 0, %0, c6, c0, 0" : "=r" (dfar));
+
+    if (status == FAULT_TRANSLATION_SECTION ||
+        status == FAULT_TRANSLATION_PAGE) {
+        return mm_handle_fault(thread->mmap, dfar);
+    }
+
+    if (status == FAULT_PERMISSION_PAGE && (dfsr & DFSR_WNR)) {
+        return mm_handle_cow_fault(thread->mmap, dfar);
+    }
+    return 0;
+}
+
 void data_exception(u32 pc)
 {
+    // User heap and stack pages are mapped in on first touch, and shared
+    // pages are copied on the first write
+    if (data_exception_resolve()) {
+        return;
+    }
+
     print("Next => %p\n", rq.next);
     print("Curr => %p\n", rq.curr);
 
@@ -84,6 +84,7 @@ __data_exception:
 
     bl data_exception
     ldmia sp!, {r0 - r3, r12, lr}
+    clrex                   @ Fail any interrupted exclusive store
     movs pc, lr
 
 @ Supervisor exception
@@ -150,14 +151,19 @@ context_core:
     ldr r3, [r0, #4]
     str sp, [r3]                @ Store the SP in the curr_thread_sp
 
-    @ Switch the memory map in case of user threads
+    @ Switch the memory map in case of user threads. The user TLB entries are
+    @ tagged with the ASID so the TLB is not flushed. The reserved ASID 0 is
+    @ used while TTBR0 changes so no walk mixes the old and new memory map
     ldr r4, [r1, #4]
     cmp r4, #0
     ldrne r3, [r4]              @ Get the base address of the next memory map
+    ldrne r5, [r4, #4]          @ Get the context ID of the next memory map
+    movne r6, #0
+    mcrne p15, 0, r6, c13, c0, 1
+    isb
     mcrne p15, 0, r3, c2, c0, 0
     isb
-    mcrne p15, 0, r0, c8, c7, 0 @ Flush the entire TLB / uTLB
-    dsb
+    mcrne p15, 0, r5, c13, c0, 1
     isb
 
     @ Set rq->curr to rq->next, and rq->next to NULL
@@ -181,5 +187,6 @@ skip_context:
     add sp, sp, r1
 
     ldmia sp!, {r0 - r3, r12}   @ Pop the AAPCS registers
+    clrex                       @ Fail any interrupted exclusive store
     rfefd sp!                   @ Return from exception
     
\ No newline at end of file
@@ -0,0 +1,126 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/cache.h>
+#include <citrus/regmap.h>
+#include <citrus/atomic.h>
+
+// Auxiliary control register
+#define L2CC_ACR_ASSOC_16 (1 << 16)
+#define L2CC_ACR_IPEN     (1 << 29)
+#define L2CC_ACR_DPEN     (1 << 28)
+
+// Prefetch control register
+#define L2CC_PCR_DLINEFILL (1 << 30)
+#define L2CC_PCR_IPEN      (1 << 29)
+#define L2CC_PCR_DPEN      (1 << 28)
+#define L2CC_PCR_PDROP     (1 << 24)
+#define L2CC_PCR_OFFSET(x) ((x) & 0x1F)
+
+// Power control register
+#define L2CC_POWCR_DCLKGATE (1 << 1)
+#define L2CC_POWCR_STBYEN   (1 << 0)
+
+// RAM latency control registers. Each field is the number of cycles minus one
+#define L2CC_LATENCY(setup, read, write) \
+    ((((write) - 1) << 8) | (((read) - 1) << 4) | ((setup) - 1))
+
+#define L2CC_TAG_LATENCY  L2CC_LATENCY(1, 1, 1)
+#define L2CC_DATA_LATENCY L2CC_LATENCY(1, 2, 1)
+
+static u8 l2cache_enabled = 0;
+static u32 l2cache_way_msk;
+
+// Waits for the outstanding operations in the controller to drain
+static inline void l2cache_sync(void)
+{
+    L2CACHE->CSR = 0;
+    while (L2CACHE->CSR & 1);
+}
+
+// Performs a background operation on all ways
+static void l2cache_way_op(volatile u32* reg)
+{
+    u32 atomic = __atomic_enter();
+
+    *reg = l2cache_way_msk;
+    while (*reg & l2cache_way_msk);
+    l2cache_sync();
+
+    __atomic_leave(atomic);
+}
+
+// Performs a line operation on every line in a physical range
+static void l2cache_line_op(volatile u32* reg, u32 start, u32 end)
+{
+    for (u32 addr = start & ~(CACHE_LINE - 1); addr < end; addr += CACHE_LINE) {
+        *reg = addr;
+    }
+    l2cache_sync();
+}
+
+// Sets up the L2C-310 cache controller and enables the outer cache. This must
+// be called after the L1 cache has been enabled
+void l2cache_init(void)
+{
+    // The controller uses the second internal SRAM as cache memory
+    SFR->L2CC_HRAMC = 1;
+
+    // The configuration registers can only be written with the cache disabled
+    L2CACHE->CR = 0;
+
+    L2CACHE->TRCR = L2CC_TAG_LATENCY;
+    L2CACHE->DRCR = L2CC_DATA_LATENCY;
+
+    L2CACHE->ACR |= L2CC_ACR_IPEN | L2CC_ACR_DPEN;
+    L2CACHE->PCR = L2CC_PCR_DLINEFILL | L2CC_PCR_IPEN | L2CC_PCR_DPEN |
+        L2CC_PCR_PDROP | L2CC_PCR_OFFSET(7);
+
+    L2CACHE->POWCR = L2CC_POWCR_DCLKGATE | L2CC_POWCR_STBYEN;
+
+    l2cache_way_msk = (L2CACHE->ACR & L2CC_ACR_ASSOC_16) ? 0xFFFF : 0xFF;
+
+    // Invalidate all ways and clear any pending interrupts before enabling
+    l2cache_way_op(&L2CACHE->IWR);
+    L2CACHE->ICR = 0x1FF;
+
+    L2CACHE->CR = 1;
+    asm volatile ("dsb" : : : "memory");
+
+    l2cache_enabled = 1;
+}
+
+// Outer cache maintenance on physical addresses. The end address is exclusive
+void l2cache_clean_range(u32 start, u32 end)
+{
+    if (l2cache_enabled) {
+        l2cache_line_op(&L2CACHE->CPALR, start, end);
+    }
+}
+
+void l2cache_inv_range(u32 start, u32 end)
+{
+    if (l2cache_enabled) {
+        l2cache_line_op(&L2CACHE->IPALR, start, end);
+    }
+}
+
+void l2cache_clean_inv_range(u32 start, u32 end)
+{
+    if (l2cache_enabled) {
+        l2cache_line_op(&L2CACHE->CIPALR, start, end);
+    }
+}
+
+void l2cache_clean(void)
+{
+    if (l2cache_enabled) {
+        l2cache_way_op(&L2CACHE->CWR);
+    }
+}
+
+void l2cache_clean_inv(void)
+{
+    if (l2cache_enabled) {
+        l2cache_way_op(&L2CACHE->CIWR);
+    }
+}
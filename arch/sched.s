@@ -52,13 +52,20 @@ sched_start:
     str r1, [r0, #4]
     str r2, [r0]
 
-    @ Conditionally update the memory map
+    @ Conditionally update the memory map. The reserved ASID 0 is used while
+    @ TTBR0 changes
     ldr r2, [r1, #4]
     cmp r2, #0
     ldrne r0, [r2]
+    ldrne r3, [r2, #4]
+    movne r2, #0
+    mcrne p15, 0, r2, c13, c0, 1 @ Switch to the reserved ASID
+    isb
     mcrne p15, 0, r0, c2, c0, 0  @ Update the TTBR0 with the current memory map
     isb
-    mcrne p15, 0, r0, c8, c7, 0  @ Flush the TLB / uTLB
+    mcrne p15, 0, r3, c13, c0, 1 @ Set the ASID of the current memory map
+    isb
+    mcr p15, 0, r0, c8, c7, 0    @ Flush the TLB / uTLB once at startup
     dsb
     isb
 
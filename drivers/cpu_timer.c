@@ -4,19 +4,39 @@
 #include <citrus/clock.h>
 #include <citrus/regmap.h>
 
+// The counter runs at 10375 kHz
+#define CPU_TIMER_KHZ 10375
+
+// A new period ends at least this many counts after the current count, so
+// that the compare is not missed while the counter is being updated
+#define CPU_TIMER_MARGIN 64
+
+// The conversions are split so that they do not overflow for periods of
+// several seconds
+static inline u32 cpu_timer_to_us(u32 counts)
+{
+    return (counts / CPU_TIMER_KHZ) * 1000 +
+        (counts % CPU_TIMER_KHZ) * 1000 / CPU_TIMER_KHZ;
+}
+
+static inline u32 cpu_timer_to_counts(u32 us)
+{
+    return (us / 1000) * CPU_TIMER_KHZ + (us % 1000) * CPU_TIMER_KHZ / 1000;
+}
+
 void cpu_timer_init(void)
 {
     clk_pck_enable(36);
 
     // Using PCLK @ 83 MHz divided by 8 yielding 10375 kHz
     TIMER1->channel[0].CMR = (1 << 14) | 1;
-    TIMER1->channel[0].RC = 10375;
+    TIMER1->channel[0].RC = CPU_TIMER_KHZ;
     TIMER1->channel[0].IER = (1 << 4);
 }
 
-void cpu_timer_clear_flags(void)
+u8 cpu_timer_clear_flags(void)
 {
-    (void)TIMER1->channel[0].SR;
+    return (TIMER1->channel[0].SR & (1 << 4)) ? 1 : 0;
 }
 
 void cpu_timer_reset(void)
@@ -31,7 +51,19 @@ u32 cpu_timer_get_value(void)
 
 u32 cpu_timer_get_value_us(void)
 {
-    return (TIMER1->channel[0].CV * 1000) / 10375;
+    return cpu_timer_to_us(TIMER1->channel[0].CV);
+}
+
+u32 cpu_timer_set_period_us(u32 us)
+{
+    u32 counts = cpu_timer_to_counts(us);
+    u32 min = TIMER1->channel[0].CV + CPU_TIMER_MARGIN;
+
+    if (counts < min) {
+        counts = min;
+    }
+    TIMER1->channel[0].RC = counts;
+    return cpu_timer_to_us(counts);
 }
 
 void cpu_timer_start(void)
@@ -8,7 +8,7 @@
 #include <citrus/cache.h>
 #include <citrus/mm.h>
 #include <citrus/mem.h>
-#include <citrus/cache_alloc.h>
+#include <citrus/dma_pool.h>
 #include <stddef.h>
 #include <stdalign.h>
 #include <citrus/panic.h>
@@ -55,13 +55,18 @@ static volatile u32 tx_index;
 // to convert to physical addresses since the allocatings produce a VA
 static void gmac_alloc_buffers(void)
 {
-    na_rx_buf  = cache_alloc(NA_SIZE * NA_CNT, 32);
-    na_tx_buf  = cache_alloc(NA_SIZE * NA_CNT, 32);
-    na_rx_desc = cache_alloc(NA_CNT * 8, 8);
-    na_tx_desc = cache_alloc(NA_CNT * 8, 8);
+    na_rx_buf  = dma_alloc(NA_SIZE * NA_CNT);
+    na_tx_buf  = dma_alloc(NA_SIZE * NA_CNT);
+    na_rx_desc = dma_alloc(NA_CNT * 8);
+    na_tx_desc = dma_alloc(NA_CNT * 8);
 
-    tx_desc    = cache_alloc(TX_DESC_CNT * 8, 8);
-    rx_desc    = cache_alloc(RX_DESC_CNT * 8, 8);
+    tx_desc    = dma_alloc(TX_DESC_CNT * 8);
+    rx_desc    = dma_alloc(RX_DESC_CNT * 8);
+
+    if (!na_rx_buf || !na_tx_buf || !na_rx_desc || !na_tx_desc || !tx_desc ||
+        !rx_desc) {
+        panic("Cant allocate DMA memory");
+    }
     
     // Allocate the buffers for the receive queue
     for (u32 i = 0; i < RX_DESC_CNT; i++) {
@@ -235,6 +240,10 @@ static void gmac_init_queues(void)
         rx_desc[i].wrap = 0;
         rx_desc[i].owner_software = 0;
         rx_desc[i].status_word = 0;
+
+        // No dirty lines may be evicted on top of the received data
+        clean_inv_range((u32)rx_netbuf[i]->buf,
+            (u32)(rx_netbuf[i]->buf + NETBUF_LENGTH));
     }
 
     // Mark the buffer as the last one in the queue
@@ -262,8 +271,6 @@ static void gmac_init_queues(void)
         GMAC->TBQBAPQ[i] = (u32)va_to_pa(na_tx_desc + i);
         GMAC->RBQBAPQ[i] = (u32)va_to_pa(na_rx_desc + i);
     }
-
-    dcache_clean();
 }
 
 
@@ -299,10 +306,12 @@ i32 gmac_rec_raw(struct netbuf** buf)
         curr_buf->ptr = curr_buf->buf;
 
         // Invalidate the entire receive buffer
-        dcache_invalidate_range((u32)curr_buf->buf,
+        invalidate_range((u32)curr_buf->buf,
             (u32)(curr_buf->buf + NETBUF_LENGTH));
 
         // Link in the new netbuf
+        clean_inv_range((u32)new_netbuf->buf,
+            (u32)(new_netbuf->buf + NETBUF_LENGTH));
         desc->addr = (u32)va_to_pa(new_netbuf->buf) >> 2;
 
         // Swap the entriees inthe netbuf queue
@@ -357,7 +366,7 @@ void gmac_send_raw(struct netbuf* buf)
     desc->addr = (u32)va_to_pa(buf->ptr);
 
     // Clean the D-cache
-    dcache_clean_range((u32)buf->ptr, (u32)buf->ptr + buf->frame_len);
+    clean_range((u32)buf->ptr, (u32)buf->ptr + buf->frame_len);
 
     // Mark the descriptor as the last one. We never use more than one 
     // descriptor in this setup
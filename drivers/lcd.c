@@ -11,7 +11,8 @@
 #include <citrus/mem.h>
 #include <citrus/align.h>
 #include <citrus/regmap.h>
-#include <citrus/boot_alloc.h>
+#include <citrus/cma.h>
+#include <citrus/page_alloc.h>
 
 #include <stddef.h>
 #include <stdalign.h>
@@ -51,60 +52,91 @@ struct lcd_dma_desc alignas(32) lcd_dma_descriptors[LAYERS * 2];
 // Allocate the layers in use by the LCD controller
 struct lcd_layer lcd_layers[LAYERS];
 
-// Set to one when the LCD buffers are ready to use
-static u8 lcd_buffers_ready = 0;
+// The layer buffers are one contiguous run of sections in the contiguous
+// memory area. They are only allocated while the display is on
+static struct page* lcd_buffer_page;
+static u32 lcd_buffer_pages;
 
-void lcd_layers_alloc(void)
+// Remaps the sections holding the layer buffers in the kernel page table. ASID
+// matching is not nessecary bacause they're in kernel space
+static void lcd_buffers_set_mem(u32 mem)
+{
+    struct ste_attr attr = {
+        .access = STE_ACCESS_FULL_ACC,
+        .mem = mem,
+        .domain = 15,
+        .nG = 0,
+        .xn = 0
+    };
+
+    u8* va = page_to_va(lcd_buffer_page);
+    for (u32 i = 0; i < lcd_buffer_pages / 256; i++) {
+        mm_change_kernel_pt_attr((u32 *)va, &attr);
+        va += 0x100000;
+    }
+}
+
+// Allocates the double buffers for all the layers and makes them
+// non-cacheable. The sections are owned by the LCD only, so no other data can
+// share the non-cacheable mapping
+static void lcd_layers_alloc(void)
 {
     u32 pixels = SCREEN_X * SCREEN_Y;
+    u32 sizes[LAYERS] = {
+        pixels * sizeof(struct rgb),   // Layer 1 uses no alpha channel
+        pixels * sizeof(struct rgba),
+        pixels * sizeof(struct rgba)
+    };
+
+    u32 size = 0;
+    for (u32 i = 0; i < LAYERS; i++) {
+        size += 2 * align_up(sizes[i], 32);
+    }
+
+    // Round up to whole 1MB sections. A block of 256 pages or more from the
+    // contiguous area is section aligned
+    lcd_buffer_pages = align_up(size, 0x100000) / 4096;
+    lcd_buffer_page = cma_alloc(lcd_buffer_pages);
+    if (lcd_buffer_page == NULL) {
+        panic("Cannot allocate the LCD buffers");
+    }
+
+    u32 va = (u32)page_to_va(lcd_buffer_page);
+    assert((va & 0xFFFFF) == 0);
+
+    // The caches might still hold lines from the previous owner, which must
+    // not be written back over the buffers later
+    lcd_buffers_set_mem(STE_MEM_NON_CACHE);
+    clean_inv_range(va, va + lcd_buffer_pages * 4096);
 
-    // Allocate aligned 1MB in order to manipulate the page tables making the 
-    // LCD buffers non-cacheable
-    lcd_layers[0].buffer[0] = boot_alloc(pixels * sizeof(struct rgb),  0xFFFFF);
-    lcd_layers[0].buffer[1] = boot_alloc(pixels * sizeof(struct rgb),  32);
-    lcd_layers[1].buffer[0] = boot_alloc(pixels * sizeof(struct rgba),  32);
-    lcd_layers[1].buffer[1] = boot_alloc(pixels * sizeof(struct rgba),  32);
-    lcd_layers[2].buffer[0] = boot_alloc(pixels * sizeof(struct rgba),  32);
-    lcd_layers[2].buffer[1] = boot_alloc(pixels * sizeof(struct rgba),  32);
-
-    // We should probably set the size at this point indicating how much was
-    // allocated
     struct lcd_layer* layer = &lcd_layers[0];
     for (u32 i = 0; i < LAYERS; i++) {
+        layer->buffer[0] = (void *)va;
+        va += align_up(sizes[i], 32);
+        layer->buffer[1] = (void *)va;
+        va += align_up(sizes[i], 32);
+
         layer->info.h = SCREEN_Y;
         layer->info.w = SCREEN_X;
-        
-        if (i == 0)
-            layer->info.bpp = 3; // Layer 1 uses no alpha channel
-        else
-            layer->info.bpp = 4;
-        
+        layer->info.bpp = (i == 0) ? 3 : 4;
+
         layer++;
     }
+}
 
-    // Total size of memory
-    u32 size = ((u32)lcd_layers[2].buffer[1] + pixels * sizeof(struct rgba)) - 
-        (u32)lcd_layers[0].buffer[0];
-
-    u32 pages = align_up(size, 0xFFFFF) >> 20;
-
-    // Mark the 1M pages as non-cacheable. ASID matching is not nessecary 
-    // bacause they're in kernel space
-    struct ste_attr attr = {
-        .access = STE_ACCESS_FULL_ACC,
-        .mem = STE_MEM_NON_CACHE,
-        .domain = 15,
-        .nG = 0,
-        .xn = 0
-    };
+// Gives the layer buffers back to the contiguous memory area. Nothing has been
+// cached through the non-cacheable mapping, so the sections can be mapped as
+// normal memory again right away
+static void lcd_layers_free(void)
+{
+    lcd_buffers_set_mem(STE_MEM_WRITE_BACK);
+    cma_free(lcd_buffer_page, lcd_buffer_pages);
 
-    u32* va = lcd_layers[0].buffer[0];
-    for (u32 i = 0; i < pages; i++) {
-        mm_change_kernel_pt_attr(va, &attr);
-        va = (u32 *)((u8 *)va + 0x100000);
+    for (u32 i = 0; i < LAYERS; i++) {
+        lcd_layers[i].buffer[0] = NULL;
+        lcd_layers[i].buffer[1] = NULL;
     }
-
-    lcd_buffers_ready = 1;
+    lcd_buffer_page = NULL;
 }
 
 static void lcd_pin_init(void)
@@ -278,22 +310,20 @@ static void lcd_layer_init(void)
     for (u32 i = 0; i < LAYERS; i++) {
         for (u32 j = 0; j < 2; j++) {
 
+            // Link the DMA channel
+            layer->buffer_dma[j] = dma;
+
             // Compute the physical address of the DMA stuff
             layer->buffer_pa[j] = (u32)va_to_pa(layer->buffer[j]);
             layer->buffer_dma_pa[j] = (u32)va_to_pa(layer->buffer_dma[j]);
 
-            // Link the DMA channel
-            layer->buffer_dma[j] = dma;
-
             // Just clear the buffers
             mem_set(layer->buffer[j], 0x00, layer->info.bpp * layer->info.h *
                 layer->info.w);
 
             dma++;
         }
-        
-        // TODO remove - framebuffers is non-cacheable
-        dcache_clean();
+
         layer++;
     }
 
@@ -348,7 +378,7 @@ static void lcd_layer_enable(void)
 
             // Only the buffers are marked as non-cacheable so we still have to 
             // clean the DMA descriptor range
-            dcache_clean_range((u32)dma_desc, (u32)dma_desc + 
+            clean_range((u32)dma_desc, (u32)dma_desc + 
                 sizeof(struct lcd_dma_desc));
 
             dma_desc++;
@@ -413,6 +443,7 @@ void lcd_init(void)
     lcd_clock_init();
 
     // Initialize the layers
+    lcd_layers_alloc();
     lcd_layer_init();
 
     // Enable the layers
@@ -426,6 +457,19 @@ void lcd_init(void)
     lcd_set_brightness(0xFF);
 }
 
+// Turns the display off and gives the layer buffers back. The DMA channels
+// are stopped first so that nothing is fetched from the freed memory
+void lcd_exit(void)
+{
+    for (u32 i = 0; i < LAYERS; i++) {
+        lcd_layers[i].ctrl->CHDR = (1 << 0);
+        while (lcd_layers[i].ctrl->CHSR & (1 << 0));
+    }
+
+    lcd_off();
+    lcd_layers_free();
+}
+
 // Sets the display backlight intesnsity
 void lcd_set_brightness(u8 brightness)
 {
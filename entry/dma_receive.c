@@ -10,8 +10,11 @@
 #include <citrus/crc.h>
 #include <citrus/elf.h>
 #include <citrus/page_alloc.h>
+#include <citrus/vmalloc.h>
 #include <citrus/mem.h>
 #include <citrus/regmap.h>
+#include <citrus/mm_trace.h>
+#include <citrus/benchmark.h>
 
 #include <stdalign.h>
 
@@ -23,6 +26,14 @@
 #define CMD_SIZE  0x01
 #define CMD_RESET 0x02
 #define CMD_KILL  0x03
+#define CMD_MM_DUMP 0x04
+#define CMD_MM_CAPTURE 0x05
+#define CMD_REPLAY_SIZE 0x06
+#define CMD_BENCH 0x07
+
+// Benchmarks selected by the argument of the benchmark command
+#define BENCH_CTX_SWITCH 0
+#define BENCH_SCHED 1
 
 #define PACKET_ERROR 0x00 
 #define PACKET_OK    0x01
@@ -123,7 +134,7 @@ static void uart4_interrupt(void)
 
         // Since the DMA has trasferred to physical memory we have to invalidate
         // the memory
-        dcache_invalidate_range((u32)dma_buffer, (u32)(dma_buffer + DMA_BUFFER_SIZE));      
+        invalidate_range((u32)dma_buffer, (u32)(dma_buffer + DMA_BUFFER_SIZE));      
 
         // Do somethong with the buffer
         u32 status = process_packet((u8 *)dma_buffer, size);
@@ -169,29 +180,30 @@ static u8 process_packet(const u8* data, u32 size)
 }
 
 
-static volatile struct page* elf_page_buffer = NULL;
 static volatile u8* elf_buffer = NULL;
 static volatile u8* write_ptr = NULL;
 static volatile u32 elf_size = 0;
 
+// Set when the buffer holds an allocation trace instead of an ELF file
+static volatile u8 load_replay = 0;
+
+// The ELF file is copied into the process pages by elf_init, so the receive
+// buffer can be freed right after
 static void clear_elf_buffers(void)
 {
-    if (elf_page_buffer != NULL) {
-        //free_pages((struct page *)elf_page_buffer);
-    }
+    vfree((void *)elf_buffer);
     elf_buffer = NULL;
     write_ptr = NULL;
 }
 
+// The buffer only has to be virtually contiguous, so it costs the size of the
+// file rounded up to a page
 static void alloc_elf_buffers(u32 size)
 {
     clear_elf_buffers();
 
-    u32 order = bytes_to_order(size);
-    elf_page_buffer = alloc_pages(order);
-
-    if (elf_page_buffer != NULL) {
-        elf_buffer = page_to_va((struct page *)elf_page_buffer);
+    elf_buffer = vmalloc(size);
+    if (elf_buffer != NULL) {
         write_ptr = elf_buffer;
         elf_size = size;
     }
@@ -201,6 +213,39 @@ volatile u16 x = 0;
 volatile u16 y = 0;
 volatile u32 count = 0;
 
+// The allocation profile is too big for the print buffer, so the dump runs in
+// a thread which sleeps while the buffer drains
+static i32 mm_dump_thread(void* arg)
+{
+    mm_trace_dump();
+    return 0;
+}
+
+static i32 mm_capture_thread(void* arg)
+{
+    mm_trace_capture_dump();
+    return 0;
+}
+
+// Replays the trace outside of the interrupt and gives the buffer back
+static i32 replay_thread(void* arg)
+{
+    alloc_replay(arg, elf_size);
+    vfree(arg);
+    return 0;
+}
+
+// The benchmarks mask interrupts for a long time, so they run in a thread
+static i32 bench_thread(void* arg)
+{
+    if ((u32)arg == BENCH_CTX_SWITCH) {
+        context_switch_benchmark();
+    } else if ((u32)arg == BENCH_SCHED) {
+        sched_benchmark();
+    }
+    return 0;
+}
+
 static u8 handle_packet(const u8* data, u32 size, u8 cmd)
 {
     if (cmd == CMD_SIZE) {
@@ -210,15 +255,34 @@ static u8 handle_packet(const u8* data, u32 size, u8 cmd)
         }
         u32 s = read_le32(data);
         alloc_elf_buffers(s);
+        load_replay = 0;
+
+    } else if (cmd == CMD_REPLAY_SIZE) {
+        if (size != 4) {
+            panic("Size packet is not 32-bytes");
+            return 0;
+        }
+        alloc_elf_buffers(read_le32(data));
+        load_replay = 1;
 
     } else if (cmd == CMD_DATA) {
+        // The buffer allocation might have failed
+        if (write_ptr == NULL) {
+            return 0;
+        }
         for (u32 i = 0; i < size; i++) {
             *write_ptr++ = *data++;
         }
 
         if (size != 4096) {
             // Last or zero-length packet
-            elf_init((u8 *)elf_buffer, elf_size);
+            if (load_replay) {
+                create_kthread(replay_thread, 500, "replay",
+                    (void *)elf_buffer, SCHED_RT);
+                elf_buffer = NULL;
+            } else {
+                elf_init((u8 *)elf_buffer, elf_size);
+            }
             clear_elf_buffers();
         }
     } else if (cmd == CMD_RESET) {
@@ -242,6 +306,24 @@ static u8 handle_packet(const u8* data, u32 size, u8 cmd)
             u32 pid = read_le32(data);
             print("Killing thread with PID %d\n", pid);
         }
+    } else if (cmd == CMD_MM_DUMP) {
+        create_kthread(mm_dump_thread, 500, "mmdump", NULL, SCHED_RT);
+    } else if (cmd == CMD_MM_CAPTURE) {
+        if (size != 1) {
+            print("Error with capture command\n");
+        } else if (data[0]) {
+            mm_trace_capture_start();
+        } else {
+            mm_trace_capture_stop();
+            create_kthread(mm_capture_thread, 500, "mmcap", NULL, SCHED_RT);
+        }
+    } else if (cmd == CMD_BENCH) {
+        if (size != 1) {
+            print("Error with benchmark command\n");
+        } else {
+            create_kthread(bench_thread, 500, "bench", (void *)(u32)data[0],
+                SCHED_RT);
+        }
     }
 
     return 1;
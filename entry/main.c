@@ -26,6 +26,8 @@
 #include <citrus/pid.h>
 #include <citrus/mem.h>
 #include <citrus/gmac.h>
+#include <citrus/mm.h>
+#include <citrus/zram.h>
 
 #include <net/ip.h>
 #include <net/netbuf.h>
@@ -46,9 +48,10 @@ void early_init(void)
     irq_enable();
     async_abort_enable();
 
-    // Enable the L1 cache
+    // Enable the L1 and the L2 cache
     icache_enable();
     dcache_enable();
+    l2cache_init();
 
     // Enable access to FPU co-processors
     fpu_init();
@@ -59,6 +62,8 @@ void kernel_init(void)
 {
     mm_init();
     sched_init();
+    pt_cache_start();
+    zram_start();
     disk_init();
 }
 
@@ -155,7 +160,7 @@ void main(void)
     // Add the kernel threads / startup routines below 
     // ==================================================
 
-    create_kthread(tx, 5000, "net tx", NULL, SCHED_RT);
+    create_kthread(tx, 5000, "net tx", NULL, SCHED_RT | SCHED_PRIO(8));
     create_kthread(udp_test, 5000, "udp", NULL, SCHED_RT);
     create_kthread(tftp_test, 5000, "tftp", NULL, SCHED_RT);
     dhcp_init();
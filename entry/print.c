@@ -127,7 +127,7 @@ void flush_buffer(void)
         .ublock_len = state.curr_len
     };
 
-    dcache_clean_range((u32)state.curr_buf, (u32)(state.curr_buf + 
+    clean_range((u32)state.curr_buf, (u32)(state.curr_buf + 
         state.curr_len));
         
     // Swap the buffer
@@ -209,7 +209,7 @@ void print_dma_test(void)
         .ublock_len = len
     };
 
-    dcache_clean();
+    clean_range((u32)test, (u32)test + len);
     dma_submit_request(&req, ch);
 
 }
@@ -435,13 +435,23 @@ void draw_char(char c, const struct simple_font* font, struct rgba (*fb)[800], u
 
 void print_screen(const char* text, u16 x, u16 y, const struct simple_font* font, struct rgba (*fb)[800])
 {
+    // Track the rows touched so that only those are cleaned
+    i32 top = y;
+    i32 bottom = y;
+
     while (*text) {
         draw_char(*text, font, fb, x, y);
         struct glyph* g = font->glyph + *text - font->first;
+        if (y + g->y_off < top) {
+            top = y + g->y_off;
+        }
+        if (y + g->y_off + g->h > bottom) {
+            bottom = y + g->y_off + g->h;
+        }
         x += g->x_advance;
         text++;
     }
-    dcache_clean();
+    clean_range((u32)fb[top], (u32)fb[bottom]);
 }
 
 void font_test(void)
@@ -349,7 +349,7 @@ static void build_dma_transfer(struct screen* s)
     prev->next = NULL;
 
     // Clean the D-cache for the DMA descriptors
-    dcache_clean_range((u32)dma_desc_get_first(), (u32)(prev + 1));
+    clean_range((u32)dma_desc_get_first(), (u32)(prev + 1));
 }
 
 // Updates the screen object with a new screen buffer
@@ -423,6 +423,7 @@ void window_init(void)
     fill(d.fb.data, get_rgba(50, 0, 0xFF, 0xFF), 0, 0, 40, 40);
 
     dcache_clean();
+    l2cache_clean();
 
     add_window(&b, &screen);
     add_window(&a, &screen);
@@ -0,0 +1,17 @@
+// Copyright (C) strawberryhacker
+
+#include "host.h"
+#include <citrus/benchmark.h>
+#include <citrus/slab.h>
+
+// Runs the allocator benchmarks natively. The output has the same format as
+// on the board, with the cycles counted in ns
+int main(void)
+{
+    host_mm_init();
+    kmem_cache_init();
+
+    page_alloc_benchmark();
+    kmalloc_benchmark();
+    return 0;
+}
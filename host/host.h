@@ -0,0 +1,16 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <citrus/types.h>
+
+/// Number of pages in the host memory. This is placed at KERNEL_START, so that
+/// the allocators see the same addresses as on the board
+#define HOST_MM_PAGES 16384
+
+/// Maps in the host memory and sets up a buddy allocator over it, which serves
+/// alloc_pages and free_pages. Exits if the memory can not be mapped
+void host_mm_init(void);
+
+#endif
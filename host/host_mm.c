@@ -0,0 +1,162 @@
+// Copyright (C) strawberryhacker
+
+#include "host.h"
+#include <citrus/mm.h>
+#include <citrus/buddy_alloc.h>
+#include <citrus/page_alloc.h>
+#include <citrus/kmalloc.h>
+#include <citrus/vmalloc.h>
+#include <citrus/align.h>
+#include <citrus/print.h>
+#include <citrus/panic.h>
+#include <sys/mman.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The allocators keep addresses in 32-bit words, so the memory must be mapped
+// below 4 GiB. It is mapped at the kernel start like on the board. The page
+// structures are linked through 32-bit words as well, so they are placed right
+// after the memory
+static struct page* page_array;
+
+// The page allocator used to borrow the zones under test
+static struct mm_zone host_zone;
+static struct buddy_struct host_buddy;
+
+void host_mm_init(void)
+{
+    u32 size = HOST_MM_PAGES * (4096 + sizeof(struct page));
+    void* mem = mmap((void *)KERNEL_START, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (mem != (void *)KERNEL_START) {
+        fprintf(stderr, "Cannot map the host memory at %08X\n", KERNEL_START);
+        exit(1);
+    }
+    page_array = (struct page *)(KERNEL_START + HOST_MM_PAGES * 4096);
+
+    host_zone.alloc = &host_buddy;
+    host_zone.start = page_array;
+    host_zone.page_cnt = HOST_MM_PAGES;
+    if (buddy_alloc_init(&host_zone, 0) == 0) {
+        fprintf(stderr, "Cannot set up the host page allocator\n");
+        exit(1);
+    }
+}
+
+struct page* alloc_page(void)
+{
+    return buddy_alloc_pages(0, &host_zone);
+}
+
+struct page* alloc_pages(u32 order)
+{
+    return buddy_alloc_pages(order, &host_zone);
+}
+
+void free_pages(struct page* page)
+{
+    buddy_free_pages(page, &host_zone);
+}
+
+u32 bytes_to_order(u32 bytes)
+{
+    u32 pages = align_up(bytes, 4096) / 4096;
+
+    return __builtin_ctz(round_up_power_two(pages));
+}
+
+u32 pages_to_order(u32 pages)
+{
+    return __builtin_ctz(round_up_power_two(pages));
+}
+
+struct page* mm_get_page_array(void)
+{
+    return page_array;
+}
+
+void* page_to_va(struct page* page)
+{
+    u32 index = page - page_array;
+    return (void *)(KERNEL_START + (index * 4096));
+}
+
+void* page_to_pa(struct page* page)
+{
+    return va_to_pa(page_to_va(page));
+}
+
+struct page* va_to_page(void* page_addr)
+{
+    if ((u32)page_addr & 0xFFF) {
+        return NULL;
+    }
+    return page_array + ((u32)page_addr - KERNEL_START) / 4096;
+}
+
+struct page* pa_to_page(void* page_addr)
+{
+    return va_to_page(pa_to_va(page_addr));
+}
+
+// The kmalloc structures are not part of any measurement, so they come from
+// the host heap
+void* kmalloc(u32 size)
+{
+    return malloc(size);
+}
+
+void* kzmalloc(u32 size)
+{
+    return calloc(1, size);
+}
+
+void kfree(void* ptr)
+{
+    free(ptr);
+}
+
+void* vzmalloc(u32 size)
+{
+    return calloc(1, size);
+}
+
+void vfree(void* ptr)
+{
+    free(ptr);
+}
+
+// There is nothing to reclaim on the host
+void mm_add_reclaim(struct mm_reclaim* reclaim)
+{
+
+}
+
+void print(const char* data, ...)
+{
+    va_list args;
+    va_start(args, data);
+    vprintf(data, args);
+    va_end(args);
+}
+
+void panic_handler(const char* file, u32 line, const char* reason)
+{
+    fprintf(stderr, "Panic: %s:%u - %s\n", file, line, reason);
+    exit(1);
+}
+
+void warning_handler(const char* file, u32 line, const char* reason)
+{
+    fprintf(stderr, "Warning: %s:%u - %s\n", file, line, reason);
+}
+
+void assert_handler(const char* file, u32 line, u32 statement)
+{
+    if (statement == 0) {
+        fprintf(stderr, "Assert: %s:%u\n", file, line);
+        exit(1);
+    }
+}
@@ -0,0 +1,42 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <citrus/types.h>
+#include <citrus/print.h>
+
+/// Host version of the kernel atomic.h. The host tools are single threaded and
+/// have no interrupts, so masking is a no-op and exclusive stores never fail
+static inline u32 __atomic_enter(void)
+{
+    return 0;
+}
+
+static inline void __atomic_leave(u32 flags)
+{
+    (void)flags;
+}
+
+static inline u32 __ldrex(volatile u32* addr)
+{
+    return *addr;
+}
+
+static inline u32 __strex(u32 val, volatile u32* addr)
+{
+    *addr = val;
+    return 0;
+}
+
+static inline void __clrex(void)
+{
+
+}
+
+static inline void __atomic_add(volatile u32* addr, i32 val)
+{
+    *addr += val;
+}
+
+#endif
@@ -0,0 +1,23 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include <citrus/types.h>
+#include <time.h>
+
+/// Host version of the kernel cycle counter. It counts nanoseconds from the
+/// monotonic clock, so the cycle columns printed by the host tools are in ns
+static inline void cycle_counter_enable(void)
+{
+
+}
+
+static inline u32 cycle_counter_read(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+#endif
@@ -0,0 +1,42 @@
+// Copyright (C) strawberryhacker
+
+#include "host.h"
+#include <citrus/benchmark.h>
+#include <citrus/slab.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Replays a trace made by scripts/mm_replay.py natively. The output has the
+// same format as on the board, with the cycles counted in ns
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace>\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8* trace = malloc(size ? size : 1);
+    if (trace == NULL || fread(trace, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(file);
+
+    host_mm_init();
+    kmem_cache_init();
+
+    alloc_replay(trace, size);
+
+    free(trace);
+    return 0;
+}
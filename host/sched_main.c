@@ -0,0 +1,17 @@
+// Copyright (C) strawberryhacker
+
+#include "host.h"
+#include <citrus/benchmark.h>
+#include <citrus/sched.h>
+
+// The real-time class is measured on its own. The class below it is never
+// reached, since the benchmark only picks from the real-time queues
+const struct sched_class fair_class;
+
+// Runs the real-time pick-next benchmarks natively. The output has the same
+// format as on the board, with the cycles counted in ns
+int main(void)
+{
+    sched_benchmark();
+    return 0;
+}
@@ -1,11 +1,26 @@
-// Copyright (C) strawberryhacker
+/// Copyright (C) strawberryhacker
 
 #ifndef ASID_H
 #define ASID_H
 
 #include <citrus/types.h>
 
+struct mmap;
+
+/// The ASID is 8 bits. The context ID of a memory map holds the ASID in the
+/// low byte and the allocator generation in the upper bits. The value can be
+/// written directly to CONTEXTIDR
+#define ASID_BITS 8
+#define ASID_CNT (1 << ASID_BITS)
+#define ASID_MSK (ASID_CNT - 1)
+
 void asid_init(void);
-u8 get_asid(void);
+
+/// Makes sure the memory map has an ASID from the current generation. This is
+/// called by the scheduler before switching to the memory map
+void asid_switch(struct mmap* mm);
+
+/// Releases the ASID of a memory map and removes its TLB entries
+void asid_free(struct mmap* mm);
 
 #endif
@@ -10,4 +10,36 @@ void __print_cpsr(void);
 u32 __atomic_enter(void);
 void __atomic_leave(u32 flags);
 
+/// Exclusive load and store for lock-free updates. The exclusive monitor is
+/// cleared on every exception return, so the store fails if an interrupt or a
+/// context switch happened after the load. The store returns 0 on success
+static inline u32 __ldrex(volatile u32* addr)
+{
+    u32 val;
+    asm volatile ("ldrex %0, [%1]" : "=r" (val) : "r" (addr) : "memory");
+    return val;
+}
+
+static inline u32 __strex(u32 val, volatile u32* addr)
+{
+    u32 status;
+    asm volatile ("strex %0, %1, [%2]" : "=&r" (status) : "r" (val), "r" (addr)
+        : "memory");
+    return status;
+}
+
+static inline void __clrex(void)
+{
+    asm volatile ("clrex" : : : "memory");
+}
+
+/// Adds a value to a word without masking the interrupts
+static inline void __atomic_add(volatile u32* addr, i32 val)
+{
+    u32 tmp;
+    do {
+        tmp = __ldrex(addr) + val;
+    } while (__strex(tmp, addr));
+}
+
 #endif
@@ -3,7 +3,73 @@
 #ifndef BENCHMARK_H
 #define BENCHMARK_H
 
+#include <citrus/types.h>
+#include <citrus/cycle_counter.h>
+
+/// A named benchmark. The run function does its own setup and brackets the
+/// measured part with benchmark_begin and benchmark_end
+struct benchmark_ctx {
+    u32 start;
+    u32 cycles;
+
+    // Number of allocator operations done in the measured part
+    u32 ops;
+
+    // Free memory which can not be handed out as one block, in percent of the
+    // free memory after the run. Zero if the benchmark does not measure it
+    u32 frag;
+};
+
+struct benchmark {
+    const char* name;
+    void (*run)(struct benchmark_ctx* ctx);
+};
+
+static inline void benchmark_begin(struct benchmark_ctx* ctx)
+{
+    ctx->start = cycle_counter_read();
+}
+
+static inline void benchmark_end(struct benchmark_ctx* ctx)
+{
+    ctx->cycles += cycle_counter_read() - ctx->start;
+}
+
+/// Deterministic xorshift generator so that every run does the same sequence
+/// of operations
+static inline u32 benchmark_rand(u32* state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/// Runs a list of benchmarks with interrupts masked and prints one line per
+/// benchmark on the form
+///
+///     bench,<name>,<ops>,<cycles>,<cycles per op>,<frag %>
+void benchmark_run(const struct benchmark* bench, u32 cnt);
+
+/// Allocator benchmarks. These run against private zones borrowed from the
+/// page allocator, so the system allocators are not affected
 void page_alloc_benchmark(void);
 void kmalloc_benchmark(void);
 
+/// Replays an allocation trace made by scripts/mm_replay.py against the SLOB
+/// allocator, the slab caches and the buddy allocator, and prints the cost, the
+/// peak footprint and the fragmentation for each. Must be called from a kernel
+/// thread
+void alloc_replay(const u8* trace, u32 size);
+
+/// Compares the memory map switch with a full TLB flush against the ASID
+/// switch. Must be called from a kernel thread
+void context_switch_benchmark(void);
+
+/// Measures the real-time pick-next cost for a growing number of runnable
+/// threads. Must be called from a kernel thread
+void sched_benchmark(void);
+
 #endif
@@ -14,17 +14,63 @@ struct buddy_order {
     struct list_node free_list;
 };
 
+/// Set in the order field of the first page of every block on a free list
+#define BUDDY_FREE_BLOCK 0x80000000
+
+/// Orders below this are served from the page cache
+#define BUDDY_PCP_ORDERS 2
+
+/// The page cache is drained in batches when it holds more than BUDDY_PCP_HIGH
+/// blocks, and refilled in batches when it runs empty
+#define BUDDY_PCP_HIGH 32
+#define BUDDY_PCP_BATCH 8
+
+/// Cache of recently freed blocks for one order. Blocks are handed out LIFO so
+/// that the last freed (and most likely still cached) block is used first
+struct buddy_pcp {
+    struct list_node* head;
+
+    // Number of blocks on the stack. This is exact after a drain but might
+    // drift in between, since it is updated apart from the head
+    volatile u32 count;
+
+    // Statistics
+    volatile u32 hits;
+    volatile u32 misses;
+};
+
 /// This holds all information about the buddy alocator
 struct buddy_struct {
     struct buddy_order* orders;
     u32 max_orders;
 
+    // Summary bitmap where bit n is set if order n has a non-empty free list
+    u32 free_map;
+
     // Memory stats fields
     u32 used;
+
+    // Number of pages at the start of the zone which are never handed out.
+    // This covers the kernel image and the buddy metadata
+    u32 reserved;
+
+    // Per-order cache of hot blocks
+    struct buddy_pcp pcp[BUDDY_PCP_ORDERS];
 };
 
-u8 buddy_alloc_init(struct mm_zone* zone);
+u8 buddy_alloc_init(struct mm_zone* zone, u32 reserved);
 struct page* buddy_alloc_pages(u32 order, struct mm_zone* zone);
 void buddy_free_pages(struct page* page, struct mm_zone* zone);
 
+/// Returns the number of free blocks of one order
+u32 buddy_get_free_blocks(struct mm_zone* zone, u32 order);
+
+/// Returns the order of the free block holding a page, or -1 if the page is
+/// in use or in the page cache. The caller must have interrupts masked
+i32 buddy_free_order(struct mm_zone* zone, struct page* page);
+
+/// Gives the page cache back to the buddy lists so that the blocks can merge.
+/// The caller must have interrupts masked. Returns 1 if any page was cached
+u8 buddy_pcp_drain_all(struct mm_zone* zone);
+
 #endif
@@ -11,11 +11,38 @@ extern void icache_invalidate(void);
 
 extern void dcache_enable(void);
 extern void dcache_disable(void);
+
+/// Set/way operations on the entire L1 data cache. These do not reach the L2
+/// cache. Use the range operations below for buffers
 extern void dcache_clean(void);
-extern void dcache_clean_range(u32 start, u32 end);
 extern void dcache_invalidate(void);
-extern void dcache_invalidate_range(u32 start, u32 end);
 extern void dcache_clean_invalidate(void);
-extern void dcache_clean_invalidate_range(u32 start, u32 end);
+
+/// Size of one L1 cache line in bytes
+#define CACHE_LINE 32
+
+/// Range operations bigger than this falls back to set/way operations on the
+/// entire L1 cache. This is the size of the L1 data cache, where the two cost
+/// the same number of operations
+#define CACHE_RANGE_MAX (32 * 1024)
+
+/// Outer range operations bigger than this operates on all the L2 ways instead
+#define L2CACHE_RANGE_MAX (128 * 1024)
+
+/// The L2C-310 outer cache. The operations does nothing before it is enabled
+void l2cache_init(void);
+void l2cache_clean_range(u32 start, u32 end);
+void l2cache_inv_range(u32 start, u32 end);
+void l2cache_clean_inv_range(u32 start, u32 end);
+void l2cache_clean(void);
+void l2cache_clean_inv(void);
+
+/// Range based cache maintenance on kernel virtual addresses. The end address
+/// is exclusive. These operates down to the point of coherency, through both the
+/// L1 and the L2 cache, and complete with a barrier before returning
+void clean_range(u32 start, u32 end);
+void invalidate_range(u32 start, u32 end);
+void clean_inv_range(u32 start, u32 end);
+void icache_sync_range(u32 start, u32 end);
 
 #endif
@@ -0,0 +1,33 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef CMA_H
+#define CMA_H
+
+#include <citrus/types.h>
+
+struct page;
+struct mm_zone;
+
+/// The contiguous memory area is the top of the DDR. It is a buddy zone of its
+/// own which the normal page allocator never uses. While no driver needs it,
+/// the area is lent out to movable pages, which are the anonymous and the
+/// copy-on-write user pages. These are moved out again when a contiguous
+/// allocation can not be served
+#define CMA_PAGES 4096
+
+/// Sets up the area starting at the given page. Returns the zone so that the
+/// memory manager can track it
+struct mm_zone* cma_init(struct page* start);
+
+/// Allocates a run of physically contiguous pages, migrating user pages out of
+/// the area if needed. A block of 2^n pages is naturally aligned, so a
+/// multiple of 256 pages starts on a 1 MiB section. Returns NULL if the area
+/// can not hold the request. Must not be called from interrupt context
+struct page* cma_alloc(u32 pages);
+void cma_free(struct page* page, u32 pages);
+
+/// Allocates one page which may be moved later. The page is taken from the
+/// contiguous area if possible and from the normal page allocator if not
+struct page* alloc_movable_page(void);
+
+#endif
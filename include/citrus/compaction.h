@@ -0,0 +1,50 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include <citrus/types.h>
+
+struct mm_zone;
+
+/// Compaction moves the user pages out of one naturally aligned block of the
+/// page allocator, so that the free pages around them merge into a high-order
+/// block. It runs when a high-order allocation fails and from the idle thread
+
+/// Orders compacted for a failed allocation. The bigger orders would need
+/// more than a page for the migration table
+#define COMPACT_MIN_ORDER 2
+#define COMPACT_MAX_ORDER 8
+
+/// The idle thread compacts one block of COMPACT_IDLE_ORDER at most every
+/// COMPACT_IDLE_MS while the fragmentation index of that order is above
+/// COMPACT_IDLE_INDEX
+#define COMPACT_IDLE_ORDER 4
+#define COMPACT_IDLE_INDEX 50
+#define COMPACT_IDLE_MS 1000
+
+struct compact_stats {
+    u32 runs;
+    u32 failed;
+    u32 moved;
+
+    // Fragmentation index of the last run, before and after
+    u32 order;
+    u32 index_before;
+    u32 index_after;
+};
+
+/// Returns the percentage of the free memory in a zone which is in blocks too
+/// small for the order. A zero means that every free page can serve the order
+u32 compact_frag_index(struct mm_zone* zone, u32 order);
+
+/// Compacts the buddy zones until a free block of the order exists. Returns 1
+/// if a block was freed
+u8 compact_pages(u32 order);
+
+/// Called by the idle thread
+void compact_idle(void);
+
+void compact_get_stats(struct compact_stats* stats);
+
+#endif
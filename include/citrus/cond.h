@@ -0,0 +1,28 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef COND_H
+#define COND_H
+
+#include <citrus/types.h>
+#include <citrus/wait.h>
+#include <citrus/mutex.h>
+
+/// Condition variable used together with a mutex. A waiter must check its
+/// condition again after waking
+struct cond {
+    struct wait_queue wait;
+};
+
+void cond_init(struct cond* cond);
+
+/// Releases the mutex and blocks in one step, then takes the mutex again
+void cond_wait(struct cond* cond, struct mutex* mutex);
+
+/// Returns 0 if the timeout in ms fired before a signal. The mutex is held
+/// again in both cases
+u8 cond_wait_timeout(struct cond* cond, struct mutex* mutex, u32 ms);
+
+void cond_signal(struct cond* cond);
+void cond_broadcast(struct cond* cond);
+
+#endif
@@ -11,9 +11,17 @@
 // Gives a overflow every millisecond
 void cpu_timer_init(void);
 void cpu_timer_reset(void);
-void cpu_timer_clear_flags(void);
+void cpu_timer_start(void);
+
+// Clears the status. Returns 1 if a period ended since the last call
+u8 cpu_timer_clear_flags(void);
+
 u32 cpu_timer_get_value(void);
 u32 cpu_timer_get_value_us(void);
-void cpu_timer_start(void);
+
+// Sets the length of the current period without resetting the counter. The
+// period always ends a little after the current count. Returns the length
+// which was programmed in us
+u32 cpu_timer_set_period_us(u32 us);
 
 #endif
@@ -0,0 +1,29 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include <citrus/types.h>
+
+/// The host build has its own version of this header, which counts in ns
+
+/// Enables the PMU cycle counter. The counter runs at the CPU clock
+static inline void cycle_counter_enable(void)
+{
+    u32 pmcr;
+    asm volatile ("mrc p15, 0, %0, c9, c12, 0" : "=r" (pmcr));
+    asm volatile ("mcr p15, 0, %0, c9, c12, 0" : : "r" (pmcr | 0b101));
+    asm volatile ("mcr p15, 0, %0, c9, c12, 1" : : "r" (1 << 31));
+    asm volatile ("isb" : : : "memory");
+}
+
+/// Returns the current value of the PMU cycle counter
+static inline u32 cycle_counter_read(void)
+{
+    u32 cycles;
+    asm volatile ("isb" : : : "memory");
+    asm volatile ("mrc p15, 0, %0, c9, c13, 0" : "=r" (cycles));
+    return cycles;
+}
+
+#endif
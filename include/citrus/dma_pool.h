@@ -0,0 +1,65 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef DMA_POOL_H
+#define DMA_POOL_H
+
+#include <citrus/types.h>
+#include <citrus/list.h>
+
+/// Coherent memory for DMA descriptors and buffers. The memory is taken from
+/// the buddy allocator in 1 MiB sections which are remapped as non-cacheable,
+/// so no cache maintenance is needed. Every allocation is aligned to at least
+/// one cache line
+
+/// Number of 4 KiB pages in one non-cacheable section
+#define DMA_SECTION_PAGES 256
+
+/// Completely free sections kept before they are given back to the buddy
+/// allocator
+#define DMA_SECTION_MAX_FREE 1
+
+/// dma_alloc serves sizes up to this from the built-in pools. Bigger
+/// allocations get their own run of pages
+#define DMA_POOL_MIN_SHIFT 5
+#define DMA_POOL_MAX_SHIFT 11
+#define DMA_POOL_CLASSES (DMA_POOL_MAX_SHIFT - DMA_POOL_MIN_SHIFT + 1)
+
+/// Maximum number of objects in one pool page
+#define DMA_PAGE_MAX_OBJS (4096 >> DMA_POOL_MIN_SHIFT)
+
+/// A pool of equally sized objects. Every pool page is one 4 KiB page in a
+/// non-cacheable section
+struct dma_pool {
+    const char* name;
+
+    u32 size;
+    u32 stride;
+    u32 obj_per_page;
+
+    // Pages with some and with no free objects
+    struct list_node partial;
+    struct list_node full;
+
+    // Statistics
+    u32 used;
+    u32 page_cnt;
+};
+
+/// Must be called after the slab caches are running
+void dma_pool_init(void);
+
+/// Creates a pool of objects of the given size. The alignment is rounded up to
+/// a cache line and can be at most one page
+struct dma_pool* dma_pool_create(const char* name, u32 size, u32 align);
+
+/// Allocates one object from the pool. Returns NULL if out of memory
+void* dma_pool_alloc(struct dma_pool* pool);
+void dma_pool_free(struct dma_pool* pool, void* ptr);
+
+/// General purpose coherent allocation. Returns NULL if out of memory or if
+/// the size does not fit in a section
+void* dma_alloc(u32 size);
+void* dma_zalloc(u32 size);
+void dma_free(void* ptr);
+
+#endif
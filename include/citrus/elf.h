@@ -61,6 +61,7 @@ struct elf_prog_header {
     u32 align;
 };
 
-void elf_init(const u8* elf_data, u32 elf_size);
+/// Loads an ELF binary into a new process. Returns 0 if it could not be loaded
+u8 elf_init(const u8* elf_data, u32 elf_size);
 
 #endif
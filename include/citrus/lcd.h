@@ -46,9 +46,10 @@ struct rgba {
     u8 r;
 };
 
-void lcd_layers_alloc(void);
-
+/// The layer buffers are allocated from the contiguous memory area when the
+/// display is turned on, and given back by lcd_exit
 void lcd_init(void);
+void lcd_exit(void);
 
 void lcd_set_brightness(u8 brightness);
 
@@ -0,0 +1,23 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <citrus/types.h>
+
+/// The compressor keeps the last position of every 4-byte sequence in a hash
+/// table given by the caller. The positions are 16-bit, so the input can be
+/// at most 64 KiB
+#define LZ4_HASH_BITS 12
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_BITS)
+#define LZ4_MAX_INPUT 65535
+
+/// Compresses a block into the LZ4 block format. Returns the compressed size
+/// or 0 if it does not fit in `cap` bytes
+u32 lz4_compress(const void* src, u32 size, void* dest, u32 cap, u16* table);
+
+/// Decompresses an LZ4 block. Returns the decompressed size or -1 if the block
+/// is malformed or does not fit in `cap` bytes
+i32 lz4_decompress(const void* src, u32 size, void* dest, u32 cap);
+
+#endif
@@ -0,0 +1,21 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+#include <citrus/types.h>
+
+struct page;
+
+/// Moves the user pages in a run of pages to new pages outside the run. The
+/// user pages are the ones with a reference. Every user page table entry is
+/// pointed to the new copy, including the entries aged by zram. Pages which
+/// are not fully moved stay where they are, which always holds for the stack
+/// of the calling memory space. The copies are synchronized with
+/// the instruction cache before they are mapped, so moved code can run. The
+/// running thread is not preempted during the move, but the interrupts are
+/// only masked for short sections. Returns the number of pages freed in the
+/// run
+u32 migrate_user_pages(struct page* start, u32 cnt);
+
+#endif
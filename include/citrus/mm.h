@@ -29,13 +29,36 @@ static inline void* pa_to_va(void* pa)
     return pa_ptr;
 }
 
+struct kmem_slab;
+
 /// Main page descriptor. Keep this short
 struct page {
     u32* mem_map;
     u32 order;
     struct list_node node;
+
+    // Points to the slab header if the page is used by the slab allocator
+    struct kmem_slab* slab;
+
+    union {
+        // Number of user memory spaces mapping the page
+        u32 ref;
+
+        // Used and dirty level 2 page tables if this is a page table page
+        u32 pt_map;
+    };
 };
 
+/// Set in the order field of a page holding level 2 page tables. The table map
+/// shares space with the reference count, so this tells the two apart
+#define PAGE_PT_TABLE 0x40000000
+
+/// Returns 1 if the page is mapped by user memory spaces and can be moved
+static inline u8 page_is_movable(struct page* page)
+{
+    return page->ref && (page->order & PAGE_PT_TABLE) == 0;
+}
+
 /// Returns the kernel virtual base address for the page array continaing a
 /// struct page for every physical page
 struct page* mm_get_page_array(void);
@@ -64,6 +87,10 @@ struct mm_zone {
     u32 (*get_used)(struct mm_zone* zone);
     u32 (*get_free)(struct mm_zone* zone);
     u32 (*get_total)(struct mm_zone* zone);
+
+    // Page cache statistics. These are NULL if the allocator has no cache
+    u32 (*get_cache_hits)(struct mm_zone* zone);
+    u32 (*get_cache_misses)(struct mm_zone* zone);
 };
 
 /// Main mm structure used in the system. This will contain a list of all the
@@ -76,15 +103,42 @@ struct mm {
 
     // SLOB allocator zones
     struct list_node slob_zones;
+
+    // Buddy zones which only hold movable pages. This is the contiguous memory
+    // area
+    struct list_node movable_zones;
+
+    // Hooks called when a page allocation fails
+    struct list_node reclaim_list;
+};
+
+/// A reclaim hook is called when the page allocator runs out of memory. The
+/// hook should return as much memory as possible to the page allocator and
+/// return the number of pages freed
+struct mm_reclaim {
+    u32 (*reclaim)(u32 order);
+    struct list_node node;
 };
 
 void mm_init(void);
 
-/// Allocation of page tables
+void mm_add_reclaim(struct mm_reclaim* reclaim);
+
+/// Allocation of page tables. The level 2 page tables are packed four to a
+/// page and handed out zeroed from a cache refilled in the background
+void pt_cache_init(void);
+void pt_cache_start(void);
+
+/// Pool of zeroed pages filled by the idle thread. Returns 0 when there is
+/// nothing left to do
+void zero_pool_init(void);
+u8 zero_pool_refill(void);
+void zero_pool_drain_movable(void);
+
 struct page* lv1_pt_alloc(void);
-struct page* lv2_pt_alloc(void);
 void lv1_pt_free(struct page* page);
-void lv2_pt_free(struct page* page);
+u32* lv2_pt_alloc(void);
+void lv2_pt_free(u32* pt);
 
 /// Verious coprocessor accesses for page table management. Do NOT try to run
 /// this in user mode. This will trigger a UNDEF exception
@@ -120,14 +174,16 @@ static inline void mm_tlb_invalidate(void)
     asm volatile ("isb" : : : "memory");
 }
 
+/// Invalidates the TLB entries for one page. User pages are not global, so the
+/// ASID of the memory map must be given
+static inline void mm_tlb_invalidate_va(u32 virt_addr, u32 asid)
+{
+    u32 mva = (virt_addr & ~0xFFF) | (asid & 0xFF);
+    asm volatile ("mcr p15, 0, %0, c8, c7, 1" : : "r" (mva));
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+}
 
-/// Bitmap for the secondary level page table. Each page can store 3 secondary
-/// level page tables and this bit maps indicated which page tables whithin the
-/// page that are free. The first bit corresponds to l2 page table number 0 at
-/// offset page_addr + 1024
-struct pt2 {
-    u32 bitmap;
-};
 
 /// Every new process allocated a struct proc_mm from the kernel malloc. This
 /// will hold the memory space used by that process. Every child thread will
@@ -136,6 +192,9 @@ struct mmap {
     // Base address of the physical address space going into TTBR0 (must be first)
     u32* ttbr_phys;
 
+    // ASID and ASID generation going into CONTEXTIDR (must be second)
+    u32 context_id;
+
     // Virtual addresses to regions
     u32* data_s;
     u32* data_e;
@@ -146,14 +205,15 @@ struct mmap {
     u32* stack_s;
     u32* stack_e;
 
-    // List to keep track of all the pages alloated
-    struct list_node page_list;
+    // Number of pages used by the memory space
     u32 page_cnt;
 
-    // The kernel uses one page to store 3 secondary page tables. This holds the
-    // current page used for page table allocations. When a level 2 page table
-    // is requested and this is full it gets replaced with new allocated page
-    struct page* pt2_ptr;
+    // Number of page faults resolved by demand paging or copy-on-write
+    u32 fault_cnt;
+
+    // Last zram pass and the last migration which visited the memory space
+    u32 zram_seq;
+    u32 migrate_seq;
 };
 
 /// Contains the attributes for a level 2 page table entry
@@ -174,23 +234,33 @@ struct ste_attr {
     u8 domain : 4;
 };
 
-void lv2_pt_init(struct page* page);
-u32* lv2_pt_find_in_page(struct page* page);
-
-
-/// Adds a new allocated page to the memory manager. This will be placed in a
-/// linked list, so that we can kill a process and free the memory
-static inline void mm_process_add_page(struct page* page, struct mmap* mm)
-{
-    list_add_first(&page->node, &mm->page_list);
-}
-
 void mm_process_init(struct mmap* mm);
 
 u8 mm_map_in_pages(struct mmap* mm, struct page* page, u32 page_cnt,
     u32 virt_addr, struct pte_attr* attr);
 
-u32* set_break(u32 bytes);
+/// Moves the heap break of the current process by a number of bytes and
+/// returns the new break. Growing reserves whole pages which are mapped in on
+/// first touch. Shrinking unmaps and frees the whole pages past the new break
+u32* set_break(i32 bytes);
+
+/// Returns the level 2 page table entry for a user address. Returns NULL if no
+/// level 2 page table covers the address
+u32* mm_get_pte_ptr(struct mmap* mm, u32 virt_addr);
+
+/// Maps in a zeroed page on a translation fault in the heap or stack region.
+/// Returns 1 if the fault was handled
+u8 mm_handle_fault(struct mmap* mm, u32 addr);
+
+/// Gives the writer its own copy of a shared page on a write permission fault.
+/// Returns 1 if the fault was handled
+u8 mm_handle_cow_fault(struct mmap* mm, u32 addr);
+
+/// Makes `dst` a copy-on-write copy of the `src` memory space
+u8 mm_clone(struct mmap* dst, struct mmap* src);
+
+/// Drops the references to all the pages mapped in a user memory space
+void mm_release_pages(struct mmap* mm);
 
 /// Functions for gettting the total amount of allocated memory
 u32 mm_get_total_used(void);
@@ -199,4 +269,9 @@ u32 mm_get_total(void);
 // Functions for changing the attributes of a 1M page in the kernel page-table
 void mm_change_kernel_pt_attr(u32* virt_addr, struct ste_attr* attr);
 
+/// Maps single pages in the kernel space outside the linear map. The unmap
+/// returns the page which was mapped, and the caller must invalidate the TLB
+u8 mm_map_kernel_page(struct page* page, u32 virt_addr, struct pte_attr* attr);
+struct page* mm_unmap_kernel_page(u32 virt_addr);
+
 #endif
@@ -0,0 +1,83 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef MM_TRACE_H
+#define MM_TRACE_H
+
+#include <citrus/types.h>
+
+/// Records every kmalloc and page allocation together with the callsite and
+/// the owning thread. Every allocation and free masks interrupts to update the
+/// trace, so it is off unless the kernel is built with `make MM_TRACE=1`
+#ifndef MM_TRACE_ENABLE
+#define MM_TRACE_ENABLE 0
+#endif
+
+/// Number of events kept in the trace ring
+#define MM_TRACE_RING 256
+
+/// Number of distinct callsites with live totals
+#define MM_TRACE_SITES 64
+
+/// Number of live allocations which can be tracked back to a callsite.
+/// Allocations above this are counted as dropped
+#define MM_TRACE_LIVE 1024
+
+/// Size of the capture buffer as a page order. An order of 8 holds 65536
+/// events
+#define MM_TRACE_CAPTURE_ORDER 8
+
+enum mm_trace_type {
+    MM_TRACE_KMALLOC,
+    MM_TRACE_KFREE,
+    MM_TRACE_ALLOC_PAGES,
+    MM_TRACE_FREE_PAGES
+};
+
+/// One event in the trace ring. The size is in bytes for both kmalloc and
+/// page allocations
+struct mm_trace_event {
+    u32 site;
+    u32 ptr;
+    u32 size;
+    u16 pid;
+    u8 type;
+    u8 reserved;
+};
+
+/// Live totals for one callsite
+struct mm_trace_site {
+    u32 site;
+    u32 live_bytes;
+    u32 live_cnt;
+    u32 alloc_cnt;
+};
+
+#if MM_TRACE_ENABLE
+
+void mm_trace_alloc(u32 type, u32 site, void* ptr, u32 size);
+void mm_trace_free(u32 type, u32 site, void* ptr);
+
+/// Records every event into a separate capture buffer until it is stopped or
+/// the buffer is full. A new capture discards the previous one
+void mm_trace_capture_start(void);
+void mm_trace_capture_stop(void);
+
+/// Prints the captured events. Must be called from a thread
+void mm_trace_capture_dump(void);
+
+#else
+
+static inline void mm_trace_alloc(u32 type, u32 site, void* ptr, u32 size) {}
+static inline void mm_trace_free(u32 type, u32 site, void* ptr) {}
+static inline void mm_trace_capture_start(void) {}
+static inline void mm_trace_capture_stop(void) {}
+static inline void mm_trace_capture_dump(void) {}
+
+#endif
+
+/// Prints the callsite totals, the free block histogram of the buddy zones,
+/// the biggest free SLOB block and the trace ring. The callsites are printed as
+/// addresses which are symbolized on the host by scripts/mm_trace.py
+void mm_trace_dump(void);
+
+#endif
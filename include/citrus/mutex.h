@@ -0,0 +1,43 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <citrus/types.h>
+#include <citrus/list.h>
+#include <citrus/wait.h>
+
+struct thread;
+
+/// Sleeping lock with priority inheritance. While a real-time thread waits,
+/// the owner runs in the real-time class at the priority of the waiter. The
+/// boost follows a chain of blocked owners. The lock is handed straight to the
+/// first waiter on unlock. Must not be used from interrupt context
+struct mutex {
+    struct thread* owner;
+    struct wait_queue wait;
+
+    // Node in the list of mutexes held by the owner
+    struct list_node held;
+};
+
+/// Maximum length of a chain of blocked owners followed by the boost
+#define MUTEX_PI_DEPTH 16
+
+void mutex_init(struct mutex* mutex);
+void mutex_lock(struct mutex* mutex);
+void mutex_unlock(struct mutex* mutex);
+
+/// Takes the mutex if it is free. Returns 1 on success
+u8 mutex_trylock(struct mutex* mutex);
+
+/// Used by the condition variables. Releases the mutex without yielding, so
+/// the caller can block in the same atomic section. Returns the new owner
+struct thread* __mutex_unlock(struct mutex* mutex);
+
+/// Used when a thread blocked on a mutex is taken out of the wait queue
+/// without getting the mutex. The owner loses the boost given by the thread.
+/// The caller must have interrupts masked
+void mutex_waiter_removed(struct thread* thread);
+
+#endif
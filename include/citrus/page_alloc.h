@@ -11,6 +11,22 @@ struct page* alloc_page(void);
 struct page* alloc_pages(u32 order);
 void free_pages(struct page* page);
 
+/// Allocates pages which are zeroed and written to memory. These are served
+/// from a pool zeroed in the background when possible
+struct page* alloc_zeroed_page(void);
+struct page* alloc_zeroed_pages(u32 order);
+
+/// Allocates a zeroed page for a user mapping. The page may be moved later
+struct page* alloc_zeroed_movable_page(void);
+
+/// User pages are reference counted. The page is freed when the last memory
+/// space drops its reference
+void get_page(struct page* page);
+void put_page(struct page* page);
+
+/// Splits a block into single pages which can be freed one by one
+void split_pages(struct page* page, u32 order);
+
 u32 bytes_to_order(u32 bytes);
 u32 pages_to_order(u32 pages);
 
@@ -6,5 +6,6 @@
 #include <citrus/types.h>
 
 struct page* process_mm_init(struct thread* thread, u32 stack_size);
+void process_mm_free(struct thread* thread);
 
 #endif
@@ -15,13 +15,15 @@
 #define STE_SECTION_XN (1 << 4)
 #define STE_SECTION_nG (1 << 17)
 
+/// TEX remap is enabled, so the memory type is given by the TEX[0], C and B
+/// bits which index the PRRR and NMRR registers set up in the entry code
 enum ste_mem {
     STE_MEM_STRONGLY_ORDERD = ((0b000 << 12) | (0b00 << 2)),
     STE_MEM_SHARABLE        = ((0b000 << 12) | (0b01 << 2)),
     STE_MEM_WRITE_THROUGH   = ((0b000 << 12) | (0b10 << 2)),
     STE_MEM_WRITE_BACK      = ((0b000 << 12) | (0b11 << 2)),
     STE_MEM_NON_CACHE       = ((0b001 << 12) | (0b00 << 2)),
-    STE_MEM_NON_SHAREABLE   = ((0b010 << 12) | (0b00 << 2))
+    STE_MEM_WRITE_ALLOC     = ((0b001 << 12) | (0b01 << 2))
 };
 
 enum ste_access {
@@ -40,15 +42,19 @@ enum ste_access {
 #define PTE_XN (1 << 0)
 #define PTE_nG (1 << 11)
 
+/// Write alloc is write-back write-allocate in both the L1 and the L2 cache
 enum pte_mem {
     PTE_MEM_STRONGLY_ORDERD = ((0b000 << 6) | (0b00 << 2)),
     PTE_MEM_SHARABLE        = ((0b000 << 6) | (0b01 << 2)),
     PTE_MEM_WRITE_THROUGH   = ((0b000 << 6) | (0b10 << 2)),
     PTE_MEM_WRITE_BACK      = ((0b000 << 6) | (0b11 << 2)),
     PTE_MEM_NON_CACHE       = ((0b001 << 6) | (0b00 << 2)),
-    PTE_MEM_NON_SHAREABLE   = ((0b010 << 6) | (0b00 << 2))
+    PTE_MEM_WRITE_ALLOC     = ((0b001 << 6) | (0b01 << 2))
 };
 
+// Mask for the access permission bits in a page table entry
+#define PTE_ACCESS_MSK ((1 << 9) | (0b11 << 4))
+
 enum pte_access {
     PTE_ACCESS_NO_ACC       = ((0 << 9) | (0b00 << 4)),
     PTE_ACCESS_PRIV_ACC     = ((0 << 9) | (0b01 << 4)),
@@ -78,7 +84,6 @@ enum pte_access {
 #define LV1_PT_SECTION_WRITE_THROUGH     (0b000 << 12) | (0b10 << 2)
 #define LV1_PT_SECTION_WRITE_BACK        (0b000 << 12) | (0b11 << 2)
 #define LV1_PT_SECTION_NON_CACHE         (0b001 << 12) | (0b00 << 2)
-#define LV1_PT_SECTION_NON_SHAREABLE     (0b010 << 12) | (0b00 << 2)
 
 // Pointer to the secondary page table 
 #define LV1_PT_PTR 0b01
@@ -104,6 +109,5 @@ enum pte_access {
 #define LV2_PT_SECTION_WRITE_THROUGH     (0b000 << 6) | (0b10 << 2)
 #define LV2_PT_SECTION_WRITE_BACK        (0b000 << 6) | (0b11 << 2)
 #define LV2_PT_SECTION_NON_CACHE         (0b001 << 6) | (0b00 << 2)
-#define LV2_PT_SECTION_NON_SHAREABLE     (0b010 << 6) | (0b00 << 2)
 
 #endif
@@ -0,0 +1,62 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <citrus/types.h>
+#include <stddef.h>
+
+/// Intrusive red-black tree. Like the list interface the node is embedded in
+/// the object, and the object is found from the node offset. The tree does
+/// not compare keys; the caller walks down the tree to find the place of a
+/// new node, links it in and lets rb_insert_color balance the tree
+struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    u32 color;
+};
+
+struct rb_root {
+    struct rb_node* node;
+};
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+/// Returns a pointer to the struct entry in which the node is embedded
+#define rb_get_entry(node, type, member) \
+    ((type *)((u8 *)(node) - offsetof(type, member)))
+
+static inline void rb_init(struct rb_root* root)
+{
+    root->node = NULL;
+}
+
+static inline u8 rb_is_empty(struct rb_root* root)
+{
+    return root->node == NULL;
+}
+
+/// Links a new node in at the place found by the caller. `link` is the child
+/// pointer in the parent, or the root pointer if the tree is empty
+static inline void rb_link_node(struct rb_node* node, struct rb_node* parent,
+    struct rb_node** link)
+{
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+/// Rebalances the tree after a node is linked in
+void rb_insert_color(struct rb_node* node, struct rb_root* root);
+
+/// Removes a node from the tree
+void rb_erase(struct rb_node* node, struct rb_root* root);
+
+/// Returns the leftmost node, or NULL if the tree is empty
+struct rb_node* rb_first(struct rb_root* root);
+
+#endif
@@ -364,10 +364,10 @@ struct l2cache_reg {
     _rw u32 ECFGR0;
     _rw u32 EVR1;
     _rw u32 EVR0;
-    __r u32 IMR;
+    _rw u32 IMR;
     __r u32 MISR;
     __r u32 RISR;
-    __r u32 ICR;
+    __w u32 ICR;
     __r u32 RESERVED3[323];
     _rw u32 CSR;
     __r u32 RESERVED4[15];
@@ -395,7 +395,9 @@ struct l2cache_reg {
     _rw u32 POWCR;
 };
 
-#define L2CAHCE ((struct l2cache_reg *)0x00A00000)
+/// The controller is at physical address 0x00A00000 in the user half of the
+/// address space. The entry code maps it into the kernel half at this address
+#define L2CACHE ((struct l2cache_reg *)0xFFE00000)
 
 /// True random number generator
 struct trng_reg {
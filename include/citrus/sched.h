@@ -3,20 +3,48 @@
 
 #include <citrus/types.h>
 #include <citrus/list.h>
+#include <citrus/rbtree.h>
 
-// Main real-time runqueue 
+/// Number of real-time priority levels. A higher level runs first
+#define RT_PRIO_LEVELS 32
+
+// Main real-time runqueue. Every priority level has its own round-robin queue,
+// and bit n in the ready bitmap is set if queue n is non-empty
 struct rt_rq {
-    struct list_node queue;
+    u32 ready;
+    struct list_node queue[RT_PRIO_LEVELS];
 };
 
+/// The fair class runs the thread with the smallest virtual runtime, which is
+/// the runtime scaled by the weight of the nice level. All values are in us
+#define FAIR_NICE_MIN -20
+#define FAIR_NICE_MAX 19
+#define FAIR_NICE_0_WEIGHT 1024
+
+/// The running thread is only preempted when it is this far ahead
+#define FAIR_GRANULARITY 1000
+
+/// A thread which wakes up is placed at most this far behind the others
+#define FAIR_SLEEP_CREDIT 3000
+
+// Fair runqueue. The runnable threads are sorted on the virtual runtime
 struct fair_rq {
-    struct list_node queue;
+    struct rb_root tree;
+    u64 min_vruntime;
+
+    // Thread picked last. It is charged for its runtime on the next pick
+    struct thread* curr;
 };
 
 struct back_rq {
     struct list_node queue;
 };
 
+/// While at most one thread is runnable the timer is programmed for the next
+/// wake-up instead of every slice. The period is kept within these bounds in us
+#define SCHED_MIN_PERIOD 100
+#define SCHED_MAX_PERIOD 1000000
+
 // Main idle runqueue 
 struct idle_rq {
     struct thread* idle;
@@ -30,6 +58,10 @@ struct time {
     volatile u64 tick;
     volatile u64 tick_to_wake;
 
+    // Length of the current timer period in us. The tick is only periodic
+    // while threads compete for the CPU
+    volatile u32 period;
+
     // Reset every second i.e. when the tick_window is bigger than 1M us
     volatile u32 tick_window;
     volatile u32 window;
@@ -62,9 +94,6 @@ struct rq {
     // List all the threads in the system 
     struct list_node thread_list;
 
-    // Keep a sorted list of sleeping threads 
-    struct list_node sleep_list;
-
     struct time time;
 
     u32 sched_enable;
@@ -89,12 +118,18 @@ struct sched_class {
 void sched_init(void);
 void sched_start(void);
 
-/// Put the current runing thread to sleep for a number of us
+/// Put the current runing thread to sleep for a number of ms
 void sched_thread_sleep(u32 ms);
 
+/// Tells the scheduler that the timer wheel needs to run at the given tick
+void sched_set_deadline(u64 tick);
+
 // Currently this is a single core operating system so we only use one runqueue
 struct rq* get_rq(void);
 
+/// Stops the scheduler from preempting the running thread and returns the old
+/// state, which is given back to sched_enable. The timers and the interrupts
+/// still run, and the thread can still block or yield
 u32 sched_disable(void);
 
 void sched_enable(u32 i);
@@ -117,6 +152,25 @@ void sched_set_lazy_fpu_user(struct thread* thread);
 
 struct thread* sched_get_lazy_fpu_user(void);
 
+/// Removes a thread from the scheduler and frees it. A thread blocked on a
+/// mutex is taken out of the queue first. The caller must have interrupts
+/// masked
 u8 sched_kill_thread(struct thread* thread);
 
+/// Changes the real-time priority of a thread. The thread is moved to the new
+/// queue if it is runnable. Returns 0 if the priority is out of range
+u8 sched_set_prio(struct thread* thread, u32 prio);
+
+/// Returns the real-time priority plus one, or 0 for a thread outside the
+/// real-time class. This orders the waiters and drives priority inheritance
+u32 sched_pi_prio(struct thread* thread);
+
+/// Sets the priority inherited through the mutexes a thread holds, using the
+/// scale above. A thread with a non-zero priority runs in the real-time class
+void sched_set_pi_prio(struct thread* thread, u32 prio);
+
+/// Changes the nice level of a thread in the fair class. Returns 0 if the
+/// level is out of range
+u8 sched_set_nice(struct thread* thread, i32 nice);
+
 #endif
@@ -3,14 +3,29 @@
 #ifndef SEM_H
 #define SEM_H
 
-#include <citrus/sem.h>
-#include <citrus/list.h>
+#include <citrus/types.h>
+#include <citrus/wait.h>
 
+/// Counting semaphore. It can be posted from interrupt context
 struct sem {
-    u32 lock;
-    struct list_head wait_list;
-}
+    u32 count;
+    struct wait_queue wait;
+};
+
+void sem_init(struct sem* sem, u32 count);
 
 void sem_wait(struct sem* sem);
 
+/// Returns 0 if the timeout in ms fired before the semaphore was taken
+u8 sem_wait_timeout(struct sem* sem, u32 ms);
+
+/// Returns 1 if the semaphore was taken without blocking
+u8 sem_trywait(struct sem* sem);
+
+/// Posts from thread context. The caller yields if a woken thread outranks it
+void sem_post(struct sem* sem);
+
+/// Posts from interrupt context
+void sem_post_irq(struct sem* sem);
+
 #endif
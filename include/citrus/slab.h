@@ -0,0 +1,93 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <citrus/types.h>
+#include <citrus/list.h>
+
+/// Minimum object alignment in number of bytes. This matches the SLOB
+#define SLAB_ALIGN 8
+
+/// The slab allocator never uses blocks bigger than this order
+#define SLAB_MAX_ORDER 3
+
+/// Number of completely free slabs a cache keeps before returning the pages to
+/// the buddy allocator
+#define SLAB_MAX_EMPTY 1
+
+/// The kmalloc size classes goes from 16 bytes to 2 KiB in powers of two. Any
+/// bigger allocations are served by the SLOB allocator
+#define KMALLOC_MIN_SHIFT 4
+#define KMALLOC_MAX_SHIFT 11
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+#define KMALLOC_MAX_SLAB (1 << KMALLOC_MAX_SHIFT)
+
+/// Every slab is a buddy block of 2^order pages. This header is placed at the
+/// start of the block and is followed by the objects
+struct kmem_slab {
+    struct kmem_cache* cache;
+    struct page* page;
+
+    // First free object in the slab. The free objects are linked together
+    void* free;
+    u32 inuse;
+
+    // Node in one of the cache partial / full / empty lists
+    struct list_node node;
+};
+
+/// One cache is used per object size. All the objects in the cache have the
+/// same size and are allocated from the cache slabs
+struct kmem_cache {
+    const char* name;
+
+    // Size of each object and the distance between two objects in the slab
+    u32 obj_size;
+    u32 obj_stride;
+
+    // Offset of the free pointer within an object. This is placed after the
+    // object if a constructor is used, so that the object stays constructed
+    u32 free_offset;
+
+    // Slab geometry
+    u32 order;
+    u32 obj_per_slab;
+    u32 obj_offset;
+
+    // Optional constructor called once for every object when a slab is made
+    void (*ctor)(void* obj);
+
+    // Slabs with some, none and only free objects
+    struct list_node partial;
+    struct list_node full;
+    struct list_node empty;
+    u32 empty_cnt;
+
+    // Statistics
+    u32 used;
+    u32 slab_cnt;
+
+    // Node in the global cache list
+    struct list_node cache_node;
+};
+
+void kmem_cache_init(void);
+
+struct kmem_cache* kmem_cache_create(const char* name, u32 size, u32 align,
+    void (*ctor)(void *));
+
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+
+/// Releases the empty slabs in a cache. Returns the number of pages released
+u32 kmem_cache_shrink(struct kmem_cache* cache);
+
+/// Returns the kmalloc cache used for a given size. Returns NULL if the size
+/// should be served by the SLOB allocator
+struct kmem_cache* kmalloc_get_cache(u32 size);
+
+/// Returns the slab the object belongs to, or NULL if it is not slab memory
+struct kmem_slab* kmem_get_slab(const void* obj);
+
+#endif
@@ -37,4 +37,7 @@ u8 slob_init(struct mm_zone* zone);
 void* slob_alloc(u32 size, struct mm_zone* zone);
 void slob_free(void* ptr, struct mm_zone* zone);
 
+/// Returns the biggest allocation the zone can serve in number of bytes
+u32 slob_get_largest(struct mm_zone* zone);
+
 #endif
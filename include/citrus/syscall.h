@@ -8,10 +8,17 @@
 #include <citrus/thread.h>
 #include <citrus/pid.h>
 
+struct wait_queue;
+
 #define SYSCALL_SLEEP         0
 #define SYSCALL_CREATE_THREAD 1
 #define SYSCALL_SBRK          2
 #define SYSCALL_KILL          3
+#define SYSCALL_CLONE_PROCESS 4
+#define SYSCALL_SET_PRIO      5
+#define SYSCALL_SET_NICE      6
+#define SYSCALL_WAIT          7
+#define SYSCALL_YIELD         8
 
 #define __svc_attr __attribute__((naked)) __attribute__((noinline))
 
@@ -20,8 +27,26 @@ void __svc_attr syscall_thread_sleep(u32 ms);
 i32 __svc_attr syscall_create_thread(pid_t* pid, u32 (*func)(void *),
     u32 stack_words, const char* name, void* args, u32 flags);
 
-u32 __svc_attr syscall_sbrk(u32 bytes);
+u32 __svc_attr syscall_sbrk(i32 bytes);
 
 void __svc_attr syscall_kill(struct thread* thread);
 
+struct thread* __svc_attr syscall_clone_process(i32 (*func)(void *),
+    u32 stack_words, const char* name, void* args, u32 flags);
+
+/// Sets the real-time priority of the calling thread. Returns 0 if the
+/// priority is out of range
+u32 __svc_attr syscall_set_prio(u32 prio);
+
+/// Sets the nice level of the calling thread. Returns 0 if the level is out
+/// of range
+u32 __svc_attr syscall_set_nice(i32 nice);
+
+/// Blocks the calling thread on a wait queue. Use the wait queue functions
+/// instead of calling this directly
+void __svc_attr syscall_wait(struct wait_queue* wq, u32 ms);
+
+/// Gives the CPU to the highest priority runnable thread
+void __svc_attr syscall_yield(void);
+
 #endif
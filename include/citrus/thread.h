@@ -5,9 +5,13 @@
 
 #include <citrus/types.h>
 #include <citrus/list.h>
+#include <citrus/rbtree.h>
+#include <citrus/timer_wheel.h>
 #include <citrus/mm.h>
 
 struct sched_class;
+struct wait_queue;
+struct mutex;
 
 /// Thread flags
 #define SCHED_RT    0b000
@@ -15,6 +19,18 @@ struct sched_class;
 #define SCHED_BACK  0b010
 #define SCHED_IDLE  0b011
 
+/// The real-time priority goes in the thread flags next to the class, e.g.
+/// SCHED_RT | SCHED_PRIO(8). Priority 0 is the default and the lowest
+#define SCHED_PRIO_POS 3
+#define SCHED_PRIO_MSK (0b11111 << SCHED_PRIO_POS)
+#define SCHED_PRIO(prio) (((prio) << SCHED_PRIO_POS) & SCHED_PRIO_MSK)
+
+/// The nice level of a fair thread is given the same way, e.g. SCHED_FAIR |
+/// SCHED_NICE(-5). The level is stored as a 6-bit two's complement number
+#define SCHED_NICE_POS 8
+#define SCHED_NICE_MSK (0b111111 << SCHED_NICE_POS)
+#define SCHED_NICE(nice) (((nice) << SCHED_NICE_POS) & SCHED_NICE_MSK)
+
 #define THREAD_MAX_NAME 32
 
 // Thread states
@@ -45,8 +61,12 @@ struct thread {
     // Base address for the stack
     u32* stack_base;
 
-    // Tick to wake 
-    u64 tick_to_wake;
+    // Wakes the thread when it sleeps or when a wait times out
+    struct timer sleep_timer;
+
+    // Wait queue the thread is blocked on in THREAD_WAIT
+    struct wait_queue* wait_queue;
+    u8 wait_timed_out;
 
     u64 runtime;
     u64 last_runtime;
@@ -65,6 +85,26 @@ struct thread {
 
     const struct sched_class* class;
 
+    // Real-time priority. Only used by the real-time class
+    u32 rt_prio;
+
+    // Priority inheritance. The base class and priority are the ones asked
+    // for. The class and the priority above are raised to the inherited
+    // priority while the thread holds a mutex a real-time thread waits for
+    const struct sched_class* base_class;
+    u32 base_prio;
+    u32 pi_prio;
+    struct list_node pi_held;
+    struct mutex* pi_blocked;
+
+    // Fair class state. The start is the runtime when the thread was last
+    // charged
+    struct rb_node fair_node;
+    u64 vruntime;
+    u64 fair_start;
+    i32 nice;
+    u8 fair_queued;
+
     // Pointer to the process and list all threads within a process 
     struct thread* process;
     struct list_node thread_group;
@@ -83,9 +123,14 @@ struct thread* create_process(i32 (*func)(void *), u32 stack_size,
 struct thread* create_thread(i32 (*func)(void *), u32 stack_size, 
     const char* name, void* args, u32 flags);
 
+// Do not use except in a process syscall
+struct thread* clone_process(i32 (*func)(void *), u32 stack_size,
+    const char* name, void* args, u32 flags);
+
 void map_in_code(struct page* code_page, u32 pages, struct thread* t);
 
-void curr_thread_add_pages(struct page* page, u32 pages);
+void curr_thread_add_pages(u32 pages);
+void curr_thread_sub_pages(u32 pages);
 
 struct mmap* get_curr_mm_process(void);
 
@@ -0,0 +1,59 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <citrus/types.h>
+#include <citrus/list.h>
+
+/// The wheel counts time in jiffies of 2^10 us. A timeout is rounded up to the
+/// next jiffy, so a timer never fires early
+#define TIMER_JIFFY_SHIFT 10
+
+/// Every level has 64 slots, and a slot on level n covers 64^n jiffies. The
+/// four levels reach about 4.7 hours. Longer timeouts are cut to the range
+#define TIMER_LEVELS     4
+#define TIMER_SLOT_BITS  6
+#define TIMER_SLOTS      (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK  (TIMER_SLOTS - 1)
+
+/// Kernel timer. The callback runs from the scheduler tick with interrupts
+/// masked, so it must be short and must not sleep. Waking a thread is fine
+struct timer {
+    struct list_node node;
+    u64 expires;
+
+    void (*func)(void* arg);
+    void* arg;
+
+    // Slot number on the wheel, where the level is the upper bits
+    u16 slot;
+    u8 pending;
+};
+
+/// Sets up a timer which is not pending
+void timer_setup(struct timer* timer, void (*func)(void *), void* arg);
+
+/// Starts a timer which fires in a number of ms. The timer must not be pending
+void timer_add(struct timer* timer, u32 ms);
+
+/// Restarts a timer whether it is pending or not. Returns 1 if it was pending
+u8 timer_mod(struct timer* timer, u32 ms);
+
+/// Stops a timer. Returns 1 if it was pending and 0 if it had fired already
+u8 timer_del(struct timer* timer);
+
+static inline u8 timer_pending(struct timer* timer)
+{
+    return timer->pending;
+}
+
+/// Used by the scheduler. The time is the kernel tick in us
+void timer_wheel_init(u64 now);
+void timer_run(u64 now);
+
+/// Returns the kernel tick where the wheel next needs to run, or 0 if no timer
+/// is pending. This can be early when a timer waits on an upper level
+u64 timer_next_event(void);
+
+#endif
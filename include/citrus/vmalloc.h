@@ -0,0 +1,23 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <citrus/types.h>
+
+/// Kernel virtual area for big allocations which only have to be virtually
+/// contiguous. It sits above the linear map of the DDR and below the IO
+/// mappings at 0xA0000000
+#define VMALLOC_START 0x90000000
+#define VMALLOC_END   0xA0000000
+
+void vmalloc_init(void);
+
+/// Allocates a virtually contiguous buffer backed by single pages, so that the
+/// size is only rounded up to a whole page. The memory is cacheable and can
+/// not be used for DMA. Returns NULL if out of memory or virtual space
+void* vmalloc(u32 size);
+void* vzmalloc(u32 size);
+void vfree(void* ptr);
+
+#endif
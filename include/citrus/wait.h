@@ -0,0 +1,62 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <citrus/types.h>
+#include <citrus/list.h>
+#include <citrus/atomic.h>
+
+struct thread;
+
+/// Threads blocked on an event. The waiters are kept in priority order, so the
+/// highest real-time priority is woken first, and equal priorities are FIFO
+struct wait_queue {
+    struct list_node threads;
+};
+
+void wait_queue_init(struct wait_queue* wq);
+
+/// Blocks the current thread in THREAD_WAIT until it is woken. The caller must
+/// have interrupts masked from the condition check to this call, so that no
+/// wake-up is lost. Interrupts are still masked when the call returns
+void wait_queue_wait(struct wait_queue* wq);
+
+/// Same as above with a timeout in ms, where 0 waits forever. Returns 0 if the
+/// timeout fired first
+u8 wait_queue_wait_timeout(struct wait_queue* wq, u32 ms);
+
+/// Wakes the first waiter or all of them. These can be called from interrupt
+/// context. A woken thread does not preempt the caller before the next tick.
+/// Returns the first thread woken, or NULL if the queue was empty
+struct thread* wait_queue_wake_one(struct wait_queue* wq);
+struct thread* wait_queue_wake_all(struct wait_queue* wq);
+
+/// Yields the CPU if a woken thread outranks the current one. Only for thread
+/// context
+void wait_preempt(struct thread* woken);
+
+static inline u8 wait_queue_empty(struct wait_queue* wq)
+{
+    return list_is_empty(&wq->threads);
+}
+
+/// Blocks the current thread until the condition is true
+#define wait_event(wq, cond) do {                  \
+    u32 __wait_atomic = __atomic_enter();          \
+    while (!(cond)) {                              \
+        wait_queue_wait(wq);                       \
+    }                                              \
+    __atomic_leave(__wait_atomic);                 \
+} while (0)
+
+/// Used by the SVC handler
+void wait_block(struct wait_queue* wq, u32 ms);
+
+/// Takes a blocked thread out of its wait queue without waking it
+void wait_queue_remove(struct thread* thread);
+
+/// Moves a waiter to the position given by its current priority
+void wait_queue_requeue(struct wait_queue* wq, struct thread* thread);
+
+#endif
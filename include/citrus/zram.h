@@ -0,0 +1,90 @@
+/// Copyright (C) strawberryhacker
+
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <citrus/types.h>
+#include <citrus/pt_entry.h>
+
+struct mmap;
+
+/// Compressed in-memory swap for the anonymous user pages. A background
+/// thread ages the private heap and stack pages when memory runs low, and
+/// compresses the pages which have not been touched since the last pass
+
+/// Maximum number of pages in the store
+#define ZRAM_SLOTS 16384
+
+/// Pages which do not compress below this are left in memory
+#define ZRAM_MAX_SIZE 3072
+
+/// The background thread starts aging pages when less than this many pages
+/// are free, and compresses at most ZRAM_BATCH pages per pass
+#define ZRAM_LOW_PAGES 1024
+#define ZRAM_BATCH 64
+#define ZRAM_PERIOD_MS 200
+
+/// User page table entries which are not present. The two lowest bits are
+/// zero, so any access faults
+///
+///  - an old entry still owns the page but has lost its mapping. If the page
+///    is touched before the next pass it is mapped in again
+///  - a swap entry holds the slot index of the compressed page
+#define ZRAM_PTE_OLD  (1 << 2)
+#define ZRAM_PTE_SWAP (1 << 3)
+
+static inline u8 zram_pte_is_old(u32 pte)
+{
+    return (pte & 0b11) == 0 && (pte & ZRAM_PTE_OLD);
+}
+
+static inline u8 zram_pte_is_swap(u32 pte)
+{
+    return (pte & 0b11) == 0 && (pte & ZRAM_PTE_SWAP);
+}
+
+struct zram_stats {
+    // Pages in the store and the number of these which were all zero. The
+    // zero pages take no memory
+    u32 stored;
+    u32 zero;
+
+    // Memory used by the compressed pages
+    u32 comp_bytes;
+
+    u32 swap_outs;
+    u32 swap_ins;
+
+    // Pages which did not compress well enough
+    u32 rejected;
+
+    // Old pages which were touched again before they were compressed
+    u32 minor_faults;
+
+    // Time spent decompressing pages in the fault handler in CPU cycles
+    u32 fault_cycles;
+    u32 fault_cycles_max;
+};
+
+/// Must be called after vmalloc_init
+void zram_init(void);
+
+/// Starts the background thread and the reclaim hook. Must be called after
+/// the scheduler is initialized
+void zram_start(void);
+
+/// Handles a translation fault on an old or a swap entry. Returns 1 if the
+/// access can be restarted
+u8 zram_fault(struct mmap* mm, u32 addr, u32* pte);
+
+/// Turns an old entry back into a valid page table entry
+u32 zram_pte_restore(u32 pte);
+
+/// Takes and drops a reference to the slot of a swap entry. Memory spaces made
+/// by a clone share the slot until they fault the page in
+void zram_pte_get(u32 pte);
+void zram_pte_put(u32 pte);
+
+void zram_get_stats(struct zram_stats* stats);
+
+#endif
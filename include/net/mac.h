@@ -9,7 +9,8 @@
 
 void mac_init(void);
 
-void mac_receive(void);
+/// Passes one received frame up the stack. Returns non-zero if there was none
+i32 mac_receive(void);
 
 void mac_send(struct netbuf* buf, u32 dest_ip, u32 src_ip, u16 type, 
     u8 broadcast);
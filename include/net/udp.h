@@ -4,6 +4,7 @@
 #include <citrus/types.h>
 #include <net/netbuf.h>
 #include <citrus/list.h>
+#include <citrus/wait.h>
 
 // This is the main UDP module
 struct udp {
@@ -19,6 +20,9 @@ struct udp_port {
     struct list_node node;
     struct list_node packets;
 
+    // Readers blocked on an empty port
+    struct wait_queue wait;
+
     u16 port;
 };
 
@@ -32,8 +36,12 @@ void udp_handle(struct netbuf* buf);
 
 void udp_listen(u16 port);
 
+/// Blocks until a packet arrives on a port
 struct netbuf* udp_rec(u16 port);
 
+/// Same as above with a timeout in ms. Returns NULL if the timeout fired
+struct netbuf* udp_rec_timeout(u16 port, u32 ms);
+
 void udp_send(struct netbuf* buf, u32 ip, u16 port, u8 flags);
 
 void udp_send_from(struct netbuf* buf, u32 dest_ip, u32 src_ip, u16 src_port, u16 dest_port, u8 flags);
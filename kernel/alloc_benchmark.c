@@ -0,0 +1,529 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/benchmark.h>
+#include <citrus/slob.h>
+#include <citrus/slab.h>
+#include <citrus/buddy_alloc.h>
+#include <citrus/page_alloc.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// The private SLOB zone is 256 KiB and the private buddy zone is 1 MiB
+#define SLOB_BENCH_ORDER  6
+#define BUDDY_BENCH_ORDER 8
+
+// Number of live allocations kept by the benchmarks
+#define BENCH_SLOTS 128
+
+// Number of operations in the long running fragmentation benchmarks
+#define BENCH_LONG_OPS 8192
+
+// Number of rounds in the fixed size churn benchmarks
+#define BENCH_ROUNDS 16
+
+// Object sizes used by the mixed benchmarks. These are picked with equal
+// weight and cover the small control structures, the ARP entries, the PID
+// tables, the thread structs, the file structs and the network buffers
+static const u32 mixed_sizes[] = {
+    16, 24, 40, 64, 96, 160, 256, 512, 640, 1300, 1536, 2048
+};
+
+#define MIXED_SIZES (sizeof(mixed_sizes) / sizeof(mixed_sizes[0]))
+
+#define SLOB_BENCH_MIN 8
+#define SLOB_BENCH_MAX 1024
+#define BUDDY_BENCH_MAX_ORDER 3
+
+static struct mm_zone bench_zone;
+static struct slob_struct bench_slob;
+static struct buddy_struct bench_buddy;
+
+static void* bench_slots[BENCH_SLOTS];
+
+// Borrows a block from the page allocator and sets it up as a SLOB zone
+static void slob_bench_setup(void)
+{
+    struct page* page = alloc_pages(SLOB_BENCH_ORDER);
+    assert(page);
+
+    bench_zone.alloc = &bench_slob;
+    bench_zone.start = page;
+    bench_zone.page_cnt = 1 << SLOB_BENCH_ORDER;
+    assert(slob_init(&bench_zone));
+
+    for (u32 i = 0; i < BENCH_SLOTS; i++) {
+        bench_slots[i] = NULL;
+    }
+}
+
+static void slob_bench_teardown(void)
+{
+    free_pages(bench_zone.start);
+}
+
+static inline u32 slob_bench_size(u32* seed)
+{
+    return SLOB_BENCH_MIN + benchmark_rand(seed) %
+        (SLOB_BENCH_MAX - SLOB_BENCH_MIN);
+}
+
+// Allocates and frees the same size over and over again
+static void slob_bench_fixed(struct benchmark_ctx* ctx)
+{
+    slob_bench_setup();
+
+    benchmark_begin(ctx);
+    for (u32 r = 0; r < BENCH_ROUNDS; r++) {
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            bench_slots[i] = slob_alloc(64, &bench_zone);
+        }
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            slob_free(bench_slots[i], &bench_zone);
+        }
+    }
+    benchmark_end(ctx);
+
+    ctx->ops = 2 * BENCH_ROUNDS * BENCH_SLOTS;
+    slob_bench_teardown();
+}
+
+// Replaces a random live allocation with one of a random size
+static u32 slob_bench_churn(u32 ops, u32* seed)
+{
+    u32 done = 0;
+    for (u32 i = 0; i < ops; i++) {
+        u32 slot = benchmark_rand(seed) % BENCH_SLOTS;
+        if (bench_slots[slot]) {
+            slob_free(bench_slots[slot], &bench_zone);
+            done++;
+        }
+        bench_slots[slot] = slob_alloc(slob_bench_size(seed), &bench_zone);
+        done++;
+    }
+    return done;
+}
+
+static void slob_bench_free_all(void)
+{
+    for (u32 i = 0; i < BENCH_SLOTS; i++) {
+        if (bench_slots[i]) {
+            slob_free(bench_slots[i], &bench_zone);
+            bench_slots[i] = NULL;
+        }
+    }
+}
+
+static void slob_bench_random(struct benchmark_ctx* ctx)
+{
+    u32 seed = 0x12345678;
+    slob_bench_setup();
+
+    benchmark_begin(ctx);
+    ctx->ops = slob_bench_churn(BENCH_SLOTS * BENCH_ROUNDS, &seed);
+    benchmark_end(ctx);
+
+    slob_bench_free_all();
+    slob_bench_teardown();
+}
+
+// Allocates random sizes and frees them in the reverse or the same order. The
+// zone might run full, so the failed allocations are skipped
+static void slob_bench_order(struct benchmark_ctx* ctx, u8 lifo)
+{
+    u32 seed = 0x9E3779B9;
+    slob_bench_setup();
+
+    benchmark_begin(ctx);
+    for (u32 r = 0; r < BENCH_ROUNDS; r++) {
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            bench_slots[i] = slob_alloc(slob_bench_size(&seed), &bench_zone);
+        }
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            u32 slot = (lifo) ? BENCH_SLOTS - 1 - i : i;
+            if (bench_slots[slot]) {
+                slob_free(bench_slots[slot], &bench_zone);
+            }
+        }
+    }
+    benchmark_end(ctx);
+
+    ctx->ops = 2 * BENCH_ROUNDS * BENCH_SLOTS;
+    slob_bench_teardown();
+}
+
+static void slob_bench_lifo(struct benchmark_ctx* ctx)
+{
+    slob_bench_order(ctx, 1);
+}
+
+static void slob_bench_fifo(struct benchmark_ctx* ctx)
+{
+    slob_bench_order(ctx, 0);
+}
+
+// Finds the biggest allocation the SLOB zone can serve
+static u32 slob_bench_largest(u32 free)
+{
+    u32 lo = 0;
+    u32 hi = free;
+
+    while (lo < hi) {
+        u32 mid = (lo + hi + 1) / 2;
+        void* ptr = slob_alloc(mid, &bench_zone);
+        if (ptr) {
+            slob_free(ptr, &bench_zone);
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Long running random churn. The live allocations are kept, and the free space
+// which is not part of the biggest free block is reported as fragmentation
+static void slob_bench_frag(struct benchmark_ctx* ctx)
+{
+    u32 seed = 0xDEADBEEF;
+    slob_bench_setup();
+
+    benchmark_begin(ctx);
+    ctx->ops = slob_bench_churn(BENCH_LONG_OPS, &seed);
+    benchmark_end(ctx);
+
+    u32 free = bench_zone.get_free(&bench_zone);
+    if (free) {
+        ctx->frag = 100 - slob_bench_largest(free) * 100 / free;
+    }
+
+    slob_bench_free_all();
+    slob_bench_teardown();
+}
+
+// Borrows a block from the page allocator and sets it up as a buddy zone
+static void buddy_bench_setup(void)
+{
+    struct page* page = alloc_pages(BUDDY_BENCH_ORDER);
+    assert(page);
+
+    bench_zone.alloc = &bench_buddy;
+    bench_zone.start = page;
+    bench_zone.page_cnt = 1 << BUDDY_BENCH_ORDER;
+    assert(buddy_alloc_init(&bench_zone, 0));
+
+    for (u32 i = 0; i < BENCH_SLOTS; i++) {
+        bench_slots[i] = NULL;
+    }
+}
+
+static void buddy_bench_teardown(void)
+{
+    free_pages(bench_zone.start);
+}
+
+static void buddy_bench_fixed(struct benchmark_ctx* ctx)
+{
+    buddy_bench_setup();
+
+    benchmark_begin(ctx);
+    for (u32 r = 0; r < BENCH_ROUNDS; r++) {
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            bench_slots[i] = buddy_alloc_pages(0, &bench_zone);
+        }
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            buddy_free_pages(bench_slots[i], &bench_zone);
+        }
+    }
+    benchmark_end(ctx);
+
+    ctx->ops = 2 * BENCH_ROUNDS * BENCH_SLOTS;
+    buddy_bench_teardown();
+}
+
+static u32 buddy_bench_churn(u32 ops, u32* seed)
+{
+    u32 done = 0;
+    for (u32 i = 0; i < ops; i++) {
+        u32 slot = benchmark_rand(seed) % BENCH_SLOTS;
+        if (bench_slots[slot]) {
+            buddy_free_pages(bench_slots[slot], &bench_zone);
+            done++;
+        }
+        u32 order = benchmark_rand(seed) % (BUDDY_BENCH_MAX_ORDER + 1);
+        bench_slots[slot] = buddy_alloc_pages(order, &bench_zone);
+        done++;
+    }
+    return done;
+}
+
+static void buddy_bench_free_all(void)
+{
+    for (u32 i = 0; i < BENCH_SLOTS; i++) {
+        if (bench_slots[i]) {
+            buddy_free_pages(bench_slots[i], &bench_zone);
+            bench_slots[i] = NULL;
+        }
+    }
+}
+
+static void buddy_bench_random(struct benchmark_ctx* ctx)
+{
+    u32 seed = 0x12345678;
+    buddy_bench_setup();
+
+    benchmark_begin(ctx);
+    ctx->ops = buddy_bench_churn(BENCH_SLOTS * BENCH_ROUNDS, &seed);
+    benchmark_end(ctx);
+
+    buddy_bench_free_all();
+    buddy_bench_teardown();
+}
+
+static void buddy_bench_order(struct benchmark_ctx* ctx, u8 lifo)
+{
+    u32 seed = 0x9E3779B9;
+    buddy_bench_setup();
+
+    benchmark_begin(ctx);
+    for (u32 r = 0; r < BENCH_ROUNDS; r++) {
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            u32 order = benchmark_rand(&seed) % (BUDDY_BENCH_MAX_ORDER + 1);
+            bench_slots[i] = buddy_alloc_pages(order, &bench_zone);
+        }
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            u32 slot = (lifo) ? BENCH_SLOTS - 1 - i : i;
+            if (bench_slots[slot]) {
+                buddy_free_pages(bench_slots[slot], &bench_zone);
+            }
+        }
+    }
+    benchmark_end(ctx);
+
+    ctx->ops = 2 * BENCH_ROUNDS * BENCH_SLOTS;
+    buddy_bench_teardown();
+}
+
+static void buddy_bench_lifo(struct benchmark_ctx* ctx)
+{
+    buddy_bench_order(ctx, 1);
+}
+
+static void buddy_bench_fifo(struct benchmark_ctx* ctx)
+{
+    buddy_bench_order(ctx, 0);
+}
+
+// Finds the biggest block the buddy zone can serve, in bytes
+static u32 buddy_bench_largest(void)
+{
+    for (i32 order = bench_buddy.max_orders - 1; order >= 0; order--) {
+        struct page* page = buddy_alloc_pages(order, &bench_zone);
+        if (page) {
+            buddy_free_pages(page, &bench_zone);
+            return 4096 << order;
+        }
+    }
+    return 0;
+}
+
+static void buddy_bench_frag(struct benchmark_ctx* ctx)
+{
+    u32 seed = 0xDEADBEEF;
+    buddy_bench_setup();
+
+    benchmark_begin(ctx);
+    ctx->ops = buddy_bench_churn(BENCH_LONG_OPS, &seed);
+    benchmark_end(ctx);
+
+    u32 free = bench_zone.get_free(&bench_zone);
+    if (free) {
+        ctx->frag = 100 - buddy_bench_largest() / (free / 100);
+    }
+
+    buddy_bench_free_all();
+    buddy_bench_teardown();
+}
+
+// The mixed benchmarks run the same sequence of kmalloc sizes through the slab
+// caches and through the SLOB allocator
+struct mixed_alloc {
+    void (*setup)(void);
+    void (*teardown)(void);
+    void* (*alloc)(u32 size);
+    void (*free)(void* ptr);
+};
+
+static void* slob_mixed_alloc(u32 size)
+{
+    return slob_alloc(size, &bench_zone);
+}
+
+static void slob_mixed_free(void* ptr)
+{
+    slob_free(ptr, &bench_zone);
+}
+
+// The slab caches are the ones used by kmalloc
+static void slab_mixed_setup(void)
+{
+    for (u32 i = 0; i < BENCH_SLOTS; i++) {
+        bench_slots[i] = NULL;
+    }
+}
+
+static void slab_mixed_teardown(void)
+{
+    for (u32 i = 0; i < KMALLOC_CLASSES; i++) {
+        kmem_cache_shrink(kmalloc_get_cache(1 << (i + KMALLOC_MIN_SHIFT)));
+    }
+}
+
+static void* slab_mixed_alloc(u32 size)
+{
+    return kmem_cache_alloc(kmalloc_get_cache(size));
+}
+
+static void slab_mixed_free(void* ptr)
+{
+    kmem_cache_free(kmem_get_slab(ptr)->cache, ptr);
+}
+
+static const struct mixed_alloc slob_mixed = {
+    .setup    = slob_bench_setup,
+    .teardown = slob_bench_teardown,
+    .alloc    = slob_mixed_alloc,
+    .free     = slob_mixed_free
+};
+
+static const struct mixed_alloc slab_mixed = {
+    .setup    = slab_mixed_setup,
+    .teardown = slab_mixed_teardown,
+    .alloc    = slab_mixed_alloc,
+    .free     = slab_mixed_free
+};
+
+static inline u32 mixed_size(u32* seed)
+{
+    return mixed_sizes[benchmark_rand(seed) % MIXED_SIZES];
+}
+
+static void mixed_free_all(const struct mixed_alloc* alloc)
+{
+    for (u32 i = 0; i < BENCH_SLOTS; i++) {
+        if (bench_slots[i]) {
+            alloc->free(bench_slots[i]);
+            bench_slots[i] = NULL;
+        }
+    }
+}
+
+// Long running churn where a random live object is replaced by a new one
+static void mixed_bench_churn(struct benchmark_ctx* ctx,
+    const struct mixed_alloc* alloc)
+{
+    u32 seed = 0xC0FFEE11;
+    alloc->setup();
+
+    benchmark_begin(ctx);
+    for (u32 i = 0; i < BENCH_LONG_OPS; i++) {
+        u32 slot = benchmark_rand(&seed) % BENCH_SLOTS;
+        if (bench_slots[slot]) {
+            alloc->free(bench_slots[slot]);
+            ctx->ops++;
+        }
+        bench_slots[slot] = alloc->alloc(mixed_size(&seed));
+        ctx->ops++;
+    }
+    benchmark_end(ctx);
+
+    mixed_free_all(alloc);
+    alloc->teardown();
+}
+
+// Allocates a burst of objects and frees them in a random order, like a
+// network burst or a number of threads exiting
+static void mixed_bench_burst(struct benchmark_ctx* ctx,
+    const struct mixed_alloc* alloc)
+{
+    u32 seed = 0x5EED1234;
+    alloc->setup();
+
+    benchmark_begin(ctx);
+    for (u32 r = 0; r < BENCH_ROUNDS; r++) {
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            bench_slots[i] = alloc->alloc(mixed_size(&seed));
+        }
+        for (u32 i = 0; i < BENCH_SLOTS; i++) {
+            u32 slot = benchmark_rand(&seed) % BENCH_SLOTS;
+            if (bench_slots[slot]) {
+                alloc->free(bench_slots[slot]);
+                bench_slots[slot] = NULL;
+            }
+        }
+        mixed_free_all(alloc);
+    }
+    benchmark_end(ctx);
+
+    ctx->ops = 2 * BENCH_ROUNDS * BENCH_SLOTS;
+    alloc->teardown();
+}
+
+static void slob_bench_mixed(struct benchmark_ctx* ctx)
+{
+    mixed_bench_churn(ctx, &slob_mixed);
+}
+
+static void slab_bench_mixed(struct benchmark_ctx* ctx)
+{
+    mixed_bench_churn(ctx, &slab_mixed);
+}
+
+static void slob_bench_burst(struct benchmark_ctx* ctx)
+{
+    mixed_bench_burst(ctx, &slob_mixed);
+}
+
+static void slab_bench_burst(struct benchmark_ctx* ctx)
+{
+    mixed_bench_burst(ctx, &slab_mixed);
+}
+
+static const struct benchmark slob_benchmarks[] = {
+    { "slob_fixed",  slob_bench_fixed  },
+    { "slob_random", slob_bench_random },
+    { "slob_lifo",   slob_bench_lifo   },
+    { "slob_fifo",   slob_bench_fifo   },
+    { "slob_frag",   slob_bench_frag   }
+};
+
+static const struct benchmark mixed_benchmarks[] = {
+    { "slob_mixed", slob_bench_mixed },
+    { "slab_mixed", slab_bench_mixed },
+    { "slob_burst", slob_bench_burst },
+    { "slab_burst", slab_bench_burst }
+};
+
+static const struct benchmark buddy_benchmarks[] = {
+    { "buddy_fixed",  buddy_bench_fixed  },
+    { "buddy_random", buddy_bench_random },
+    { "buddy_lifo",   buddy_bench_lifo   },
+    { "buddy_fifo",   buddy_bench_fifo   },
+    { "buddy_frag",   buddy_bench_frag   }
+};
+
+// Runs the buddy allocator benchmarks
+void page_alloc_benchmark(void)
+{
+    benchmark_run(buddy_benchmarks,
+        sizeof(buddy_benchmarks) / sizeof(buddy_benchmarks[0]));
+}
+
+// Runs the SLOB allocator benchmarks, followed by the slab caches and the SLOB
+// allocator on the same mixed kmalloc workloads
+void kmalloc_benchmark(void)
+{
+    benchmark_run(slob_benchmarks,
+        sizeof(slob_benchmarks) / sizeof(slob_benchmarks[0]));
+    benchmark_run(mixed_benchmarks,
+        sizeof(mixed_benchmarks) / sizeof(mixed_benchmarks[0]));
+}
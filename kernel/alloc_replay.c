@@ -0,0 +1,377 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/benchmark.h>
+#include <citrus/mm_trace.h>
+#include <citrus/slob.h>
+#include <citrus/slab.h>
+#include <citrus/buddy_alloc.h>
+#include <citrus/page_alloc.h>
+#include <citrus/atomic.h>
+#include <citrus/print.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// The trace is made by scripts/mm_replay.py from a capture. The frees refer to
+// the allocation by a slot number instead of the pointer, so the replay only
+// needs a flat slot array
+#define REPLAY_MAGIC 0x50524D4D
+
+struct replay_header {
+    u32 magic;
+    u32 op_cnt;
+    u32 slot_cnt;
+    u32 reserved;
+};
+
+// The type is the mm trace event type
+struct replay_op {
+    u16 type;
+    u16 reserved;
+    u32 slot;
+    u32 size;
+};
+
+// The private zones are big enough to hold the peak of a normal workload.
+// Allocations which do not fit are counted as failed
+#define SLOB_REPLAY_ORDER  10
+#define BUDDY_REPLAY_ORDER 12
+
+// An allocator under test. It only sees the events of its own kind
+struct replay_alloc {
+    const char* name;
+    u32 alloc_type;
+    u32 free_type;
+
+    void (*setup)(void);
+    void (*teardown)(void);
+    void* (*alloc)(u32 size);
+    void (*free)(void* ptr);
+
+    // Biggest block which can be allocated in number of bytes
+    u32 (*largest)(void);
+
+    // Memory taken by the allocator in number of bytes, including overhead
+    u32 (*used)(void);
+};
+
+struct replay_result {
+    u32 ops;
+    u32 failed;
+    u32 peak_live;
+    u32 peak_used;
+    u32 peak_frag;
+    u32 end_frag;
+};
+
+static struct mm_zone replay_zone;
+static struct slob_struct replay_slob;
+static struct buddy_struct replay_buddy;
+
+static void slob_replay_setup(void)
+{
+    struct page* page = alloc_pages(SLOB_REPLAY_ORDER);
+    assert(page);
+
+    replay_zone.alloc = &replay_slob;
+    replay_zone.start = page;
+    replay_zone.page_cnt = 1 << SLOB_REPLAY_ORDER;
+    assert(slob_init(&replay_zone));
+}
+
+static void* slob_replay_alloc(u32 size)
+{
+    return slob_alloc(size, &replay_zone);
+}
+
+static void slob_replay_free(void* ptr)
+{
+    slob_free(ptr, &replay_zone);
+}
+
+static u32 slob_replay_largest(void)
+{
+    return slob_get_largest(&replay_zone);
+}
+
+static void buddy_replay_setup(void)
+{
+    struct page* page = alloc_pages(BUDDY_REPLAY_ORDER);
+    assert(page);
+
+    replay_zone.alloc = &replay_buddy;
+    replay_zone.start = page;
+    replay_zone.page_cnt = 1 << BUDDY_REPLAY_ORDER;
+    assert(buddy_alloc_init(&replay_zone, 0));
+}
+
+static void* buddy_replay_alloc(u32 size)
+{
+    return buddy_alloc_pages(bytes_to_order(size), &replay_zone);
+}
+
+static void buddy_replay_free(void* ptr)
+{
+    buddy_free_pages(ptr, &replay_zone);
+}
+
+static u32 buddy_replay_largest(void)
+{
+    for (i32 order = replay_buddy.max_orders - 1; order >= 0; order--) {
+        if (buddy_get_free_blocks(&replay_zone, order)) {
+            return 4096 << order;
+        }
+    }
+    return 0;
+}
+
+static void replay_teardown(void)
+{
+    free_pages(replay_zone.start);
+}
+
+static u32 replay_zone_used(void)
+{
+    return replay_zone.get_total(&replay_zone) -
+        replay_zone.get_free(&replay_zone);
+}
+
+// The slab replay mirrors kmalloc, where the small sizes go to the slab caches
+// and the rest to the SLOB allocator. The caches are private copies of the
+// kmalloc size classes, so that the system allocations do not show up in the
+// footprint. They are made once and shrunk after every run
+static struct kmem_cache* replay_caches[KMALLOC_CLASSES];
+
+static void slab_replay_setup(void)
+{
+    slob_replay_setup();
+
+    for (u32 i = 0; i < KMALLOC_CLASSES; i++) {
+        if (replay_caches[i] == NULL) {
+            replay_caches[i] = kmem_cache_create("replay",
+                1 << (i + KMALLOC_MIN_SHIFT), SLAB_ALIGN, NULL);
+            assert(replay_caches[i]);
+        }
+    }
+}
+
+static void slab_replay_teardown(void)
+{
+    for (u32 i = 0; i < KMALLOC_CLASSES; i++) {
+        kmem_cache_shrink(replay_caches[i]);
+    }
+    replay_teardown();
+}
+
+static void* slab_replay_alloc(u32 size)
+{
+    if (size == 0 || size > KMALLOC_MAX_SLAB) {
+        return slob_alloc(size, &replay_zone);
+    }
+
+    u32 shift = KMALLOC_MIN_SHIFT;
+    if (size > (1 << KMALLOC_MIN_SHIFT)) {
+        shift = 32 - __builtin_clz(size - 1);
+    }
+    return kmem_cache_alloc(replay_caches[shift - KMALLOC_MIN_SHIFT]);
+}
+
+static void slab_replay_free(void* ptr)
+{
+    struct kmem_slab* slab = kmem_get_slab(ptr);
+    if (slab) {
+        kmem_cache_free(slab->cache, ptr);
+    } else {
+        slob_free(ptr, &replay_zone);
+    }
+}
+
+// The slab pages come from the page allocator and are added to the SLOB zone
+static u32 slab_replay_used(void)
+{
+    u32 used = replay_zone_used();
+    for (u32 i = 0; i < KMALLOC_CLASSES; i++) {
+        used += replay_caches[i]->slab_cnt * (4096 << replay_caches[i]->order);
+    }
+    return used;
+}
+
+static const struct replay_alloc replay_allocs[] = {
+    {
+        .name       = "slob",
+        .alloc_type = MM_TRACE_KMALLOC,
+        .free_type  = MM_TRACE_KFREE,
+        .setup      = slob_replay_setup,
+        .teardown   = replay_teardown,
+        .alloc      = slob_replay_alloc,
+        .free       = slob_replay_free,
+        .largest    = slob_replay_largest,
+        .used       = replay_zone_used
+    },
+    {
+        .name       = "slab",
+        .alloc_type = MM_TRACE_KMALLOC,
+        .free_type  = MM_TRACE_KFREE,
+        .setup      = slab_replay_setup,
+        .teardown   = slab_replay_teardown,
+        .alloc      = slab_replay_alloc,
+        .free       = slab_replay_free,
+        .largest    = slob_replay_largest,
+        .used       = slab_replay_used
+    },
+    {
+        .name       = "buddy",
+        .alloc_type = MM_TRACE_ALLOC_PAGES,
+        .free_type  = MM_TRACE_FREE_PAGES,
+        .setup      = buddy_replay_setup,
+        .teardown   = replay_teardown,
+        .alloc      = buddy_replay_alloc,
+        .free       = buddy_replay_free,
+        .largest    = buddy_replay_largest,
+        .used       = replay_zone_used
+    }
+};
+
+// Free memory which can not be handed out as one block, in percent
+static u32 replay_frag(const struct replay_alloc* alloc)
+{
+    u32 free = replay_zone.get_free(&replay_zone);
+    if (free == 0) {
+        return 0;
+    }
+    return 100 - alloc->largest() * 100 / free;
+}
+
+// Runs the trace against one allocator. Only the allocator calls are timed,
+// with interrupts masked, while the footprint and the fragmentation are
+// sampled outside the measured part
+static void replay_run(const struct replay_alloc* alloc,
+    const struct replay_op* ops, u32 op_cnt, void** slots, u32* sizes,
+    u32 slot_cnt, struct benchmark_ctx* ctx, struct replay_result* res)
+{
+    alloc->setup();
+
+    u32 base_used = alloc->used();
+    u32 max_used = base_used;
+    u32 live = 0;
+
+    for (u32 i = 0; i < op_cnt; i++) {
+        const struct replay_op* op = &ops[i];
+
+        if (op->type == alloc->alloc_type) {
+            u32 atomic = __atomic_enter();
+            benchmark_begin(ctx);
+            void* ptr = alloc->alloc(op->size);
+            benchmark_end(ctx);
+            __atomic_leave(atomic);
+
+            res->ops++;
+            slots[op->slot] = ptr;
+            if (ptr == NULL) {
+                res->failed++;
+                continue;
+            }
+
+            sizes[op->slot] = op->size;
+            live += op->size;
+            if (live > res->peak_live) {
+                res->peak_live = live;
+            }
+
+            u32 used = alloc->used();
+            if (used > max_used) {
+                max_used = used;
+                res->peak_frag = replay_frag(alloc);
+            }
+        } else if (op->type == alloc->free_type) {
+            void* ptr = slots[op->slot];
+            if (ptr == NULL) {
+                continue;
+            }
+
+            u32 atomic = __atomic_enter();
+            benchmark_begin(ctx);
+            alloc->free(ptr);
+            benchmark_end(ctx);
+            __atomic_leave(atomic);
+
+            res->ops++;
+            slots[op->slot] = NULL;
+            live -= sizes[op->slot];
+        }
+    }
+
+    res->peak_used = max_used - base_used;
+    res->end_frag = replay_frag(alloc);
+
+    // Allocations which are never freed in the trace
+    for (u32 i = 0; i < slot_cnt; i++) {
+        if (slots[i]) {
+            alloc->free(slots[i]);
+            slots[i] = NULL;
+        }
+    }
+    alloc->teardown();
+}
+
+// Replays a captured allocation trace against every allocator and prints one
+// line per allocator on the form
+//
+//     replay,<name>,<ops>,<cycles>,<cycles per op>,<failed>,<peak live>,
+//         <peak used>,<peak frag %>,<end frag %>
+//
+// The peak used is the memory taken by the allocator at the worst point,
+// including the allocator overhead. Must be called from a thread
+void alloc_replay(const u8* trace, u32 size)
+{
+    const struct replay_header* header = (const struct replay_header *)trace;
+    const struct replay_op* ops = (const struct replay_op *)(header + 1);
+
+    if (size < sizeof(struct replay_header) || header->magic != REPLAY_MAGIC ||
+        sizeof(struct replay_header) + header->op_cnt *
+        sizeof(struct replay_op) > size) {
+
+        print("replay: bad trace\n");
+        return;
+    }
+
+    // Every slot needs the pointer and the size
+    u32 slot_bytes = header->slot_cnt * sizeof(void *);
+    struct page* page = alloc_pages(bytes_to_order(slot_bytes * 2));
+    if (page == NULL) {
+        print("replay: no memory for %d slots\n", header->slot_cnt);
+        return;
+    }
+    void** slots = page_to_va(page);
+    u32* sizes = (u32 *)((u8 *)slots + slot_bytes);
+
+    for (u32 i = 0; i < header->op_cnt; i++) {
+        if (ops[i].slot >= header->slot_cnt) {
+            print("replay: bad slot\n");
+            free_pages(page);
+            return;
+        }
+    }
+
+    cycle_counter_enable();
+    print("replay,name,ops,cycles,cycles_per_op,failed,peak_live,peak_used,"
+        "peak_frag,end_frag\n");
+
+    for (u32 i = 0; i < sizeof(replay_allocs) / sizeof(replay_allocs[0]); i++) {
+        struct benchmark_ctx ctx = { 0 };
+        struct replay_result res = { 0 };
+
+        for (u32 j = 0; j < header->slot_cnt; j++) {
+            slots[j] = NULL;
+        }
+
+        replay_run(&replay_allocs[i], ops, header->op_cnt, slots, sizes,
+            header->slot_cnt, &ctx, &res);
+
+        u32 per_op = (res.ops) ? ctx.cycles / res.ops : 0;
+        print("replay,%s,%d,%d,%d,%d,%d,%d,%d,%d\n", replay_allocs[i].name,
+            res.ops, ctx.cycles, per_op, res.failed, res.peak_live,
+            res.peak_used, res.peak_frag, res.end_frag);
+    }
+
+    free_pages(page);
+}
@@ -1,13 +1,131 @@
-/// Copyright (C) strawberryhacker
+// Copyright (C) strawberryhacker
 
 #include <citrus/asid.h>
+#include <citrus/mm.h>
+#include <citrus/mem.h>
+#include <citrus/atomic.h>
+#include <stddef.h>
+
+// ASID 0 is never handed out. It is used while TTBR0 is being changed
+#define ASID_RESERVED 0
+
+// Current generation in the upper bits of the context ID. A memory map with an
+// older generation has to get a new ASID before it runs
+static u32 asid_generation;
+
+// Bitmap of the ASIDs used in the current generation
+static u32 asid_map[ASID_CNT / 32];
+static u32 asid_next;
+
+// Memory map currently loaded in TTBR0 and CONTEXTIDR
+static struct mmap* asid_active;
+
+// Invalidates all TLB entries tagged with a given ASID
+static inline void asid_tlb_invalidate(u32 asid)
+{
+    asm volatile ("mcr p15, 0, %0, c8, c7, 2" : : "r" (asid & ASID_MSK));
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+}
+
+static inline void asid_set_used(u32 asid)
+{
+    asid_map[asid / 32] |= (1 << (asid % 32));
+}
+
+static inline void asid_set_free(u32 asid)
+{
+    asid_map[asid / 32] &= ~(1 << (asid % 32));
+}
+
+static inline u8 asid_is_used(u32 asid)
+{
+    return (asid_map[asid / 32] & (1 << (asid % 32))) ? 1 : 0;
+}
 
 void asid_init(void)
 {
+    asid_generation = ASID_CNT;
+    asid_next = 1;
+    asid_active = NULL;
 
+    mem_set(asid_map, 0, sizeof(asid_map));
+    asid_set_used(ASID_RESERVED);
 }
 
-u8 get_asid(void)
+// Starts a new generation when all the ASIDs are in use. Every ASID from the
+// old generation becomes invalid, so the entire TLB is flushed once here
+// instead of on every context switch
+static void asid_rollover(void)
 {
-    return 0;
+    asid_generation += ASID_CNT;
+
+    // A new memory map has a zero context ID which must never be valid
+    if (asid_generation == 0) {
+        asid_generation = ASID_CNT;
+    }
+
+    mem_set(asid_map, 0, sizeof(asid_map));
+    asid_set_used(ASID_RESERVED);
+    asid_next = 1;
+
+    mm_tlb_invalidate();
+
+    // The active memory map is still loaded in CONTEXTIDR. It keeps its ASID
+    // so that no other memory map is given the same ASID
+    if (asid_active) {
+        u32 asid = asid_active->context_id & ASID_MSK;
+        asid_set_used(asid);
+        asid_active->context_id = asid_generation | asid;
+    }
+}
+
+// Returns a free ASID from the current generation
+static u32 asid_alloc(void)
+{
+    for (u32 i = 0; i < ASID_CNT; i++) {
+        u32 asid = (asid_next + i) & ASID_MSK;
+
+        if (!asid_is_used(asid)) {
+            asid_set_used(asid);
+            asid_next = asid + 1;
+            return asid;
+        }
+    }
+
+    asid_rollover();
+    return asid_alloc();
+}
+
+void asid_switch(struct mmap* mm)
+{
+    u32 atomic = __atomic_enter();
+
+    if ((mm->context_id & ~ASID_MSK) != asid_generation) {
+        mm->context_id = asid_generation | asid_alloc();
+    }
+    asid_active = mm;
+
+    __atomic_leave(atomic);
+}
+
+// The TLB entries for the ASID are removed so that the ASID can be given to a
+// new memory map right away
+void asid_free(struct mmap* mm)
+{
+    u32 atomic = __atomic_enter();
+
+    if ((mm->context_id & ~ASID_MSK) == asid_generation) {
+        u32 asid = mm->context_id & ASID_MSK;
+
+        asid_set_free(asid);
+        asid_tlb_invalidate(asid);
+    }
+    mm->context_id = 0;
+
+    if (asid_active == mm) {
+        asid_active = NULL;
+    }
+
+    __atomic_leave(atomic);
 }
@@ -0,0 +1,25 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/benchmark.h>
+#include <citrus/print.h>
+#include <citrus/atomic.h>
+
+// Runs a list of benchmarks. The output is meant to be parsed by a script, so
+// it is kept to one comma separated line per benchmark
+void benchmark_run(const struct benchmark* bench, u32 cnt)
+{
+    cycle_counter_enable();
+    print("bench,name,ops,cycles,cycles_per_op,frag\n");
+
+    for (u32 i = 0; i < cnt; i++) {
+        struct benchmark_ctx ctx = { 0 };
+
+        u32 atomic = __atomic_enter();
+        bench[i].run(&ctx);
+        __atomic_leave(atomic);
+
+        u32 per_op = (ctx.ops) ? ctx.cycles / ctx.ops : 0;
+        print("bench,%s,%d,%d,%d,%d\n", bench[i].name, ctx.ops, ctx.cycles,
+            per_op, ctx.frag);
+    }
+}
@@ -0,0 +1,41 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/cond.h>
+#include <citrus/atomic.h>
+#include <stddef.h>
+
+void cond_init(struct cond* cond)
+{
+    wait_queue_init(&cond->wait);
+}
+
+// The mutex is released and the thread blocked with interrupts masked, so a
+// signal sent right after the release is not lost
+u8 cond_wait_timeout(struct cond* cond, struct mutex* mutex, u32 ms)
+{
+    u32 atomic = __atomic_enter();
+
+    __mutex_unlock(mutex);
+    u8 status = wait_queue_wait_timeout(&cond->wait, ms);
+    mutex_lock(mutex);
+
+    __atomic_leave(atomic);
+    return status;
+}
+
+void cond_wait(struct cond* cond, struct mutex* mutex)
+{
+    cond_wait_timeout(cond, mutex, 0);
+}
+
+// The signaling thread usually holds the mutex the waiter needs, so it does not
+// yield to the waiter here
+void cond_signal(struct cond* cond)
+{
+    wait_queue_wake_one(&cond->wait);
+}
+
+void cond_broadcast(struct cond* cond)
+{
+    wait_queue_wake_all(&cond->wait);
+}
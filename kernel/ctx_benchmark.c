@@ -0,0 +1,79 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/benchmark.h>
+#include <citrus/mm.h>
+#include <citrus/print.h>
+#include <citrus/atomic.h>
+
+// Number of 1 MiB kernel sections touched after every switch. Every section
+// takes one TLB entry. The word offset moves with the section so that all the
+// words end up in different cache sets
+#define CTX_BENCH_SECTIONS 64
+#define CTX_BENCH_ROUNDS   256
+
+// Touches the TLB working set
+static inline u32 ctx_bench_touch(void)
+{
+    u32 sum = 0;
+    for (u32 i = 0; i < CTX_BENCH_SECTIONS; i++) {
+        sum += *(volatile u32 *)(KERNEL_START + (i << 20) + (i << 5));
+    }
+    return sum;
+}
+
+// Memory map switch as it was done before ASIDs. The entire TLB is flushed
+static inline void ctx_switch_flush(u32 ttbr0)
+{
+    asm volatile ("mcr p15, 0, %0, c2, c0, 0" : : "r" (ttbr0));
+    asm volatile ("isb" : : : "memory");
+    asm volatile ("mcr p15, 0, %0, c8, c7, 0" : : "r" (0));
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+}
+
+// Memory map switch as done by the context switch
+static inline void ctx_switch_asid(u32 ttbr0, u32 context_id)
+{
+    asm volatile ("mcr p15, 0, %0, c13, c0, 1" : : "r" (0));
+    asm volatile ("isb" : : : "memory");
+    asm volatile ("mcr p15, 0, %0, c2, c0, 0" : : "r" (ttbr0));
+    asm volatile ("isb" : : : "memory");
+    asm volatile ("mcr p15, 0, %0, c13, c0, 1" : : "r" (context_id));
+    asm volatile ("isb" : : : "memory");
+}
+
+// Switches to the current memory map over and over again and touches a number
+// of kernel sections after each switch. The difference between the two runs
+// is the TLB refill cost saved by the ASIDs
+void context_switch_benchmark(void)
+{
+    cycle_counter_enable();
+
+    u32 atomic = __atomic_enter();
+
+    u32 ttbr0 = get_ttbr0();
+    u32 context_id;
+    asm volatile ("mrc p15, 0, %0, c13, c0, 1" : "=r" (context_id));
+
+    // Warm up the caches so that only the TLB differs between the runs
+    ctx_bench_touch();
+
+    u32 start = cycle_counter_read();
+    for (u32 i = 0; i < CTX_BENCH_ROUNDS; i++) {
+        ctx_switch_flush(ttbr0);
+        ctx_bench_touch();
+    }
+    u32 flush_cycles = cycle_counter_read() - start;
+
+    start = cycle_counter_read();
+    for (u32 i = 0; i < CTX_BENCH_ROUNDS; i++) {
+        ctx_switch_asid(ttbr0, context_id);
+        ctx_bench_touch();
+    }
+    u32 asid_cycles = cycle_counter_read() - start;
+
+    __atomic_leave(atomic);
+
+    print("ctx_switch: tlb flush %d cycles, asid %d cycles per switch\n",
+        flush_cycles / CTX_BENCH_ROUNDS, asid_cycles / CTX_BENCH_ROUNDS);
+}
@@ -8,6 +8,7 @@
 #include <citrus/page_alloc.h>
 #include <citrus/mem.h>
 #include <citrus/sched.h>
+#include <citrus/process.h>
 #include <citrus/pt_entry.h>
 #include <citrus/cache.h>
 #include <citrus/align.h>
@@ -191,7 +192,7 @@ void print_prog_header(struct elf_prog_header* ptr)
     print("Align: %08X\n", ptr->align);
 }
 
-void elf_init(const u8* elf_data, u32 elf_size)
+u8 elf_init(const u8* elf_data, u32 elf_size)
 {
     struct elf_header* elf_header = (struct elf_header *)elf_data;
 
@@ -219,6 +220,10 @@ void elf_init(const u8* elf_data, u32 elf_size)
     u32 bin_pages = (u32)align_up_ptr((void *)prog_header->memsz, 4096) / 4096;
     u32 bin_order = pages_to_order(bin_pages);
     struct page* bin_page_ptr = alloc_pages(bin_order);
+    if (bin_page_ptr == NULL) {
+        print("Not enough memory for the ELF binary\n");
+        return 0;
+    }
     
     mem_copy(elf_data + prog_header->offset, page_to_va(bin_page_ptr),
         prog_header->filesz);
@@ -229,25 +234,55 @@ void elf_init(const u8* elf_data, u32 elf_size)
     struct thread* t = create_process((i32 (*)(void *))elf_header->entry, 500,
         "elf-app", NULL, SCHED_RT);
 
+    if (t == NULL) {
+        free_pages(bin_page_ptr);
+        __atomic_leave(irq);
+        print("Not enough memory for the ELF process\n");
+        return 0;
+    }
+
     struct pte_attr attr = {
         .access = PTE_ACCESS_FULL_ACC,
-        .mem    = PTE_MEM_WRITE_THROUGH,
+        .mem    = PTE_MEM_WRITE_ALLOC,
         .domain = 15,
-        .nG     = 0,
+        .nG     = 1,
         .xn     = 0
     };
 
-    i32 err = mm_map_in_pages(t->mmap, bin_page_ptr, (1 << bin_order),
-        prog_header->vaddr, &attr);
+    // The binary pages belongs to the process from now on. They are split so
+    // that copy-on-write can share and free them one by one. The heap starts
+    // right after the loaded image
+    split_pages(bin_page_ptr, bin_order);
+    for (u32 i = 0; i < (1 << bin_order); i++) {
+        bin_page_ptr[i].ref = 1;
+    }
+
+    if (mm_map_in_pages(t->mmap, bin_page_ptr, (1 << bin_order),
+        prog_header->vaddr, &attr) == 0) {
+
+        // The pages which made it into the page tables are dropped together
+        // with the memory space, and the rest are dropped here
+        for (u32 i = 0; i < (1 << bin_order); i++) {
+            u32* pte = mm_get_pte_ptr(t->mmap, prog_header->vaddr + i * 4096);
+            if (pte == NULL || (*pte & PTE_MASK) == 0) {
+                put_page(&bin_page_ptr[i]);
+            }
+        }
+        process_mm_free(t);
+        sched_kill_thread(t);
 
-    assert(err == 1);
+        __atomic_leave(irq);
+        print("Not enough memory to map the ELF binary\n");
+        return 0;
+    }
+    t->mmap->data_s = (u32 *)prog_header->vaddr;
+    t->mmap->data_e = (u32 *)(prog_header->vaddr + (1 << bin_order) * 4096);
 
-    asm volatile("dsb" : : :"memory");
-    asm volatile("dmb" : : :"memory");
+    // Only the loaded image has to reach the point of unification
+    u32 bin_start = (u32)page_to_va(bin_page_ptr);
+    icache_sync_range(bin_start, bin_start + (1 << bin_order) * 4096);
     asm volatile("isb" : : :"memory");
-    dcache_clean();
-    icache_invalidate();
 
     __atomic_leave(irq);
-
+    return 1;
 }
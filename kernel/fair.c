@@ -4,47 +4,219 @@
 #include <citrus/sched.h>
 #include <citrus/print.h>
 #include <citrus/list.h>
+#include <citrus/rbtree.h>
 #include <citrus/thread.h>
 #include <citrus/interrupt.h>
 #include <citrus/atomic.h>
+#include <citrus/cpu_timer.h>
 #include <stddef.h>
 
+// Weight of every nice level from -20 to 19. Each level is about 25% from the
+// next, so one nice level is worth about 10% of the CPU between two threads
+static const u32 fair_weights[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15
+};
+
+// Runtime counted per update. This keeps the scaling within 32 bits
+#define FAIR_MAX_DELTA 1000000
+
+// Scales real runtime to virtual runtime. A nice 0 thread runs at real time
+static inline u32 fair_scale(u32 delta, struct thread* thread)
+{
+    if (delta > FAIR_MAX_DELTA) {
+        delta = FAIR_MAX_DELTA;
+    }
+    return delta * FAIR_NICE_0_WEIGHT / fair_weights[thread->nice + 20];
+}
+
+// Returns the runtime of a thread including the part of the current slice
+// which the core scheduler has not counted yet
+static inline u64 fair_clock(struct thread* thread, struct rq* rq)
+{
+    u64 clock = thread->runtime;
+    if (thread == rq->curr) {
+        clock += cpu_timer_get_value_us();
+    }
+    return clock;
+}
+
+// The keys are compared as a signed difference, so a wrapped clock still
+// sorts right
+static inline u8 fair_before(u64 a, u64 b)
+{
+    return (i64)(a - b) < 0;
+}
+
+static void fair_insert(struct fair_rq* fair_rq, struct thread* thread)
+{
+    struct rb_node** link = &fair_rq->tree.node;
+    struct rb_node* parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        struct thread* t = rb_get_entry(parent, struct thread, fair_node);
+
+        // Equal keys go to the right, so they run in the order they came
+        if (fair_before(thread->vruntime, t->vruntime)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+
+    rb_link_node(&thread->fair_node, parent, link);
+    rb_insert_color(&thread->fair_node, &fair_rq->tree);
+}
+
+// Charges the thread picked last for the time it has run since then, and
+// moves it to its new place in the tree
+static void fair_update_curr(struct fair_rq* fair_rq, struct rq* rq)
+{
+    struct thread* curr = fair_rq->curr;
+    if (curr == NULL) {
+        return;
+    }
+
+    u64 clock = fair_clock(curr, rq);
+    u32 delta = (u32)(clock - curr->fair_start);
+    curr->fair_start = clock;
+
+    if (delta == 0) {
+        return;
+    }
+
+    // The thread picked last is always in the tree, since the dequeue clears
+    // the pointer
+    rb_erase(&curr->fair_node, &fair_rq->tree);
+    curr->vruntime += fair_scale(delta, curr);
+    fair_insert(fair_rq, curr);
+}
+
+// The minimum virtual runtime only moves forward. It is the reference for
+// placing threads which wake up
+static void fair_update_min(struct fair_rq* fair_rq)
+{
+    struct rb_node* first = rb_first(&fair_rq->tree);
+    if (first == NULL) {
+        return;
+    }
+
+    struct thread* t = rb_get_entry(first, struct thread, fair_node);
+    if (fair_before(fair_rq->min_vruntime, t->vruntime)) {
+        fair_rq->min_vruntime = t->vruntime;
+    }
+}
+
 void fair_init(struct rq* rq)
 {
     //print("Init fair\n");
     struct fair_rq* fair_rq = &rq->fair_rq;
 
-    list_init(&fair_rq->queue);
+    rb_init(&fair_rq->tree);
+    fair_rq->min_vruntime = 0;
+    fair_rq->curr = NULL;
 }
 
+// A thread which has slept is placed at most FAIR_SLEEP_CREDIT behind the
+// threads which kept running. It runs first, but can not save up CPU time by
+// sleeping. New threads are treated as waking up
 void fair_enqueue(struct thread* thread, struct rq* rq)
 {
+    struct fair_rq* fair_rq = &rq->fair_rq;
+
     u32 flags = __atomic_enter();
-    list_add_last(&thread->node, &rq->fair_rq.queue);
+
+    u64 floor = fair_rq->min_vruntime - FAIR_SLEEP_CREDIT;
+    if (fair_before(thread->vruntime, floor)) {
+        thread->vruntime = floor;
+    }
+
+    fair_insert(fair_rq, thread);
+    thread->fair_queued = 1;
+
     __atomic_leave(flags);
 }
 
 void fair_dequeue(struct thread* thread, struct rq* rq)
 {
+    struct fair_rq* fair_rq = &rq->fair_rq;
+
     u32 flags = __atomic_enter();
-    list_delete_node(&thread->node);
+
+    // The running thread is charged before it leaves, since the slice is
+    // counted by the core scheduler after the dequeue
+    if (thread == fair_rq->curr) {
+        fair_update_curr(fair_rq, rq);
+        fair_rq->curr = NULL;
+    }
+
+    if (thread->fair_queued) {
+        rb_erase(&thread->fair_node, &fair_rq->tree);
+        thread->fair_queued = 0;
+    }
+
     __atomic_leave(flags);
 }
 
+// Picks the thread with the smallest virtual runtime. The thread picked last
+// keeps the CPU until it is FAIR_GRANULARITY ahead, so that two CPU hogs do
+// not switch on every tick
 struct thread* fair_pick_next(struct rq* rq)
 {
-    if (list_is_empty(&rq->fair_rq.queue)) {
+    struct fair_rq* fair_rq = &rq->fair_rq;
+
+    // Lock the runqueue while picking next
+    u32 flags = __atomic_enter();
+
+    fair_update_curr(fair_rq, rq);
+    fair_update_min(fair_rq);
+
+    struct rb_node* first = rb_first(&fair_rq->tree);
+    if (first == NULL) {
+        __atomic_leave(flags);
         return NULL;
     }
-    struct list_node* tmp = list_get_first(&rq->fair_rq.queue);
-    
-    // Lock the runqueue while picking next
+
+    struct thread* next = rb_get_entry(first, struct thread, fair_node);
+    struct thread* curr = fair_rq->curr;
+
+    if (curr && curr != next &&
+        (i64)(curr->vruntime - next->vruntime) < FAIR_GRANULARITY) {
+
+        next = curr;
+    }
+
+    if (next != curr) {
+        next->fair_start = fair_clock(next, rq);
+        fair_rq->curr = next;
+    }
+
+    __atomic_leave(flags);
+    return next;
+}
+
+// Sets the nice level. The thread is charged at the old weight first
+u8 fair_set_nice(struct thread* thread, struct rq* rq, i32 nice)
+{
+    if (nice < FAIR_NICE_MIN || nice > FAIR_NICE_MAX) {
+        return 0;
+    }
+
     u32 flags = __atomic_enter();
-    list_delete_first(&rq->fair_rq.queue);
-    list_add_last(tmp, &rq->fair_rq.queue);
+    if (thread == rq->fair_rq.curr) {
+        fair_update_curr(&rq->fair_rq, rq);
+    }
+    thread->nice = nice;
     __atomic_leave(flags);
 
-    return list_get_entry(tmp, struct thread, node);
+    return 1;
 }
 
 extern const struct sched_class back_class;
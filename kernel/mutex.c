@@ -0,0 +1,172 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/mutex.h>
+#include <citrus/sched.h>
+#include <citrus/thread.h>
+#include <citrus/syscall.h>
+#include <citrus/atomic.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+void mutex_init(struct mutex* mutex)
+{
+    mutex->owner = NULL;
+    wait_queue_init(&mutex->wait);
+    list_node_init(&mutex->held);
+}
+
+// Gives the mutex to a thread. The caller must have interrupts masked
+static void mutex_take(struct mutex* mutex, struct thread* thread)
+{
+    mutex->owner = thread;
+    list_add_last(&mutex->held, &thread->pi_held);
+}
+
+// Returns the highest priority waiting for any mutex held by the thread. The
+// waiters are sorted, so only the first in each queue is checked
+static u32 mutex_inherited(struct thread* thread)
+{
+    u32 prio = 0;
+
+    struct list_node* node;
+    list_iterate(node, &thread->pi_held) {
+        struct mutex* mutex = list_get_entry(node, struct mutex, held);
+        if (wait_queue_empty(&mutex->wait)) {
+            continue;
+        }
+
+        struct thread* waiter = list_get_entry(mutex->wait.threads.next,
+            struct thread, node);
+        u32 waiter_prio = sched_pi_prio(waiter);
+        if (waiter_prio > prio) {
+            prio = waiter_prio;
+        }
+    }
+    return prio;
+}
+
+// Raises an owner to the priority of a new waiter. If the owner is blocked on
+// another mutex, its place in that queue is updated and the owner of that
+// mutex is raised as well
+static void mutex_boost(struct thread* owner, u32 prio)
+{
+    for (u32 i = 0; owner && i < MUTEX_PI_DEPTH; i++) {
+        if (sched_pi_prio(owner) >= prio) {
+            return;
+        }
+        sched_set_pi_prio(owner, prio);
+
+        struct mutex* next = owner->pi_blocked;
+        if (next == NULL) {
+            return;
+        }
+        wait_queue_requeue(&next->wait, owner);
+        owner = next->owner;
+    }
+}
+
+void mutex_waiter_removed(struct thread* thread)
+{
+    struct mutex* mutex = thread->pi_blocked;
+    if (mutex == NULL) {
+        return;
+    }
+    thread->pi_blocked = NULL;
+
+    // Drop the boost the waiter gave, following the chain of blocked owners
+    struct thread* owner = mutex->owner;
+    for (u32 i = 0; owner && i < MUTEX_PI_DEPTH; i++) {
+        sched_set_pi_prio(owner, mutex_inherited(owner));
+
+        struct mutex* next = owner->pi_blocked;
+        if (next == NULL) {
+            return;
+        }
+        wait_queue_requeue(&next->wait, owner);
+        owner = next->owner;
+    }
+}
+
+void mutex_lock(struct mutex* mutex)
+{
+    u32 atomic = __atomic_enter();
+    struct thread* curr = get_curr_thread();
+
+    if (mutex->owner == curr) {
+        panic("Mutex is already held by the caller");
+    }
+
+    if (mutex->owner == NULL) {
+        mutex_take(mutex, curr);
+    } else {
+        curr->pi_blocked = mutex;
+        mutex_boost(mutex->owner, sched_pi_prio(curr));
+
+        // The unlock hands the mutex over before waking this thread
+        wait_queue_wait(&mutex->wait);
+    }
+
+    __atomic_leave(atomic);
+}
+
+u8 mutex_trylock(struct mutex* mutex)
+{
+    u32 atomic = __atomic_enter();
+
+    u8 status = 0;
+    if (mutex->owner == NULL) {
+        mutex_take(mutex, get_curr_thread());
+        status = 1;
+    }
+
+    __atomic_leave(atomic);
+    return status;
+}
+
+struct thread* __mutex_unlock(struct mutex* mutex)
+{
+    u32 atomic = __atomic_enter();
+    struct thread* curr = get_curr_thread();
+
+    if (mutex->owner != curr) {
+        panic("Mutex is not held by the caller");
+    }
+    list_delete_node(&mutex->held);
+
+    struct thread* next = NULL;
+    if (wait_queue_empty(&mutex->wait)) {
+        mutex->owner = NULL;
+    } else {
+        next = list_get_entry(mutex->wait.threads.next, struct thread, node);
+        next->pi_blocked = NULL;
+        mutex_take(mutex, next);
+        wait_queue_wake_one(&mutex->wait);
+
+        // The new owner inherits from the waiters left behind
+        sched_set_pi_prio(next, mutex_inherited(next));
+    }
+
+    // Drop the part of the boost which came through this mutex
+    sched_set_pi_prio(curr, mutex_inherited(curr));
+
+    __atomic_leave(atomic);
+    return next;
+}
+
+void mutex_unlock(struct mutex* mutex)
+{
+    u32 atomic = __atomic_enter();
+    struct thread* curr = get_curr_thread();
+
+    u32 prio = sched_pi_prio(curr);
+    struct thread* next = __mutex_unlock(mutex);
+
+    // A thread which lost its boost gives the CPU back right away
+    if (sched_pi_prio(curr) < prio) {
+        syscall_yield();
+    } else {
+        wait_preempt(next);
+    }
+
+    __atomic_leave(atomic);
+}
@@ -12,21 +12,49 @@
 #include <citrus/mem.h>
 #include <citrus/panic.h>
 #include <citrus/cache.h>
+#include <citrus/asid.h>
 
-// This sets up the new process memory space and 
+// This sets up the new process memory space and returns the level 1 page
+// table. Returns NULL if the allocation fails
 struct page* process_mm_init(struct thread* thread, u32 stack_size)
 {
     // The init process has to dynamically allocte the mm struct
     struct mmap* map = (struct mmap *)
         kzmalloc(sizeof(struct mmap));
 
-    mm_process_init(map);
-    thread->mmap = map;
+    if (map == NULL) {
+        return NULL;
+    }
 
     // Make the main level 1 page table
     struct page* lv1 = lv1_pt_alloc();
-    mm_process_add_page(lv1, map);
+    if (lv1 == NULL) {
+        kfree(map);
+        return NULL;
+    }
+
+    mm_process_init(map);
+    thread->mmap = map;
+
     map->ttbr_phys = page_to_pa(lv1);
 
-    return NULL;
+    return lv1;
+}
+
+// Frees all the pages owned by a process memory space, including the page
+// tables, together with the mmap structure itself. Pages shared with other
+// processes are only freed when the last process drops them
+void process_mm_free(struct thread* thread)
+{
+    struct mmap* map = thread->mmap;
+
+    // The user pages are found trough the page tables, so they must be released
+    // before the page tables are freed
+    mm_release_pages(map);
+    asid_free(map);
+
+    lv1_pt_free(pa_to_page(map->ttbr_phys));
+
+    kfree(map);
+    thread->mmap = NULL;
 }
@@ -14,34 +14,53 @@ void rt_init(struct rq* rq)
     //print("Init RT\n");
     struct rt_rq* rt_rq = &rq->rt_rq;
 
-    list_init(&rt_rq->queue);
+    rt_rq->ready = 0;
+    for (u32 i = 0; i < RT_PRIO_LEVELS; i++) {
+        list_init(&rt_rq->queue[i]);
+    }
 }
 
 void rt_enqueue(struct thread* thread, struct rq* rq)
 {
+    struct rt_rq* rt_rq = &rq->rt_rq;
+
     u32 flags = __atomic_enter();
-    list_add_last(&thread->node, &rq->rt_rq.queue);
+    list_add_last(&thread->node, &rt_rq->queue[thread->rt_prio]);
+    rt_rq->ready |= (1 << thread->rt_prio);
     __atomic_leave(flags);
 }
 
 void rt_dequeue(struct thread* thread, struct rq* rq)
 {
+    struct rt_rq* rt_rq = &rq->rt_rq;
+
     u32 flags = __atomic_enter();
     list_delete_node(&thread->node);
+    if (list_is_empty(&rt_rq->queue[thread->rt_prio])) {
+        rt_rq->ready &= ~(1 << thread->rt_prio);
+    }
     __atomic_leave(flags);
 }
 
+// Picks the first thread in the highest non-empty priority level. The level is
+// found with a single CLZ on the ready bitmap, so the cost does not depend on
+// the number of threads. Threads within a level are run round-robin
 struct thread* rt_pick_next(struct rq* rq)
 {
-    if (list_is_empty(&rq->rt_rq.queue)) {
-        return NULL;
-    }
-    struct list_node* tmp = list_get_first(&rq->rt_rq.queue);
-    
+    struct rt_rq* rt_rq = &rq->rt_rq;
+
     // Lock the runqueue while picking next
     u32 flags = __atomic_enter();
-    list_delete_first(&rq->rt_rq.queue);
-    list_add_last(tmp, &rq->rt_rq.queue);
+    if (rt_rq->ready == 0) {
+        __atomic_leave(flags);
+        return NULL;
+    }
+
+    struct list_node* queue = &rt_rq->queue[31 - __builtin_clz(rt_rq->ready)];
+    struct list_node* tmp = list_get_first(queue);
+
+    list_delete_first(queue);
+    list_add_last(tmp, queue);
     __atomic_leave(flags);
 
     return list_get_entry(tmp, struct thread, node);
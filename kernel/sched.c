@@ -14,10 +14,20 @@
 #include <citrus/kmalloc.h>
 #include <citrus/regmap.h>
 #include <citrus/pid.h>
+#include <citrus/asid.h>
+#include <citrus/mm.h>
+#include <citrus/compaction.h>
+#include <citrus/timer_wheel.h>
+#include <citrus/wait.h>
+#include <citrus/mutex.h>
 
 // Each CPU has a private runqueue
 struct rq rq;
 
+// Set while the core scheduler runs. The timer callbacks can wake threads, and
+// the timer is programmed at the end of the core scheduler anyway
+static u8 sched_busy;
+
 // Array for the scheduling classes
 #define CLASS_CNT 4
 
@@ -31,12 +41,35 @@ const struct sched_class* get_sched_class(u32 class_num)
     return sched_classes[class_num];
 }
 
+// Core scheduler
+void core_sched(struct rq* rq, u32 reschedule);
+
+// Ends a long timer period early, so that a thread made runnable outside the
+// scheduler does not wait for it. If the period ended while the interrupt was
+// masked, the flag read here clears the interrupt and the tick is run here
+static void sched_kick(void)
+{
+    u32 atomic = __atomic_enter();
+
+    if (!sched_busy && rq.time.period > SCHED_SLICE) {
+        if (cpu_timer_clear_flags()) {
+            core_sched(&rq, 0);
+        } else {
+            rq.time.period = cpu_timer_set_period_us(cpu_timer_get_value_us() +
+                SCHED_SLICE);
+        }
+    }
+
+    __atomic_leave(atomic);
+}
+
 // Enqueus a thread into the running queue of a scheduling class
 void sched_enqueue_thread(struct thread* thread)
 {
     assert(thread->class);
     thread->state = THREAD_RUNNING;
     thread->class->enqueue(thread, &rq);
+    sched_kick();
 }
 
 // Dequeues a thread from its runqueue
@@ -46,38 +79,31 @@ void sched_dequeue_thread(struct thread* thread)
     thread->class->dequeue(thread, &rq);
 }
 
-// Checks the sleep queue and enqueues all thread with expired delay
-void enqueue_sleeping_threads(struct rq* rq)
+// Called by the timer wheel when a new timer is the first to fire. A long
+// timer period is ended early so that the wheel runs in time
+void sched_set_deadline(u64 tick)
 {
-    u64 tick = rq->time.tick;
-
-    struct list_node* list = &rq->sleep_list;
-    while (list->next != list) {
-        // Check if the thread tick to wake is bigger than the tick
-        struct thread* t = list_get_entry(list->next, struct thread, node);
-
-        if (t->tick_to_wake > tick) {
-            break;
-        }
-        
+    u32 atomic = __atomic_enter();
 
-        list_delete_first(list);
-        t->class->enqueue(t, rq);
+    if (rq.time.tick_to_wake == 0 || tick < rq.time.tick_to_wake) {
+        rq.time.tick_to_wake = tick;
+        sched_kick();
     }
 
-    // Fix the rq->tick_to_wake to it point to the next tick to wake - if any
-    if (list->next != list) {
-        struct thread* t = list_get_entry(list->next, struct thread, node);
-        rq->time.tick_to_wake = t->tick_to_wake;
-    } else {
-        rq->time.tick_to_wake = 0;
-    }
+    __atomic_leave(atomic);
 }
 
-// Core scheduler
-void core_sched(struct rq* rq, u32 reschedule);
+// Sleep timer callback putting a thread back on its runqueue
+static void sched_wake_sleeper(void* arg)
+{
+    struct thread* thread = arg;
+
+    thread->state = THREAD_RUNNING;
+    thread->class->enqueue(thread, &rq);
+}
 
-// Scheduler interrupt being called every ms
+// Scheduler interrupt. This is called every ms while threads compete for the
+// CPU, and at the next wake-up otherwise
 void cpu_tick_handler(void)
 {
     cpu_timer_clear_flags();
@@ -107,31 +133,112 @@ static inline struct thread* core_pick_next(struct rq* rq)
     return NULL;
 }
 
+// Returns 1 if more than one thread is runnable, not counting the idle thread
+static u8 sched_competing(struct rq* rq)
+{
+    u32 ready = rq->rt_rq.ready;
+    if (ready & (ready - 1)) {
+        return 1;
+    }
+
+    u32 cnt = 0;
+    if (ready) {
+        struct list_node* queue = &rq->rt_rq.queue[31 - __builtin_clz(ready)];
+        if (queue->next != queue->prev) {
+            return 1;
+        }
+        cnt++;
+    }
+
+    struct rb_node* root = rq->fair_rq.tree.node;
+    if (root) {
+        if (root->left || root->right) {
+            return 1;
+        }
+        cnt++;
+    }
+
+    struct list_node* back = &rq->back_rq.queue;
+    if (!list_is_empty(back)) {
+        if (back->next != back->prev) {
+            return 1;
+        }
+        cnt++;
+    }
+    return cnt > 1;
+}
+
+// Programs the length of the next timer period. The running thread can only
+// be preempted by a thread waking up, unless other threads are runnable
+static void sched_program_timer(struct rq* rq)
+{
+    u32 period = SCHED_SLICE;
+
+    if (!sched_competing(rq)) {
+        period = SCHED_MAX_PERIOD;
+
+        if (rq->time.tick_to_wake) {
+            u64 left = 0;
+            if (rq->time.tick_to_wake > rq->time.tick) {
+                left = rq->time.tick_to_wake - rq->time.tick;
+            }
+
+            if (left < SCHED_MIN_PERIOD) {
+                period = SCHED_MIN_PERIOD;
+            } else if (left < SCHED_MAX_PERIOD) {
+                period = (u32)left;
+            }
+        }
+    }
+
+    if (period != rq->time.period) {
+        rq->time.period = cpu_timer_set_period_us(period);
+    }
+}
+
 // Core scheduler. This must be called inside either the IRQ interrupt or the
 // SVC interrupt. These interrupts have special mechanisms for doing a context 
-// switch
+// switch. A tick accounts for the whole period, so the runtime of the idle
+// thread is exact
 void core_sched(struct rq* rq, u32 reschedule)
 {
+    sched_busy = 1;
+
     u32 runtime;
     if (reschedule) {
         runtime = cpu_timer_get_value_us();
         cpu_timer_reset();
     } else {
-        runtime = SCHED_SLICE;
+        runtime = rq->time.period;
     }
 
     rq->time.tick += runtime;
     rq->curr->runtime += runtime;
 
-    // Enqueue expired delays
-    if (rq->time.tick > rq->time.tick_to_wake && rq->time.tick_to_wake)
-        enqueue_sleeping_threads(rq);
+    // Run the expired timers. This wakes the sleeping threads
+    if (rq->time.tick >= rq->time.tick_to_wake && rq->time.tick_to_wake)
+        timer_run(rq->time.tick);
+    rq->time.tick_to_wake = timer_next_event();
+
+    // The running thread keeps the CPU while the scheduler is disabled, unless
+    // it blocks by itself. A thread woken meanwhile runs at the next tick
+    if (!reschedule && !rq->sched_enable) {
+        sched_program_timer(rq);
+        sched_busy = 0;
+        return;
+    }
 
     struct thread* new = core_pick_next(rq);
+    sched_program_timer(rq);
 
-    // The context switch will not happend if the thread is the same
-    if (new != rq->curr)
+    // The context switch will not happend if the thread is the same. A user
+    // thread needs a valid ASID before its memory map is loaded
+    if (new != rq->curr) {
+        if (new->mmap)
+            asid_switch(new->mmap);
         rq->next = new;
+    }
+    sched_busy = 0;
 }
 
 // Adds a thread to the rq thread list
@@ -145,7 +252,7 @@ void sched_init_rq(struct rq* rq)
 {
     // Initialize all the lists 
     list_init(&rq->thread_list);
-    list_init(&rq->sleep_list);
+    timer_wheel_init(0);
 
     rq->curr = NULL;
     rq->next = NULL;
@@ -157,6 +264,7 @@ void sched_init_rq(struct rq* rq)
     rq->time.tick = 0;
     rq->time.tick_to_wake = 0;
     rq->time.tick_window = 0;
+    rq->time.period = SCHED_SLICE;
 
     // Initialize the private data for all the scheduling classes 
     const struct sched_class* class;
@@ -180,13 +288,21 @@ struct thread* sched_get_lazy_fpu_user(void)
 }
 
 // This is the IDLE thread which is run when no other scheduling class can
-// offer any new thread. This might not need to occupy a full timeslice but
-// should probably wait for a signal
-//
-// TODO this should yield on a external signal
+// offer any new thread. The idle time is used to zero pages for the page
+// table and page fault paths. When there is nothing left to do the CPU waits
+// for an interrupt. The timer is programmed for the next wake-up, so the CPU
+// sleeps until then unless a device needs it
 static i32 idle_func(void* args)
 {
-    while (1);
+    while (1) {
+        if (zero_pool_refill()) {
+            continue;
+        }
+        compact_idle();
+
+        asm volatile ("dsb" : : : "memory");
+        asm volatile ("wfi");
+    }
     return 1;
 }
 
@@ -211,6 +327,7 @@ static inline void sched_early_init(void)
 void sched_init(void)
 {
     sched_early_init();
+    asid_init();
 
     add_idle(&rq);
 
@@ -236,35 +353,6 @@ struct thread* get_curr_thread(void)
     return rq.curr;
 }   
 
-// Adds a thread to the sorted delay list for a given runqueue. The thread with
-// the shortest time left to sleep will be placed in front of the queue. This
-// will modify the threads node pointers; therefore the thread must NOT exist in
-// any list at this point
-void add_sleep_list(struct thread* thread, struct rq* rq)
-{
-    thread->state = THREAD_SLEEP;
-    u64 curr_tick = thread->tick_to_wake;
-
-    // Conditionally update the rq.tick_to_wake 
-    if (curr_tick < rq->time.tick_to_wake || (rq->time.tick_to_wake == 0)) {
-        rq->time.tick_to_wake = curr_tick;
-    }
-
-    // Place the thread in the ordered delay list 
-    struct list_node* node;
-    list_iterate(node, &rq->sleep_list) {
-        struct thread* t = list_get_entry(node, struct thread, node);
-        
-        if (t->tick_to_wake >= curr_tick) {
-            list_add_before(&thread->node, &t->node);
-            return;
-        }
-    }
-
-    // This is the longest delay 
-    list_add_last(&thread->node, &rq->sleep_list);
-}
-
 void print_queue(struct list_node* queue)
 {
     struct list_node* node;
@@ -275,8 +363,8 @@ void print_queue(struct list_node* queue)
     print("\n");
 }
 
-// Functions for temporarily stopping the scheduler from executing. The timers 
-// and interrupts will still run
+// Functions for temporarily stopping the scheduler from preempting the running
+// thread. The timers and interrupts will still run
 u32 sched_disable(void)
 {
     u32 i = rq.sched_enable;
@@ -289,33 +377,124 @@ void sched_enable(u32 i)
     rq.sched_enable = i;
 }
 
-// This will put the current running thread into the sleep queue for a number of 
-// microseconds
+// Takes the current running thread off its runqueue for a number of ms. The
+// thread is woken by its sleep timer
 void sched_thread_sleep(u32 ms)
 {
-    // Get the current thread
     struct thread* curr = get_curr_thread();
-    u64 tick = get_kernel_tick();
-    
-    curr->tick_to_wake = tick + (u64)(ms * 1000);
+
     curr->class->dequeue(curr, &rq);
-    add_sleep_list(curr, &rq);
+    curr->state = THREAD_SLEEP;
+
+    timer_setup(&curr->sleep_timer, sched_wake_sleeper, curr);
+    timer_add(&curr->sleep_timer, ms);
     
     core_sched(&rq, 1);
 }
 
 u8 sched_kill_thread(struct thread* thread)
 {
+    // The mutexes would stay locked forever
+    if (!list_is_empty(&thread->pi_held)) {
+        panic("Thread killed while holding a mutex");
+    }
+
     list_delete_node(&thread->thread_group);
     list_delete_node(&thread->thread_node);
 
-    thread->class->dequeue(thread, &rq);
+    // A sleeping thread is only referenced by its timer
+    if (thread->state == THREAD_SLEEP) {
+        timer_del(&thread->sleep_timer);
+    } else if (thread->state == THREAD_WAIT) {
+        wait_queue_remove(thread);
+        timer_del(&thread->sleep_timer);
+        mutex_waiter_removed(thread);
+    } else {
+        thread->class->dequeue(thread, &rq);
+    }
 
     kfree(thread);
 
     return 1;
 }
 
+// Returns the effective real-time priority plus one, or 0 for other classes
+u32 sched_pi_prio(struct thread* thread)
+{
+    return (thread->class == &rt_class) ? thread->rt_prio + 1 : 0;
+}
+
+// Moves a thread to the class and priority given by the higher of its base and
+// its inherited priority. A runnable thread is moved between the runqueues
+static void sched_apply_prio(struct thread* thread)
+{
+    u32 prio = thread->pi_prio;
+    if (thread->base_class == &rt_class && thread->base_prio + 1 > prio) {
+        prio = thread->base_prio + 1;
+    }
+
+    const struct sched_class* class = thread->base_class;
+    u32 rt_prio = thread->base_prio;
+    if (prio) {
+        class = &rt_class;
+        rt_prio = prio - 1;
+    }
+
+    if (class == thread->class && rt_prio == thread->rt_prio) {
+        return;
+    }
+
+    u8 queued = (thread->state == THREAD_RUNNING);
+    if (queued) {
+        thread->class->dequeue(thread, &rq);
+    }
+    thread->class = class;
+    thread->rt_prio = rt_prio;
+    if (queued) {
+        thread->class->enqueue(thread, &rq);
+    }
+}
+
+// The thread is requeued if it is runnable, so that the ready bitmap matches
+// the queues
+u8 sched_set_prio(struct thread* thread, u32 prio)
+{
+    if (prio >= RT_PRIO_LEVELS) {
+        return 0;
+    }
+
+    u32 atomic = __atomic_enter();
+    thread->base_prio = prio;
+    sched_apply_prio(thread);
+    __atomic_leave(atomic);
+
+    return 1;
+}
+
+void sched_set_pi_prio(struct thread* thread, u32 prio)
+{
+    u32 atomic = __atomic_enter();
+    thread->pi_prio = prio;
+    sched_apply_prio(thread);
+    __atomic_leave(atomic);
+}
+
+u8 fair_set_nice(struct thread* thread, struct rq* rq, i32 nice);
+extern const struct sched_class fair_class;
+
+u8 sched_set_nice(struct thread* thread, i32 nice)
+{
+    if (thread->class == &fair_class) {
+        return fair_set_nice(thread, &rq, nice);
+    }
+
+    if (nice < FAIR_NICE_MIN || nice > FAIR_NICE_MAX) {
+        return 0;
+    }
+    thread->nice = nice;
+    return 1;
+}
+
 struct rq* get_rq(void)
 {
     return &rq;
@@ -0,0 +1,87 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/benchmark.h>
+#include <citrus/sched.h>
+#include <citrus/thread.h>
+#include <citrus/vmalloc.h>
+#include <citrus/print.h>
+#include <stddef.h>
+
+// Largest number of runnable threads in the pick-next benchmarks
+#define SCHED_BENCH_THREADS 256
+
+// Number of picks measured per run
+#define SCHED_BENCH_ROUNDS 4096
+
+extern const struct sched_class rt_class;
+
+// Private runqueue, so that the threads in the system are not affected
+static struct rq bench_rq;
+static struct thread* bench_threads;
+
+// Enqueues a number of dummy threads on random priority levels and measures
+// the cost of picking the next thread
+static void rt_bench_pick(struct benchmark_ctx* ctx, u32 threads)
+{
+    u32 seed = 0x2545F491;
+    rt_class.init(&bench_rq);
+
+    for (u32 i = 0; i < threads; i++) {
+        struct thread* thread = &bench_threads[i];
+
+        list_node_init(&thread->node);
+        thread->rt_prio = benchmark_rand(&seed) % RT_PRIO_LEVELS;
+        rt_class.enqueue(thread, &bench_rq);
+    }
+
+    benchmark_begin(ctx);
+    for (u32 i = 0; i < SCHED_BENCH_ROUNDS; i++) {
+        rt_class.pick_next(&bench_rq);
+    }
+    benchmark_end(ctx);
+
+    ctx->ops = SCHED_BENCH_ROUNDS;
+}
+
+static void rt_bench_pick_1(struct benchmark_ctx* ctx)
+{
+    rt_bench_pick(ctx, 1);
+}
+
+static void rt_bench_pick_8(struct benchmark_ctx* ctx)
+{
+    rt_bench_pick(ctx, 8);
+}
+
+static void rt_bench_pick_64(struct benchmark_ctx* ctx)
+{
+    rt_bench_pick(ctx, 64);
+}
+
+static void rt_bench_pick_256(struct benchmark_ctx* ctx)
+{
+    rt_bench_pick(ctx, SCHED_BENCH_THREADS);
+}
+
+static const struct benchmark sched_benchmarks[] = {
+    { "rt_pick_1",   rt_bench_pick_1   },
+    { "rt_pick_8",   rt_bench_pick_8   },
+    { "rt_pick_64",  rt_bench_pick_64  },
+    { "rt_pick_256", rt_bench_pick_256 }
+};
+
+// Runs the real-time pick-next benchmarks. The cycles per pick should be the
+// same for every thread count
+void sched_benchmark(void)
+{
+    bench_threads = vzmalloc(SCHED_BENCH_THREADS * sizeof(struct thread));
+    if (bench_threads == NULL) {
+        print("sched_benchmark: out of memory\n");
+        return;
+    }
+
+    benchmark_run(sched_benchmarks,
+        sizeof(sched_benchmarks) / sizeof(sched_benchmarks[0]));
+
+    vfree(bench_threads);
+}
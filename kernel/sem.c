@@ -0,0 +1,69 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/sem.h>
+#include <citrus/atomic.h>
+#include <stddef.h>
+
+void sem_init(struct sem* sem, u32 count)
+{
+    sem->count = count;
+    wait_queue_init(&sem->wait);
+}
+
+// A woken thread takes the count in a new check, since a running thread might
+// have taken it first. The timeout starts over in that case
+u8 sem_wait_timeout(struct sem* sem, u32 ms)
+{
+    u32 atomic = __atomic_enter();
+
+    u8 status = 1;
+    while (sem->count == 0) {
+        if (!wait_queue_wait_timeout(&sem->wait, ms)) {
+            status = 0;
+            break;
+        }
+    }
+    if (status) {
+        sem->count--;
+    }
+
+    __atomic_leave(atomic);
+    return status;
+}
+
+void sem_wait(struct sem* sem)
+{
+    sem_wait_timeout(sem, 0);
+}
+
+u8 sem_trywait(struct sem* sem)
+{
+    u32 atomic = __atomic_enter();
+
+    u8 status = 0;
+    if (sem->count) {
+        sem->count--;
+        status = 1;
+    }
+
+    __atomic_leave(atomic);
+    return status;
+}
+
+void sem_post_irq(struct sem* sem)
+{
+    u32 atomic = __atomic_enter();
+    sem->count++;
+    wait_queue_wake_one(&sem->wait);
+    __atomic_leave(atomic);
+}
+
+void sem_post(struct sem* sem)
+{
+    u32 atomic = __atomic_enter();
+    sem->count++;
+    struct thread* thread = wait_queue_wake_one(&sem->wait);
+    __atomic_leave(atomic);
+
+    wait_preempt(thread);
+}
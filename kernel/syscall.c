@@ -7,6 +7,7 @@
 #include <citrus/thread.h>
 #include <citrus/page_alloc.h>
 #include <citrus/mm.h>
+#include <citrus/wait.h>
 
 #define __syscall_def(x)        \
     asm volatile ("svc #"#x""); \
@@ -14,6 +15,9 @@
 
 #define __syscall(x) __syscall_def(x)
 
+// Core scheduler
+void core_sched(struct rq* rq, u32 reschedule);
+
 void __svc_attr syscall_thread_sleep(u32 ms)
 {
     __syscall(SYSCALL_SLEEP);
@@ -25,7 +29,7 @@ i32 __svc_attr syscall_create_thread(pid_t* pid, u32 (*func)(void *),
     __syscall(SYSCALL_CREATE_THREAD);
 }
 
-u32 __svc_attr syscall_sbrk(u32 bytes)
+u32 __svc_attr syscall_sbrk(i32 bytes)
 {
     __syscall(SYSCALL_SBRK);
 }
@@ -35,6 +39,32 @@ void __svc_attr syscall_kill(struct thread* thread)
     __syscall(SYSCALL_KILL);
 }
 
+struct thread* __svc_attr syscall_clone_process(i32 (*func)(void *),
+    u32 stack_words, const char* name, void* args, u32 flags)
+{
+    __syscall(SYSCALL_CLONE_PROCESS);
+}
+
+u32 __svc_attr syscall_set_prio(u32 prio)
+{
+    __syscall(SYSCALL_SET_PRIO);
+}
+
+u32 __svc_attr syscall_set_nice(i32 nice)
+{
+    __syscall(SYSCALL_SET_NICE);
+}
+
+void __svc_attr syscall_wait(struct wait_queue* wq, u32 ms)
+{
+    __syscall(SYSCALL_WAIT);
+}
+
+void __svc_attr syscall_yield(void)
+{
+    __syscall(SYSCALL_YIELD);
+}
+
 // Called by the SVC vector. The AAPCS stackframe are preserved before this call.
 // The LR at the 5th position in the stack frame will contain the return value
 // after the SVC vector. The SVC instruction is 4 bytes before the LR causing
@@ -67,7 +97,31 @@ void supervisor_exception(u32* sp)
             break;
         }
         case SYSCALL_SBRK : {
-            sp[0] = (u32)set_break(sp[0]);
+            sp[0] = (u32)set_break((i32)svc0);
+            break;
+        }
+        case SYSCALL_CLONE_PROCESS : {
+            sp[0] = (u32)clone_process((i32 (*)(void *))svc0, svc1,
+                (const char *)svc2, (void *)svc3, sp[7]);
+            break;
+        }
+        case SYSCALL_SET_PRIO : {
+            sp[0] = sched_set_prio(get_curr_thread(), svc0);
+
+            // A lower priority might let another thread run right away
+            core_sched(get_rq(), 1);
+            break;
+        }
+        case SYSCALL_SET_NICE : {
+            sp[0] = sched_set_nice(get_curr_thread(), (i32)svc0);
+            break;
+        }
+        case SYSCALL_WAIT : {
+            wait_block((struct wait_queue *)svc0, svc1);
+            break;
+        }
+        case SYSCALL_YIELD : {
+            core_sched(get_rq(), 1);
             break;
         }
         case SYSCALL_KILL : {
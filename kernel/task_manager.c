@@ -6,17 +6,22 @@
 #include <citrus/syscall.h>
 #include <citrus/mm.h>
 #include <citrus/cache.h>
+#include <citrus/zram.h>
+#include <citrus/compaction.h>
 
 #define BARS 20
 
 void print_thread_header(void)
 {
-    print_task("%3s %-16s %5s %11s\n", "PID", "NAME", "CPU%", "MEM");
+    print_task("%3s %-16s %5s %11s %7s\n", "PID", "NAME", "CPU%", "MEM",
+        "FAULTS");
 }
 
-void print_thread_stats(u32 pid, const char* name, u8 percent, u8 frac, u32 mem)
+void print_thread_stats(u32 pid, const char* name, u8 percent, u8 frac, u32 mem,
+    u32 faults)
 {
-    print_task("%3d %-16s %2d.%02d %8d KB\n", pid, name, percent, frac, mem);
+    print_task("%3d %-16s %2d.%02d %8d KB %7d\n", pid, name, percent, frac, mem,
+        faults);
 }
 
 void print_cpu_usage(u8 cpu_usage)
@@ -44,6 +49,35 @@ void print_mem_usage(u32 total, u32 used)
     print_task(NORMAL "%*s %3d%%]\n", space, "", used / (total / 100));
 }
 
+// Prints the compressed swap usage. The ratio is the size of the swapped
+// pages over the size of the compressed data
+void print_zram_usage(void)
+{
+    struct zram_stats stats;
+    zram_get_stats(&stats);
+
+    u32 comp_pages = stats.stored - stats.zero;
+    u32 ratio = (stats.comp_bytes >= 100) ?
+        comp_pages * 4096 / (stats.comp_bytes / 100) : 0;
+    u32 avg = (stats.swap_ins) ? stats.fault_cycles / stats.swap_ins : 0;
+
+    print_task("ZRAM %d pages in %d KB, ratio %d.%02d, %d faults avg %d max %d "
+        "cycles\n", stats.stored, stats.comp_bytes / 1024, ratio / 100,
+        ratio % 100, stats.swap_ins, avg, stats.fault_cycles_max);
+}
+
+// Prints the compaction passes and the fragmentation index of the last pass
+// before and after it ran
+void print_compact_usage(void)
+{
+    struct compact_stats stats;
+    compact_get_stats(&stats);
+
+    print_task("COMPACT %d runs %d failed %d pages moved, order %d frag %d%% "
+        "-> %d%%\n", stats.runs, stats.failed, stats.moved, stats.order,
+        stats.index_before, stats.index_after);
+}
+
 extern struct rq rq;
 
 i32 task_manager(void* args)
@@ -64,6 +98,8 @@ i32 task_manager(void* args)
 
         print_cpu_usage(100 - idle_percent);
         print_mem_usage(mm_get_total(), mm_get_total_used());
+        print_zram_usage();
+        print_compact_usage();
 
         // Print the thread header
         print_thread_header();
@@ -78,7 +114,11 @@ i32 task_manager(void* args)
             u32 fraction = (runtime / 100) - (percent * 100);
             u32 mem_kib = t->page_cnt * 4;
 
-            print_thread_stats(t->pid, t->name, percent, fraction, mem_kib);
+            // The demand paging faults are counted per process
+            u32 faults = (t->mmap) ? t->mmap->fault_cnt : 0;
+
+            print_thread_stats(t->pid, t->name, percent, fraction, mem_kib,
+                faults);
             t->last_runtime = t->runtime;
         }
         print_task("\n");
@@ -87,5 +127,6 @@ i32 task_manager(void* args)
 
 void task_manager_init(void)
 {
-    create_kthread(task_manager, 500, "taskmgmt", "HELLO", SCHED_RT);
+    create_kthread(task_manager, 500, "taskmgmt", "HELLO",
+        SCHED_RT | SCHED_PRIO(4));
 }
@@ -110,6 +110,7 @@ static void init_thread_struct(struct thread* thread)
     list_node_init(&thread->node);
     list_node_init(&thread->thread_group);
     list_node_init(&thread->thread_node);
+    list_init(&thread->pi_held);
 
     // Initialize the FPU context - 32 registers
     mem_set(thread->fpu_stack, 0, 32 * 4);
@@ -128,11 +129,26 @@ static void thread_set_name(struct thread* thread, const char* name)
     *dest = '\0';
 }
 
-// Sets the scheduler class in a thread given the thread flags
+// Sets the scheduler class and the real-time priority in a thread given the
+// thread flags
 static void thread_set_sched_class(struct thread* thread, u32 flags)
 {
     const struct sched_class* class = get_sched_class(flags & 0b111);
     thread->class = class;
+    thread->rt_prio = (flags & SCHED_PRIO_MSK) >> SCHED_PRIO_POS;
+
+    thread->base_class = class;
+    thread->base_prio = thread->rt_prio;
+    thread->pi_prio = 0;
+
+    // Sign extend the nice level
+    i32 nice = (i32)((flags & SCHED_NICE_MSK) << (26 - SCHED_NICE_POS)) >> 26;
+    if (nice < FAIR_NICE_MIN) {
+        nice = FAIR_NICE_MIN;
+    } else if (nice > FAIR_NICE_MAX) {
+        nice = FAIR_NICE_MAX;
+    }
+    thread->nice = nice;
 }
 
 // Creates a lightweight kernel thread in the kernel memory space
@@ -167,9 +183,6 @@ struct thread* create_kthread(i32 (*func)(void *), u32 stack_words,
     thread_set_sched_class(thread, flags);
     sched_enqueue_thread(thread);
 
-    dcache_clean();
-    icache_invalidate();
-
     return thread;
 }
 
@@ -180,8 +193,9 @@ void kill_kernel_thread(struct thread* t)
 }
 
 // Core function for creating a user thread. This assumes that a memory space 
-// is created. It will allocate a new stack region
-static inline void create_user_thread_core(struct thread* thread,
+// is created. It will allocate a new stack region. Returns 0 if the stack
+// could not be allocated or mapped
+static inline u8 create_user_thread_core(struct thread* thread,
     i32 (*func)(void *), u32 stack_words,const char* name, void* args, u32 flags)
 {
     assert(thread->mmap != NULL);
@@ -189,51 +203,60 @@ static inline void create_user_thread_core(struct thread* thread,
     // Set the name of the thread
     thread_set_name(thread, name);
 
-    // Map in the stack region. This will allocate a number of pages and map
-    // them into the stack region in the process memory map
+    // Reserve the stack region in the process memory map. Only the top page
+    // is mapped in here since it holds the initial stack frame. The rest is
+    // mapped in by the data abort handler when the stack grows
     u32 stack_page_cnt = (u32)align_up_ptr((void *)stack_words, 4096) / 4096;
-    u32 stack_order = pages_to_order(stack_page_cnt);
-    stack_page_cnt = (1 << stack_order);
-    
-    // Allocate and add the pages
-    struct page* stack_page_ptr = alloc_pages(stack_order);
-    mm_process_add_page(stack_page_ptr, thread->mmap);
+    if (stack_page_cnt == 0) {
+        stack_page_cnt = 1;
+    }
+
+    u32* stack_e = thread->mmap->stack_e - stack_page_cnt * (4096 / 4);
+    u32* heap_e = thread->mmap->heap_e;
+    if (stack_e > thread->mmap->stack_e || (heap_e && stack_e < heap_e)) {
+        return 0;
+    }
+
+    struct page* stack_page_ptr = alloc_page();
+    if (stack_page_ptr == NULL) {
+        return 0;
+    }
 
     struct pte_attr attr = {
         .access = PTE_ACCESS_FULL_ACC,
-        .mem    = PTE_MEM_WRITE_THROUGH,
+        .mem    = PTE_MEM_WRITE_ALLOC,
         .domain = 15,
-        .nG     = 0,
+        .nG     = 1,
         .xn     = 0
     };
 
-    // Allocate space in the process virtual memory space for the stack
-    thread->mmap->stack_e -= stack_page_cnt * (4096 / 4);
-
-    // Map in the stack in the process virtual memory
-    u8 status = mm_map_in_pages(thread->mmap, stack_page_ptr, stack_page_cnt, 
-        (u32)thread->mmap->stack_e, &attr);
+    // Map in the top page in the process virtual memory
+    u32* stack_top = stack_e + (stack_page_cnt - 1) * (4096 / 4);
+    u8 status = mm_map_in_pages(thread->mmap, stack_page_ptr, 1, 
+        (u32)stack_top, &attr);
 
-    assert(status);
+    if (status == 0) {
+        free_pages(stack_page_ptr);
+        return 0;
+    }
 
-    // Invalidate the stack region in the D-cache
-    u32 start = (u32)page_to_va(stack_page_ptr);
+    // The stack page is released together with the process page tables
+    stack_page_ptr->ref = 1;
+    thread->mmap->stack_e = stack_e;
 
     // Setup the stack using kernel logical addressing
     u32* sp_kern_virt = page_to_va(stack_page_ptr);
-    u32* sp_usr_virt = thread->mmap->stack_e;
 
-    u32* sp = sp_kern_virt + stack_page_cnt * 1024 - 1;
+    u32* sp = sp_kern_virt + 1024 - 1;
     sp = stack_setup(sp, func, args, USER_THREAD_CPSR);
-    thread->stack = sp_usr_virt + (sp - sp_kern_virt);
-
-    dcache_clean();
-    icache_invalidate();
+    thread->stack = stack_top + (sp - sp_kern_virt);
 
     // Add the thread to the global thread list
     sched_add_thread(thread);
     thread_set_sched_class(thread, flags);
     sched_enqueue_thread(thread);
+
+    return 1;
 }
 
 // Creates a user thread within the memory space of the parent process
@@ -243,6 +266,9 @@ struct thread* create_thread(i32 (*func)(void *), u32 stack_words,
     struct thread* thread = kzmalloc(sizeof(struct thread));
     //print("Creating a user thread: %p\n", thread);
 
+    if (thread == NULL) {
+        return NULL;
+    }
     init_thread_struct(thread);
 
     // Find the parent thread
@@ -254,10 +280,13 @@ struct thread* create_thread(i32 (*func)(void *), u32 stack_words,
     list_add_first(&thread->thread_group, &parent->thread_group);
 
     // Create the thread
-    create_user_thread_core(thread, func, stack_words, name, args, flags);
+    if (create_user_thread_core(thread, func, stack_words, name, args,
+        flags) == 0) {
 
-    dcache_clean();
-    icache_invalidate();
+        list_delete_node(&thread->thread_group);
+        kfree(thread);
+        return NULL;
+    }
 
     return NULL;
 }
@@ -269,19 +298,67 @@ struct thread* create_process(i32 (*func)(void *), u32 stack_words,
     struct thread* thread = kzmalloc(sizeof(struct thread));
     //print("Creating a user process: %p\n", thread);
 
+    if (thread == NULL) {
+        return NULL;
+    }
     init_thread_struct(thread);
 
     // Make a new memory space
-    process_mm_init(thread, stack_words);
-    create_user_thread_core(thread, func, stack_words, name, args, flags);
+    if (process_mm_init(thread, stack_words) == NULL) {
+        kfree(thread);
+        return NULL;
+    }
+
+    if (create_user_thread_core(thread, func, stack_words, name, args,
+        flags) == 0) {
+
+        process_mm_free(thread);
+        kfree(thread);
+        return NULL;
+    }
 
     // Must be initialized after the create_thread_core beacuse it initializes
     // the thread group as a list node
     thread->process = thread;
     list_init(&thread->thread_group);
 
-    dcache_clean();
-    icache_invalidate();
+    return thread;
+}
+
+// Creates a new process with a copy-on-write copy of the memory space of the
+// current process. The new process starts in `func` on a new stack. Nothing is
+// copied until one of the processes writes to a shared page
+struct thread* clone_process(i32 (*func)(void *), u32 stack_words,
+    const char* name, void* args, u32 flags)
+{
+    struct thread* parent = get_curr_thread();
+    if (parent->mmap == NULL) {
+        return NULL;
+    }
+
+    struct thread* thread = kzmalloc(sizeof(struct thread));
+    if (thread == NULL) {
+        return NULL;
+    }
+    init_thread_struct(thread);
+
+    // Make a new memory space sharing all the pages with the parent
+    if (process_mm_init(thread, stack_words) == NULL) {
+        kfree(thread);
+        return NULL;
+    }
+
+    if (mm_clone(thread->mmap, parent->mmap) == 0 ||
+        create_user_thread_core(thread, func, stack_words, name, args,
+        flags) == 0) {
+
+        process_mm_free(thread);
+        kfree(thread);
+        return NULL;
+    }
+
+    thread->process = thread;
+    list_init(&thread->thread_group);
 
     return thread;
 }
@@ -293,9 +370,9 @@ void map_in_code(struct page* code_page, u32 pages, struct thread* thread)
 
     struct pte_attr attr = {
         .access = PTE_ACCESS_FULL_ACC,
-        .mem    = PTE_MEM_WRITE_THROUGH,
+        .mem    = PTE_MEM_WRITE_ALLOC,
         .domain = 15,
-        .nG     = 0,
+        .nG     = 1,
         .xn     = 0
     };
 
@@ -304,20 +381,31 @@ void map_in_code(struct page* code_page, u32 pages, struct thread* thread)
     assert(status);
 
     mm_tlb_invalidate();
-    dcache_clean();
-    icache_invalidate();
+
+    u32 start = (u32)page_to_va(code_page);
+    icache_sync_range(start, start + pages * 4096);
 }
 
-// Adding a number of pages to a thread. This also updated the parent process
-// memory makp, and adds the pages to the mm pages list
-void curr_thread_add_pages(struct page* page, u32 pages)
+// Adds a number of pages to the memory statistics of the current thread and
+// its process. The user pages are tracked by the page tables, not the page list
+void curr_thread_add_pages(u32 pages)
 {
     struct thread* t = get_curr_thread();
 
     t->page_cnt += pages;
     t->mmap->page_cnt += pages;
+}
+
+// Removes pages from the memory statistics of the current thread and its
+// process. The pages might have been faulted in by another thread in the
+// process, so the thread count stops at zero
+void curr_thread_sub_pages(u32 pages)
+{
+    struct thread* t = get_curr_thread();
 
-    mm_process_add_page(page, t->mmap);
+    t->page_cnt -= (pages < t->page_cnt) ? pages : t->page_cnt;
+    t->mmap->page_cnt -= (pages < t->mmap->page_cnt) ? pages :
+        t->mmap->page_cnt;
 }
 
 // Returns the memory managment structure of the current (parent) process of 
@@ -0,0 +1,297 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/timer_wheel.h>
+#include <citrus/sched.h>
+#include <citrus/cpu_timer.h>
+#include <citrus/atomic.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// Hierarchical timing wheel. A timer is placed on the lowest level whose range
+// covers its timeout, so insert and delete are O(1). When the lowest level
+// wraps around, the next slot on the level above is cascaded down
+struct timer_wheel {
+    struct list_node slots[TIMER_LEVELS][TIMER_SLOTS];
+
+    // One bit per slot which is in use
+    u64 used[TIMER_LEVELS];
+
+    // The next jiffy to process
+    u64 jiffies;
+
+    // Cached result of the next event search. A deleted timer might leave it
+    // early, which only costs a spurious tick
+    u64 next;
+};
+
+static struct timer_wheel wheel;
+
+// Time since the last scheduler tick is read from the CPU timer, since the
+// tick is not updated while the CPU idles
+static inline u64 timer_now(void)
+{
+    return get_kernel_tick() + cpu_timer_get_value_us();
+}
+
+static inline u32 timer_slot_index(u64 expires, u32 level)
+{
+    return (expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+}
+
+// Places a pending timer on the level covering its timeout. An expired timer
+// goes in the slot processed next. The caller must have interrupts masked
+static void timer_enqueue(struct timer* timer)
+{
+    u64 expires = timer->expires;
+    if (expires < wheel.jiffies) {
+        expires = wheel.jiffies;
+    }
+    u64 delta = expires - wheel.jiffies;
+
+    u32 level = 0;
+    while (level < TIMER_LEVELS - 1 &&
+        delta >= (1ULL << ((level + 1) * TIMER_SLOT_BITS))) {
+        level++;
+    }
+
+    // Cut the timeout to the range of the top level
+    if (delta >> (TIMER_LEVELS * TIMER_SLOT_BITS)) {
+        expires = wheel.jiffies + (1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS))
+            - 1;
+        timer->expires = expires;
+    }
+
+    u32 index = timer_slot_index(expires, level);
+    list_add_last(&timer->node, &wheel.slots[level][index]);
+    wheel.used[level] |= (1ULL << index);
+    timer->slot = (level << TIMER_SLOT_BITS) | index;
+}
+
+static void timer_dequeue(struct timer* timer)
+{
+    u32 level = timer->slot >> TIMER_SLOT_BITS;
+    u32 index = timer->slot & TIMER_SLOT_MASK;
+
+    list_delete_node(&timer->node);
+    if (list_is_empty(&wheel.slots[level][index])) {
+        wheel.used[level] &= ~(1ULL << index);
+    }
+}
+
+// Moves all timers in a slot down to the levels covering their timeouts
+static void timer_cascade(u32 level, u32 index)
+{
+    struct list_node* slot = &wheel.slots[level][index];
+    wheel.used[level] &= ~(1ULL << index);
+
+    while (!list_is_empty(slot)) {
+        struct timer* timer = list_get_entry(slot->next, struct timer, node);
+        list_delete_node(&timer->node);
+        timer_enqueue(timer);
+    }
+}
+
+// Returns the number of slots from the index to the first slot in use,
+// wrapping around. Returns TIMER_SLOTS if no slot is used
+static inline u32 timer_next_slot(u64 used, u32 index)
+{
+    if (used == 0) {
+        return TIMER_SLOTS;
+    }
+    u64 high = used >> index;
+    if (high) {
+        return __builtin_ctzll(high);
+    }
+    return __builtin_ctzll(used) + TIMER_SLOTS - index;
+}
+
+// Finds the first jiffy where a timer fires or a slot has to be cascaded.
+// Returns 0 if the wheel is empty
+static u64 timer_find_next(void)
+{
+    u64 next = 0;
+
+    u32 dist = timer_next_slot(wheel.used[0], wheel.jiffies & TIMER_SLOT_MASK);
+    if (dist < TIMER_SLOTS) {
+        next = wheel.jiffies + dist;
+    }
+
+    for (u32 level = 1; level < TIMER_LEVELS; level++) {
+        if (wheel.used[level] == 0) {
+            continue;
+        }
+        u32 shift = level * TIMER_SLOT_BITS;
+        u64 pos = wheel.jiffies >> shift;
+
+        // The current slot is cascaded when the jiffy is on its boundary. Past
+        // the boundary it was cascaded already, and nothing is placed in it
+        // until the level wraps
+        u32 start = 0;
+        if (wheel.jiffies & ((1ULL << shift) - 1)) {
+            start = 1;
+        }
+        dist = timer_next_slot(wheel.used[level], (pos + start) &
+            TIMER_SLOT_MASK) + start;
+
+        u64 cascade = (pos + dist) << shift;
+        if (next == 0 || cascade < next) {
+            next = cascade;
+        }
+    }
+    return next;
+}
+
+void timer_setup(struct timer* timer, void (*func)(void *), void* arg)
+{
+    timer->func = func;
+    timer->arg = arg;
+    timer->pending = 0;
+}
+
+// Returns 1 if no timer is pending on any level
+static inline u8 timer_wheel_empty(void)
+{
+    for (u32 level = 0; level < TIMER_LEVELS; level++) {
+        if (wheel.used[level]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Starts a timer. The caller must have interrupts masked
+static void __timer_add(struct timer* timer, u32 ms)
+{
+    u64 now = timer_now();
+    u64 deadline = now + (u64)ms * 1000;
+
+    // The scheduler does not run the wheel while it is empty, so the jiffy
+    // count might lag far behind. Move it up to the current time, so that the
+    // new timer is placed relative to now and does not hit the top level limit
+    if (timer_wheel_empty() && (now >> TIMER_JIFFY_SHIFT) > wheel.jiffies) {
+        wheel.jiffies = now >> TIMER_JIFFY_SHIFT;
+    }
+    u64 expires = (deadline + (1 << TIMER_JIFFY_SHIFT) - 1) >>
+        TIMER_JIFFY_SHIFT;
+
+    timer->expires = expires;
+    timer->pending = 1;
+    timer_enqueue(timer);
+
+    // Let the scheduler know if this is the first event
+    if (wheel.next == 0 || timer->expires < wheel.next) {
+        wheel.next = (timer->expires > wheel.jiffies) ? timer->expires :
+            wheel.jiffies;
+        sched_set_deadline(wheel.next << TIMER_JIFFY_SHIFT);
+    }
+}
+
+void timer_add(struct timer* timer, u32 ms)
+{
+    u32 atomic = __atomic_enter();
+
+    if (timer->pending) {
+        panic("Timer is already pending");
+    }
+    __timer_add(timer, ms);
+
+    __atomic_leave(atomic);
+}
+
+u8 timer_mod(struct timer* timer, u32 ms)
+{
+    u32 atomic = __atomic_enter();
+
+    u8 pending = timer->pending;
+    if (pending) {
+        timer_dequeue(timer);
+    }
+    __timer_add(timer, ms);
+
+    __atomic_leave(atomic);
+    return pending;
+}
+
+u8 timer_del(struct timer* timer)
+{
+    u32 atomic = __atomic_enter();
+
+    u8 pending = timer->pending;
+    if (pending) {
+        timer_dequeue(timer);
+        timer->pending = 0;
+    }
+
+    __atomic_leave(atomic);
+    return pending;
+}
+
+void timer_wheel_init(u64 now)
+{
+    for (u32 level = 0; level < TIMER_LEVELS; level++) {
+        for (u32 i = 0; i < TIMER_SLOTS; i++) {
+            list_init(&wheel.slots[level][i]);
+        }
+        wheel.used[level] = 0;
+    }
+    wheel.jiffies = now >> TIMER_JIFFY_SHIFT;
+    wheel.next = 0;
+}
+
+// Processes every jiffy up to the time given. This is called by the scheduler
+// tick with interrupts masked
+void timer_run(u64 now)
+{
+    u64 target = now >> TIMER_JIFFY_SHIFT;
+
+    while (wheel.jiffies <= target) {
+        u32 index = wheel.jiffies & TIMER_SLOT_MASK;
+
+        // Nothing can happen before the lowest level wraps, so a long idle
+        // period is skipped in steps of 64 jiffies
+        if (index && wheel.used[0] == 0) {
+            u64 wrap = (wheel.jiffies | TIMER_SLOT_MASK) + 1;
+            wheel.jiffies = (wrap < target + 1) ? wrap : target + 1;
+            continue;
+        }
+
+        // Cascade the upper levels when the level below wraps around
+        if (index == 0) {
+            for (u32 level = 1; level < TIMER_LEVELS; level++) {
+                u32 slot = timer_slot_index(wheel.jiffies, level);
+                timer_cascade(level, slot);
+                if (slot) {
+                    break;
+                }
+            }
+        }
+
+        // The jiffy is moved on before the callbacks run, so a timer started
+        // again from its own callback does not fire twice in this jiffy
+        struct list_node expired;
+        list_init(&expired);
+
+        struct list_node* slot = &wheel.slots[0][index];
+        while (!list_is_empty(slot)) {
+            struct list_node* node = slot->next;
+            list_delete_node(node);
+            list_add_last(node, &expired);
+        }
+        wheel.used[0] &= ~(1ULL << index);
+        wheel.jiffies++;
+
+        while (!list_is_empty(&expired)) {
+            struct timer* timer = list_get_entry(expired.next, struct timer,
+                node);
+            list_delete_node(&timer->node);
+            timer->pending = 0;
+            timer->func(timer->arg);
+        }
+    }
+    wheel.next = timer_find_next();
+}
+
+u64 timer_next_event(void)
+{
+    return wheel.next << TIMER_JIFFY_SHIFT;
+}
@@ -0,0 +1,139 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/wait.h>
+#include <citrus/sched.h>
+#include <citrus/thread.h>
+#include <citrus/syscall.h>
+#include <citrus/timer_wheel.h>
+#include <citrus/atomic.h>
+#include <stddef.h>
+
+// Core scheduler
+void core_sched(struct rq* rq, u32 reschedule);
+
+void wait_queue_init(struct wait_queue* wq)
+{
+    list_init(&wq->threads);
+}
+
+// Inserts a thread after the waiters of the same or a higher priority. A
+// blocked thread is off its runqueue, so the runqueue node is free to use
+static void wait_insert(struct wait_queue* wq, struct thread* thread)
+{
+    u32 prio = sched_pi_prio(thread);
+
+    struct list_node* node;
+    list_iterate(node, &wq->threads) {
+        struct thread* t = list_get_entry(node, struct thread, node);
+
+        if (sched_pi_prio(t) < prio) {
+            list_add_before(&thread->node, &t->node);
+            return;
+        }
+    }
+    list_add_last(&thread->node, &wq->threads);
+}
+
+void wait_queue_remove(struct thread* thread)
+{
+    list_delete_node(&thread->node);
+    thread->wait_queue = NULL;
+}
+
+void wait_queue_requeue(struct wait_queue* wq, struct thread* thread)
+{
+    list_delete_node(&thread->node);
+    wait_insert(wq, thread);
+}
+
+// Timeout callback taking a thread out of its wait queue
+static void wait_timeout(void* arg)
+{
+    struct thread* thread = arg;
+    if (thread->state != THREAD_WAIT) {
+        return;
+    }
+
+    wait_queue_remove(thread);
+    thread->wait_timed_out = 1;
+    sched_enqueue_thread(thread);
+}
+
+// Called from the SVC handler with interrupts masked. The current thread is
+// taken off its runqueue before it is linked into the wait queue
+void wait_block(struct wait_queue* wq, u32 ms)
+{
+    struct thread* curr = get_curr_thread();
+
+    sched_dequeue_thread(curr);
+    curr->state = THREAD_WAIT;
+    curr->wait_queue = wq;
+    curr->wait_timed_out = 0;
+    wait_insert(wq, curr);
+
+    if (ms) {
+        timer_setup(&curr->sleep_timer, wait_timeout, curr);
+        timer_add(&curr->sleep_timer, ms);
+    }
+
+    core_sched(get_rq(), 1);
+}
+
+void wait_queue_wait(struct wait_queue* wq)
+{
+    syscall_wait(wq, 0);
+}
+
+u8 wait_queue_wait_timeout(struct wait_queue* wq, u32 ms)
+{
+    struct thread* curr = get_curr_thread();
+
+    syscall_wait(wq, ms);
+    return !curr->wait_timed_out;
+}
+
+static void wait_wake(struct thread* thread)
+{
+    wait_queue_remove(thread);
+    timer_del(&thread->sleep_timer);
+    sched_enqueue_thread(thread);
+}
+
+struct thread* wait_queue_wake_one(struct wait_queue* wq)
+{
+    u32 atomic = __atomic_enter();
+
+    struct thread* thread = NULL;
+    if (!list_is_empty(&wq->threads)) {
+        thread = list_get_entry(wq->threads.next, struct thread, node);
+        wait_wake(thread);
+    }
+
+    __atomic_leave(atomic);
+    return thread;
+}
+
+struct thread* wait_queue_wake_all(struct wait_queue* wq)
+{
+    u32 atomic = __atomic_enter();
+
+    struct thread* first = NULL;
+    while (!list_is_empty(&wq->threads)) {
+        struct thread* thread = list_get_entry(wq->threads.next,
+            struct thread, node);
+        if (first == NULL) {
+            first = thread;
+        }
+        wait_wake(thread);
+    }
+
+    __atomic_leave(atomic);
+    return first;
+}
+
+void wait_preempt(struct thread* woken)
+{
+    if (woken && sched_pi_prio(woken) > sched_pi_prio(get_curr_thread())) {
+        syscall_yield();
+    }
+}
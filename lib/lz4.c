@@ -0,0 +1,198 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/lz4.h>
+#include <citrus/mem.h>
+
+#define LZ4_MIN_MATCH 4
+
+// The last five bytes are always literals, and the last match must start at
+// least twelve bytes before the end of the block
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+
+// The data is not aligned
+static inline u32 lz4_read32(const u8* ptr)
+{
+    return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((u32)ptr[3] << 24);
+}
+
+static inline u32 lz4_hash(u32 seq)
+{
+    return (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// Writes the part of a length which does not fit in the token
+static inline u8* lz4_write_len(u8* out, u32 len)
+{
+    while (len >= 255) {
+        *out++ = 255;
+        len -= 255;
+    }
+    *out++ = len;
+    return out;
+}
+
+// Returns the worst case size of a sequence
+static inline u32 lz4_seq_size(u32 lit, u32 match)
+{
+    return 1 + lit / 255 + 1 + lit + 2 + match / 255 + 1;
+}
+
+// Writes a sequence of literals followed by a match. A zero offset means that
+// this is the last sequence which only holds literals
+static u8* lz4_write_seq(u8* out, const u8* lit, u32 lit_len, u32 offset,
+    u32 match_len)
+{
+    u8* token = out++;
+
+    *token = ((lit_len >= 15) ? 15 : lit_len) << 4;
+    if (lit_len >= 15) {
+        out = lz4_write_len(out, lit_len - 15);
+    }
+    mem_copy(lit, out, lit_len);
+    out += lit_len;
+
+    if (offset == 0) {
+        return out;
+    }
+
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+
+    *token |= (match_len >= 15) ? 15 : match_len;
+    if (match_len >= 15) {
+        out = lz4_write_len(out, match_len - 15);
+    }
+    return out;
+}
+
+u32 lz4_compress(const void* src, u32 size, void* dest, u32 cap, u16* table)
+{
+    const u8* in = (const u8 *)src;
+    const u8* in_end = in + size;
+    const u8* anchor = in;
+    u8* out = (u8 *)dest;
+    u8* out_end = out + cap;
+
+    if (size > LZ4_MAX_INPUT) {
+        return 0;
+    }
+
+    // The positions in the table are verified before use, so a zeroed table
+    // is enough
+    mem_set(table, 0, LZ4_HASH_SIZE * sizeof(u16));
+
+    if (size > LZ4_MFLIMIT) {
+        const u8* match_limit = in_end - LZ4_MFLIMIT;
+        const u8* ptr = in;
+
+        while (ptr <= match_limit) {
+            u32 seq = lz4_read32(ptr);
+            u32 hash = lz4_hash(seq);
+            const u8* ref = in + table[hash];
+            table[hash] = ptr - in;
+
+            if (ref >= ptr || lz4_read32(ref) != seq) {
+                ptr++;
+                continue;
+            }
+
+            // Extend the match, leaving room for the last literals
+            const u8* match_end = ptr + LZ4_MIN_MATCH;
+            const u8* ref_end = ref + LZ4_MIN_MATCH;
+            while (match_end < in_end - LZ4_LAST_LITERALS &&
+                *match_end == *ref_end) {
+
+                match_end++;
+                ref_end++;
+            }
+
+            u32 lit_len = ptr - anchor;
+            u32 match_len = match_end - ptr - LZ4_MIN_MATCH;
+            if (lz4_seq_size(lit_len, match_len) > (u32)(out_end - out)) {
+                return 0;
+            }
+            out = lz4_write_seq(out, anchor, lit_len, ptr - ref, match_len);
+
+            ptr = match_end;
+            anchor = ptr;
+        }
+    }
+
+    // The rest of the block is literals
+    u32 lit_len = in_end - anchor;
+    if (1 + lit_len / 255 + 1 + lit_len > (u32)(out_end - out)) {
+        return 0;
+    }
+    out = lz4_write_seq(out, anchor, lit_len, 0, 0);
+
+    return out - (u8 *)dest;
+}
+
+// Reads the part of a length which did not fit in the token. Returns 0 if the
+// length runs past the end of the block
+static inline u8 lz4_read_len(const u8** in, const u8* in_end, u32* len)
+{
+    u8 byte;
+    do {
+        if (*in >= in_end) {
+            return 0;
+        }
+        byte = *(*in)++;
+        *len += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+i32 lz4_decompress(const void* src, u32 size, void* dest, u32 cap)
+{
+    const u8* in = (const u8 *)src;
+    const u8* in_end = in + size;
+    u8* out = (u8 *)dest;
+    u8* out_end = out + cap;
+
+    while (in < in_end) {
+        u8 token = *in++;
+
+        u32 lit_len = token >> 4;
+        if (lit_len == 15 && !lz4_read_len(&in, in_end, &lit_len)) {
+            return -1;
+        }
+        if (lit_len > (u32)(in_end - in) || lit_len > (u32)(out_end - out)) {
+            return -1;
+        }
+        mem_copy(in, out, lit_len);
+        in += lit_len;
+        out += lit_len;
+
+        // The last sequence has no match
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return -1;
+        }
+        u32 offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (u32)(out - (u8 *)dest)) {
+            return -1;
+        }
+
+        u32 match_len = token & 0xF;
+        if (match_len == 15 && !lz4_read_len(&in, in_end, &match_len)) {
+            return -1;
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > (u32)(out_end - out)) {
+            return -1;
+        }
+
+        // The match might overlap the output, so it is copied byte by byte
+        const u8* ref = out - offset;
+        while (match_len--) {
+            *out++ = *ref++;
+        }
+    }
+    return out - (u8 *)dest;
+}
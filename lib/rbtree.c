@@ -0,0 +1,236 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/rbtree.h>
+
+static inline u8 rb_is_black(struct rb_node* node)
+{
+    return node == NULL || node->color == RB_BLACK;
+}
+
+// Points the parent, or the root if there is no parent, to a new child
+static inline void rb_replace_child(struct rb_node* parent, struct rb_node* old,
+    struct rb_node* new, struct rb_root* root)
+{
+    if (parent == NULL) {
+        root->node = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static void rb_rotate_left(struct rb_node* node, struct rb_root* root)
+{
+    struct rb_node* right = node->right;
+
+    node->right = right->left;
+    if (right->left) {
+        right->left->parent = node;
+    }
+
+    right->parent = node->parent;
+    rb_replace_child(node->parent, node, right, root);
+
+    right->left = node;
+    node->parent = right;
+}
+
+static void rb_rotate_right(struct rb_node* node, struct rb_root* root)
+{
+    struct rb_node* left = node->left;
+
+    node->left = left->right;
+    if (left->right) {
+        left->right->parent = node;
+    }
+
+    left->parent = node->parent;
+    rb_replace_child(node->parent, node, left, root);
+
+    left->right = node;
+    node->parent = left;
+}
+
+// The new node is red. Only a red parent breaks the tree, which is fixed by
+// recoloring while the uncle is red and by one or two rotations otherwise
+void rb_insert_color(struct rb_node* node, struct rb_root* root)
+{
+    struct rb_node* parent;
+
+    while ((parent = node->parent) && parent->color == RB_RED) {
+        // A red parent is never the root, so the grandparent exists
+        struct rb_node* gparent = parent->parent;
+
+        if (parent == gparent->left) {
+            struct rb_node* uncle = gparent->right;
+            if (!rb_is_black(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(gparent, root);
+        } else {
+            struct rb_node* uncle = gparent->left;
+            if (!rb_is_black(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->node->color = RB_BLACK;
+}
+
+// Restores the black height after a black node is removed. The node which
+// took its place might be NULL, so the parent is passed along
+static void rb_erase_color(struct rb_node* node, struct rb_node* parent,
+    struct rb_root* root)
+{
+    while (node != root->node && rb_is_black(node)) {
+        if (node == parent->left) {
+            struct rb_node* sibling = parent->right;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->right;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (rb_is_black(sibling->right)) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(parent, root);
+            node = root->node;
+        } else {
+            struct rb_node* sibling = parent->left;
+            if (sibling->color == RB_RED) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->left;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (rb_is_black(sibling->left)) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(parent, root);
+            node = root->node;
+        }
+    }
+
+    if (node) {
+        node->color = RB_BLACK;
+    }
+}
+
+// A node with two children is replaced by its successor, so that the node
+// actually unlinked from the tree has at most one child
+void rb_erase(struct rb_node* node, struct rb_root* root)
+{
+    struct rb_node* child;
+    struct rb_node* parent;
+    u32 color;
+
+    if (node->left == NULL || node->right == NULL) {
+        child = (node->left) ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+
+        if (child) {
+            child->parent = parent;
+        }
+        rb_replace_child(parent, node, child, root);
+    } else {
+        struct rb_node* next = node->right;
+        while (next->left) {
+            next = next->left;
+        }
+
+        child = next->right;
+        color = next->color;
+
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            if (child) {
+                child->parent = parent;
+            }
+            parent->left = child;
+
+            next->right = node->right;
+            node->right->parent = next;
+        }
+
+        next->left = node->left;
+        node->left->parent = next;
+        next->parent = node->parent;
+        next->color = node->color;
+        rb_replace_child(node->parent, node, next, root);
+    }
+
+    if (color == RB_BLACK) {
+        rb_erase_color(child, parent, root);
+    }
+}
+
+struct rb_node* rb_first(struct rb_root* root)
+{
+    struct rb_node* node = root->node;
+    if (node == NULL) {
+        return NULL;
+    }
+
+    while (node->left) {
+        node = node->left;
+    }
+    return node;
+}
@@ -3,7 +3,6 @@
 #include <citrus/buddy_alloc.h>
 #include <citrus/print.h>
 #include <citrus/mem.h>
-#include <citrus/kmalloc.h>
 #include <citrus/align.h>
 #include <citrus/panic.h>
 #include <citrus/atomic.h>
@@ -41,25 +40,119 @@ static inline void toggle_bit(u32 bit, void* ptr)
     src[bit / 32] ^= (1 << (bit % 32)); 
 }
 
+// Adds a block to the free list of an order and marks the order as non-empty.
+// The first page is tagged so that the block can be found from any of its pages
+static inline void buddy_add_free(struct buddy_struct* buddy, struct page* page,
+    u32 order)
+{
+    list_add_first(&page->node, &buddy->orders[order].free_list);
+    page->order = order | BUDDY_FREE_BLOCK;
+    buddy->free_map |= (1 << order);
+}
+
+// Removes a block from the free list of an order. The order is marked as empty
+// in the summary bitmap if this was the last block
+static inline void buddy_delete_free(struct buddy_struct* buddy,
+    struct page* page, u32 order)
+{
+    list_delete_node(&page->node);
+    page->order = order;
+    if (list_is_empty(&buddy->orders[order].free_list)) {
+        buddy->free_map &= ~(1 << order);
+    }
+}
+
+// Gets the number of bytes sitting in the page caches. These are counted as
+// used by the buddy lists but are free for allocation
+static u32 buddy_get_cached(struct buddy_struct* buddy)
+{
+    u32 cached = 0;
+    for (u32 i = 0; i < BUDDY_PCP_ORDERS; i++) {
+        cached += (buddy->pcp[i].count << i) * 4096;
+    }
+    return cached;
+}
+
 // Gets the total number of bytes free
 static u32 buddy_get_free(struct mm_zone* zone)
 {
-    u32 total = zone->page_cnt * 4096;
     struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
-    return total - buddy->used;
+    u32 total = (zone->page_cnt - buddy->reserved) * 4096;
+    return total - (buddy->used - buddy_get_cached(buddy));
 }
 
 // Gets the total number of bytes used
 static u32 buddy_get_used(struct mm_zone* zone)
 {
     struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
-    return buddy->used;
+    return buddy->used - buddy_get_cached(buddy);
 }
 
 // Gets the total number of bytes in total
 static u32 buddy_get_total(struct mm_zone* zone)
 {
-    return zone->page_cnt * 4096;
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    return (zone->page_cnt - buddy->reserved) * 4096;
+}
+
+// Gets the number of page cache hits
+static u32 buddy_get_cache_hits(struct mm_zone* zone)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+
+    u32 hits = 0;
+    for (u32 i = 0; i < BUDDY_PCP_ORDERS; i++) {
+        hits += buddy->pcp[i].hits;
+    }
+    return hits;
+}
+
+// Gets the number of page cache misses
+static u32 buddy_get_cache_misses(struct mm_zone* zone)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+
+    u32 misses = 0;
+    for (u32 i = 0; i < BUDDY_PCP_ORDERS; i++) {
+        misses += buddy->pcp[i].misses;
+    }
+    return misses;
+}
+
+// Returns the number of free blocks of the given order, including the blocks
+// sitting in the page cache
+u32 buddy_get_free_blocks(struct mm_zone* zone, u32 order)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    if (order >= buddy->max_orders) {
+        return 0;
+    }
+
+    u32 atomic = __atomic_enter();
+    u32 blocks = list_get_size(&buddy->orders[order].free_list);
+    if (order < BUDDY_PCP_ORDERS) {
+        blocks += buddy->pcp[order].count;
+    }
+    __atomic_leave(atomic);
+
+    return blocks;
+}
+
+// Returns the order of the free block holding the page, or -1 if the page is
+// allocated. Pages in the page cache count as allocated. The caller must have
+// interrupts masked
+i32 buddy_free_order(struct mm_zone* zone, struct page* page)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    u32 index = page - zone->start;
+
+    for (u32 order = 0; order < buddy->max_orders; order++) {
+        struct page* head = zone->start + (index & ~((1 << order) - 1));
+        if (head->order == (order | BUDDY_FREE_BLOCK)) {
+            return order;
+        }
+    }
+    return -1;
 }
 
 // Initailzie the zone structure used for the buddy allocator
@@ -68,40 +161,84 @@ static void buddy_init_zone(struct mm_zone* zone)
     zone->get_used = buddy_get_used;
     zone->get_total = buddy_get_total;
     zone->get_free = buddy_get_free;
+    zone->get_cache_hits = buddy_get_cache_hits;
+    zone->get_cache_misses = buddy_get_cache_misses;
 }
 
-// The zone should have a pointer to the buddy structure. The buddy structure
-// need a bitmap and a order list in order to work. This should ideally be 
-// dynamically allocated by kmalloc
-u8 buddy_alloc_init(struct mm_zone* zone)
+static void __buddy_free(struct page* page, struct mm_zone* zone);
+
+// Frees all the usable pages in a new zone. The pages are freed in the biggest
+// naturally aligned blocks which fit, so that the zone does not have to be a
+// power of two. The caller must have interrupts masked
+static void buddy_free_range(struct mm_zone* zone, u32 start, u32 end)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+
+    while (start < end) {
+        u32 order = buddy->max_orders - 1;
+        if (start) {
+            u32 align_order = __builtin_ctz(start);
+            if (align_order < order) {
+                order = align_order;
+            }
+        }
+        while ((1 << order) > end - start) {
+            order--;
+        }
+
+        struct page* page = zone->start + start;
+        page->order = order;
+        __buddy_free(page, zone);
+
+        start += (1 << order);
+    }
+}
+
+// The zone should have a pointer to the buddy structure. The bitmap and the
+// order list are placed in the first pages after the `reserved` pages of the
+// zone, since the buddy allocator is what backs kmalloc. The zone may have any
+// size; it is treated as the next power of two where the pages past the end
+// are never freed
+u8 buddy_alloc_init(struct mm_zone* zone, u32 reserved)
 {
     // Initialize the zone
     buddy_init_zone(zone);
 
     struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
 
-    buddy->used = 0;
+    buddy->free_map = 0;
+
+    for (u32 i = 0; i < BUDDY_PCP_ORDERS; i++) {
+        buddy->pcp[i].head = NULL;
+        buddy->pcp[i].count = 0;
+        buddy->pcp[i].hits = 0;
+        buddy->pcp[i].misses = 0;
+    }
 
     // Find the order of the buddy allocator
-    u32 two_pwr_pages = round_down_power_two(zone->page_cnt);
+    u32 two_pwr_pages = round_up_power_two(zone->page_cnt);
     buddy->max_orders = __builtin_ctz(two_pwr_pages) + 1;
+    if (buddy->max_orders < 2) {
+        return 0;
+    }
     
     // The map size is in number of words 
     u32 map_size = get_map_size(buddy->max_orders);
+    u32 meta_size = sizeof(struct buddy_order) * buddy->max_orders +
+        map_size * 4;
+    u32 meta_pages = align_up(meta_size, 4096) / 4096;
 
-    u32* map = kmalloc(map_size * 4);
-    if (map == NULL)
+    if (reserved + meta_pages >= zone->page_cnt) {
         return 0;
-
-    // Zero the buddy bitmap 
-    mem_set(map, 0, map_size * 4);
+    }
 
     // Allocate the buddy lists and map pointers 
-    buddy->orders = (struct buddy_order *)
-        kmalloc(sizeof(struct buddy_order) * buddy->max_orders);
+    buddy->orders = (struct buddy_order *)page_to_va(zone->start + reserved);
+    u32* map = (u32 *)(buddy->orders + buddy->max_orders);
+    reserved += meta_pages;
 
-    if (buddy->orders == NULL)
-        return 0;
+    // Zero the buddy bitmap. This marks every block as allocated
+    mem_set(map, 0, map_size * 4);
 
     for (u32 i = buddy->max_orders; i --> 0;) {
         // Assign the map pointer 
@@ -116,11 +253,15 @@ u8 buddy_alloc_init(struct mm_zone* zone)
         list_init(&buddy->orders[i].free_list);
     }
 
-    // When the buddy system is initialized it should contain one single block 
-    // spanning the entire memory zone (power of two)
-    list_add_first(&zone->start->node,
-        &buddy->orders[buddy->max_orders - 1].free_list);
-    
+    // Free the usable pages into the buddy lists. The used counter is set up
+    // so that it only tracks the pages handed out after this point
+    u32 atomic = __atomic_enter();
+
+    buddy->reserved = reserved;
+    buddy->used = (zone->page_cnt - reserved) * 4096;
+    buddy_free_range(zone, reserved, zone->page_cnt);
+
+    __atomic_leave(atomic);
     return 1;
 }
 
@@ -129,29 +270,24 @@ u8 buddy_alloc_init(struct mm_zone* zone)
     ((index & ~((1 << (order + 1)) - 1)) >> (order + 1))
 
 // Takes in the requested order and the allocator zone and gives a pointer to 
-// the first page in that region
-struct page* buddy_alloc_pages(u32 order, struct mm_zone* zone)
+// the first page in that region. Returns NULL if no block is big enough. The
+// caller must have interrupts masked
+static struct page* __buddy_alloc(u32 order, struct mm_zone* zone)
 {
-    u32 atomic = __atomic_enter();
-
     struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
 
-    struct buddy_order* curr_order_obj = buddy->orders + order;
-    u32 curr_order = order;
-    
-    while (curr_order < buddy->max_orders) {
-        if (list_is_empty(&curr_order_obj->free_list) == 0) {
-            break;
-        }
-        curr_order++;
-        curr_order_obj++;
+    if (order >= buddy->max_orders) {
+        return NULL;
     }
 
-    if (curr_order >= buddy->max_orders) {
-        __atomic_leave(atomic);
-        panic("Buddy allocator out of memory");
+    // Find the smallest non-empty order which can hold the request. All orders
+    // below the requested order are masked out of the summary bitmap
+    u32 fit_map = buddy->free_map & ~((1 << order) - 1);
+    if (fit_map == 0) {
         return NULL;
     }
+    u32 curr_order = __builtin_ctz(fit_map);
+    struct buddy_order* curr_order_obj = buddy->orders + curr_order;
     
     // curr_order holds the index of the order which is able to store the 
     // requested memory. This does NOT have to be a perfect fit
@@ -169,7 +305,7 @@ struct page* buddy_alloc_pages(u32 order, struct mm_zone* zone)
     // We have a order which can hold a block. If this is a perfect fit, we have 
     // to remove the block. If this is too big, we still have to remove the 
     // block - because we are splitting it. 
-    list_delete_first(&curr_order_obj->free_list);
+    buddy_delete_free(buddy, new_page, curr_order);
 
     if (order == curr_order) {
         goto alloc_ok;
@@ -187,7 +323,7 @@ struct page* buddy_alloc_pages(u32 order, struct mm_zone* zone)
 
         // Split the block by insert the buddy into the free list 
         struct page* _page = zone->start + page_index + (1 << curr_order);
-        list_add_first(&_page->node, &buddy->orders[curr_order].free_list);
+        buddy_add_free(buddy, _page, curr_order);
 
     } while (curr_order > order);
 
@@ -195,20 +331,17 @@ alloc_ok:
     // Update the size from the allocation 
     new_page->order = order;
     buddy->used += (1 << order) * 4096;
-    __atomic_leave(atomic);
     return new_page;    
 }
 
-// Frees a page pointer allocated by the buddy allocator. This requires the
-// the order to be specified
-void buddy_free_pages(struct page* page, struct mm_zone* zone)
+// Frees a page pointer allocated by the buddy allocator. The order is taken
+// from the page structure. The caller must have interrupts masked
+static void __buddy_free(struct page* page, struct mm_zone* zone)
 {
-    u32 atomic = __atomic_enter();
     u32 order = page->order;
     u32 free_order = page->order;
 
     struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
-    struct buddy_order* curr_order = &buddy->orders[order];
     u32 index = page - zone->start;
 
     while (order < (buddy->max_orders - 1)) {
@@ -226,21 +359,183 @@ void buddy_free_pages(struct page* page, struct mm_zone* zone)
         }
 
         u32 buddy_index = index ^ (1 << order);
-        struct list_node* n = &(zone->start + buddy_index)->node;
-
-        list_delete_node(&(zone->start + buddy_index)->node);
+        buddy_delete_free(buddy, zone->start + buddy_index, order);
 
         index &= ~((1 << (order + 1)) - 1);
         order++;
     }
 
     page = zone->start + index;
-    list_add_first(&page->node, &buddy->orders[order].free_list);
+    buddy_add_free(buddy, page, order);
 
     if (buddy->used < (1 << free_order) * 4096) {
         panic("Buddy error\n");
     }
     buddy->used -= (1 << free_order) * 4096;
+}
+
+// The page cache is a LIFO stack linked through the page list nodes. Popping
+// and pushing uses exclusive load / store instead of masking the interrupts.
+// The exclusive monitor is cleared on every exception return, so the store
+// fails and the operation is retried if anything happened in between. The
+// count is updated after the store and can be off if an interrupt hits in
+// between, so it is only used as a hint. The drain counts the stack again
+static struct page* buddy_pcp_pop(struct buddy_pcp* pcp)
+{
+    struct list_node* node;
+
+    do {
+        node = (struct list_node *)__ldrex((volatile u32 *)&pcp->head);
+        if (node == NULL) {
+            __clrex();
+            return NULL;
+        }
+    } while (__strex((u32)node->next, (volatile u32 *)&pcp->head));
+
+    if (pcp->count) {
+        pcp->count--;
+    }
+    return list_get_entry(node, struct page, node);
+}
+
+static void buddy_pcp_push(struct buddy_pcp* pcp, struct page* page)
+{
+    struct list_node* node = &page->node;
+
+    do {
+        node->next = (struct list_node *)__ldrex((volatile u32 *)&pcp->head);
+    } while (__strex((u32)node, (volatile u32 *)&pcp->head));
+
+    pcp->count++;
+}
+
+// Returns the coldest pages in the page cache to the buddy lists until only
+// `keep` pages are left. The count is set from the pages left on the stack.
+// The caller must have interrupts masked
+static void buddy_pcp_drain(struct buddy_pcp* pcp, struct mm_zone* zone,
+    u32 keep)
+{
+    struct list_node* node = pcp->head;
+    struct list_node* last = NULL;
+    u32 count = 0;
+
+    // Skip the hot pages at the top of the stack
+    while (node && count < keep) {
+        last = node;
+        node = node->next;
+        count++;
+    }
+
+    if (last) {
+        last->next = NULL;
+    } else {
+        pcp->head = NULL;
+    }
+
+    while (node) {
+        struct list_node* next = node->next;
+        __buddy_free(list_get_entry(node, struct page, node), zone);
+        node = next;
+    }
+    pcp->count = count;
+}
+
+// Returns all the cached pages to the buddy lists. This is used when the
+// buddy lists cannot satisfy a request, since the cached pages can not merge.
+// The caller must have interrupts masked
+u8 buddy_pcp_drain_all(struct mm_zone* zone)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    u8 drained = 0;
+
+    for (u32 i = 0; i < BUDDY_PCP_ORDERS; i++) {
+        if (buddy->pcp[i].head) {
+            buddy_pcp_drain(&buddy->pcp[i], zone, 0);
+            drained = 1;
+        }
+    }
+    return drained;
+}
+
+// Moves a batch of blocks from the buddy lists into the page cache and returns
+// one of them. This is only done when the page cache is empty
+static struct page* buddy_pcp_refill(u32 order, struct mm_zone* zone)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    struct buddy_pcp* pcp = &buddy->pcp[order];
+
+    u32 atomic = __atomic_enter();
+
+    struct page* page = __buddy_alloc(order, zone);
+    if (page == NULL && buddy_pcp_drain_all(zone)) {
+        page = __buddy_alloc(order, zone);
+    }
+
+    for (u32 i = 1; page && i < BUDDY_PCP_BATCH; i++) {
+        struct page* extra = __buddy_alloc(order, zone);
+        if (extra == NULL) {
+            break;
+        }
+        extra->node.next = pcp->head;
+        pcp->head = &extra->node;
+        pcp->count++;
+    }
 
     __atomic_leave(atomic);
+    return page;
+}
+
+// Allocates 2^order pages from the buddy allocator. Returns NULL if no block
+// is big enough. The small orders are served from the per-order page cache
+struct page* buddy_alloc_pages(u32 order, struct mm_zone* zone)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+
+    if (order < BUDDY_PCP_ORDERS) {
+        struct buddy_pcp* pcp = &buddy->pcp[order];
+        struct page* page = buddy_pcp_pop(pcp);
+
+        // The statistics are not updated atomically, and an interrupt might
+        // lose an update
+        if (page) {
+            pcp->hits++;
+            return page;
+        }
+        pcp->misses++;
+        return buddy_pcp_refill(order, zone);
+    }
+
+    u32 atomic = __atomic_enter();
+
+    struct page* page = __buddy_alloc(order, zone);
+    if (page == NULL && buddy_pcp_drain_all(zone)) {
+        page = __buddy_alloc(order, zone);
+    }
+
+    __atomic_leave(atomic);
+    return page;
+}
+
+// Frees a page pointer allocated by the buddy allocator. Small blocks are
+// kept in the page cache, and the coldest ones are returned in a batch when
+// the cache grows too big
+void buddy_free_pages(struct page* page, struct mm_zone* zone)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+
+    if (page->order < BUDDY_PCP_ORDERS) {
+        struct buddy_pcp* pcp = &buddy->pcp[page->order];
+        buddy_pcp_push(pcp, page);
+
+        if (pcp->count > BUDDY_PCP_HIGH) {
+            u32 atomic = __atomic_enter();
+            buddy_pcp_drain(pcp, zone, BUDDY_PCP_HIGH - BUDDY_PCP_BATCH);
+            __atomic_leave(atomic);
+        }
+        return;
+    }
+
+    u32 atomic = __atomic_enter();
+    __buddy_free(page, zone);
+    __atomic_leave(atomic);
 }
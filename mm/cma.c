@@ -0,0 +1,172 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/cma.h>
+#include <citrus/mm.h>
+#include <citrus/buddy_alloc.h>
+#include <citrus/page_alloc.h>
+#include <citrus/mm_trace.h>
+#include <citrus/migrate.h>
+#include <citrus/atomic.h>
+#include <citrus/mem.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// The CMA zone is a normal buddy zone. Only the movable pages and the
+// contiguous allocations are taken from it
+static struct mm_zone cma_zone;
+static struct buddy_struct cma_buddy;
+
+// Marks the pages handed out by cma_alloc. These are pinned, and a block
+// holding any of them can not be emptied
+static u32 cma_map[CMA_PAGES / 32];
+
+static inline u8 cma_is_pinned(u32 index)
+{
+    return cma_map[index / 32] & (1 << (index % 32));
+}
+
+static void cma_set_pinned(u32 index, u32 pages, u8 pinned)
+{
+    for (u32 i = index; i < index + pages; i++) {
+        if (pinned) {
+            cma_map[i / 32] |= (1 << (i % 32));
+        } else {
+            cma_map[i / 32] &= ~(1 << (i % 32));
+        }
+    }
+}
+
+struct mm_zone* cma_init(struct page* start)
+{
+    cma_zone.alloc = &cma_buddy;
+    cma_zone.start = start;
+    cma_zone.page_cnt = CMA_PAGES;
+    assert(buddy_alloc_init(&cma_zone, 0));
+
+    mem_set(cma_map, 0, sizeof(cma_map));
+    return &cma_zone;
+}
+
+struct page* alloc_movable_page(void)
+{
+    struct page* page = buddy_alloc_pages(0, &cma_zone);
+    if (page == NULL) {
+        return alloc_page();
+    }
+
+    mm_trace_alloc(MM_TRACE_ALLOC_PAGES, (u32)__builtin_return_address(0),
+        page_to_va(page), 4096);
+    return page;
+}
+
+// Finds the block of 2^order pages which is cheapest to empty. A block is
+// skipped if it holds buddy metadata, pinned pages or page tables. The user
+// pages are the ones with a reference; everything else is free or on its way
+// to be. Returns the page index of the block or -1 if no block can be emptied.
+// The interrupts are masked for one block at a time
+static i32 cma_find_block(u32 order)
+{
+    u32 block = 1 << order;
+    i32 best = -1;
+    u32 best_used = block + 1;
+
+    for (u32 index = 0; index + block <= CMA_PAGES; index += block) {
+        if (index < cma_buddy.reserved) {
+            continue;
+        }
+
+        u32 used = 0;
+        u32 atomic = __atomic_enter();
+        for (u32 i = index; i < index + block; i++) {
+            struct page* page = &cma_zone.start[i];
+            if (cma_is_pinned(i) || (page->order & PAGE_PT_TABLE)) {
+                used = block + 1;
+                break;
+            }
+            if (page->ref) {
+                used++;
+            }
+        }
+        __atomic_leave(atomic);
+
+        if (used < best_used) {
+            best = index;
+            best_used = used;
+        }
+    }
+    return best;
+}
+
+// Moves the user pages out of the cheapest block of the given order, so that
+// the block can be handed out as one contiguous allocation. The pages are
+// moved by migrate_user_pages. Returns 1 if pages were moved
+static u8 cma_evacuate(u32 order)
+{
+    i32 index = cma_find_block(order);
+    if (index < 0) {
+        return 0;
+    }
+    return migrate_user_pages(cma_zone.start + index, 1 << order) != 0;
+}
+
+// Takes a block from the CMA zone and gives back the pages past the request.
+// The caller must have interrupts masked
+static struct page* cma_take(u32 pages, u32 order)
+{
+    struct page* page = buddy_alloc_pages(order, &cma_zone);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    split_pages(page, order);
+    for (u32 i = pages; i < (1 << order); i++) {
+        buddy_free_pages(&page[i], &cma_zone);
+    }
+
+    cma_set_pinned(page - cma_zone.start, pages, 1);
+    return page;
+}
+
+static struct page* cma_take_masked(u32 pages, u32 order)
+{
+    u32 atomic = __atomic_enter();
+    struct page* page = cma_take(pages, order);
+    __atomic_leave(atomic);
+    return page;
+}
+
+struct page* cma_alloc(u32 pages)
+{
+    if (pages == 0 || pages > CMA_PAGES) {
+        return NULL;
+    }
+    u32 order = pages_to_order(pages);
+
+    // The movable zero pool might sit on the pages needed. After that the user
+    // pages are moved out. The move runs with the interrupts enabled, so the
+    // block is taken in a masked section of its own afterwards
+    struct page* page = cma_take_masked(pages, order);
+    if (page == NULL) {
+        zero_pool_drain_movable();
+        page = cma_take_masked(pages, order);
+    }
+    if (page == NULL && cma_evacuate(order)) {
+        page = cma_take_masked(pages, order);
+    }
+    return page;
+}
+
+void cma_free(struct page* page, u32 pages)
+{
+    u32 index = page - cma_zone.start;
+    assert(index + pages <= CMA_PAGES);
+
+    u32 atomic = __atomic_enter();
+
+    cma_set_pinned(index, pages, 0);
+    for (u32 i = 0; i < pages; i++) {
+        buddy_free_pages(&page[i], &cma_zone);
+    }
+
+    __atomic_leave(atomic);
+}
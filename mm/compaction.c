@@ -0,0 +1,198 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/compaction.h>
+#include <citrus/mm.h>
+#include <citrus/buddy_alloc.h>
+#include <citrus/migrate.h>
+#include <citrus/sched.h>
+#include <citrus/atomic.h>
+#include <citrus/align.h>
+#include <stddef.h>
+
+static struct compact_stats compact_stats;
+
+// Tick of the last idle pass in microseconds
+static u64 compact_idle_tick;
+
+// Set while a pass runs. The migration allocates pages, which must not start
+// a new pass
+static u8 compact_busy;
+
+extern struct mm mm;
+
+u32 compact_frag_index(struct mm_zone* zone, u32 order)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    u32 free = 0;
+    u32 usable = 0;
+
+    for (u32 i = 0; i < buddy->max_orders; i++) {
+        u32 pages = buddy_get_free_blocks(zone, i) << i;
+        free += pages;
+        if (i >= order) {
+            usable += pages;
+        }
+    }
+
+    if (free == 0) {
+        return 0;
+    }
+    return (free - usable) * 100 / free;
+}
+
+// Finds the block of 2^order pages which is cheapest to empty. The free pages
+// are found through the buddy lists and the user pages through the reference
+// count. A block holding anything else, page tables included, is pinned by the
+// kernel and skipped.
+// Returns the page index of the block or -1 if no block can be emptied. The
+// interrupts are masked for one block at a time
+static i32 compact_find_block(struct mm_zone* zone, u32 order)
+{
+    struct buddy_struct* buddy = (struct buddy_struct *)zone->alloc;
+    u32 block = 1 << order;
+    i32 best = -1;
+    u32 best_used = block + 1;
+
+    u32 index = align_up(buddy->reserved, block);
+    for (; index + block <= zone->page_cnt; index += block) {
+        u32 used = 0;
+        u32 i = index;
+
+        u32 atomic = __atomic_enter();
+
+        while (i < index + block) {
+            i32 free = buddy_free_order(zone, &zone->start[i]);
+            if (free >= 0) {
+                // Free blocks are naturally aligned, so this skips to the end
+                // of the block holding the page
+                i = (i & ~((1 << free) - 1)) + (1 << free);
+                continue;
+            }
+            if (!page_is_movable(&zone->start[i])) {
+                used = block + 1;
+                break;
+            }
+            used++;
+            i++;
+        }
+        __atomic_leave(atomic);
+
+        if (used < best_used) {
+            best = index;
+            best_used = used;
+        }
+    }
+    return best;
+}
+
+// Drains the page cache of a zone. The cached pages look like kernel pages
+static void compact_drain(struct mm_zone* zone)
+{
+    u32 atomic = __atomic_enter();
+    buddy_pcp_drain_all(zone);
+    __atomic_leave(atomic);
+}
+
+// Empties one block of a zone. The interrupts are only masked for short
+// sections, and only a compaction pass may call this. Returns 1 if the zone
+// has a free block of the order afterwards
+static u8 compact_zone(struct mm_zone* zone, u32 order)
+{
+    compact_stats.runs++;
+    compact_stats.order = order;
+    compact_stats.index_before = compact_frag_index(zone, order);
+
+    compact_drain(zone);
+
+    u8 status = 0;
+    i32 index = compact_find_block(zone, order);
+    if (index >= 0) {
+        struct page* start = zone->start + index;
+        compact_stats.moved += migrate_user_pages(start, 1 << order);
+
+        // The copies are allocated through the page cache, which might have
+        // taken free pages from the block
+        u32 atomic = __atomic_enter();
+        buddy_pcp_drain_all(zone);
+        status = buddy_free_order(zone, start) >= (i32)order;
+        __atomic_leave(atomic);
+    }
+
+    if (status == 0) {
+        compact_stats.failed++;
+    }
+    compact_stats.index_after = compact_frag_index(zone, order);
+    return status;
+}
+
+u8 compact_pages(u32 order)
+{
+    if (order < COMPACT_MIN_ORDER || order > COMPACT_MAX_ORDER) {
+        return 0;
+    }
+
+    u32 atomic = __atomic_enter();
+    if (compact_busy) {
+        __atomic_leave(atomic);
+        return 0;
+    }
+    compact_busy = 1;
+    __atomic_leave(atomic);
+
+    u8 status = 0;
+    struct list_node* node;
+    list_iterate(node, &mm.buddy_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+
+        if (compact_zone(zone, order)) {
+            status = 1;
+            break;
+        }
+    }
+
+    compact_busy = 0;
+    return status;
+}
+
+// Compacts ahead of time while the system is idle, so that the high-order
+// allocations do not have to wait for it
+void compact_idle(void)
+{
+    u64 tick = get_kernel_tick();
+    if (tick - compact_idle_tick < COMPACT_IDLE_MS * 1000) {
+        return;
+    }
+    compact_idle_tick = tick;
+
+    u32 atomic = __atomic_enter();
+    if (compact_busy) {
+        __atomic_leave(atomic);
+        return;
+    }
+    compact_busy = 1;
+    __atomic_leave(atomic);
+
+    struct list_node* node;
+    list_iterate(node, &mm.buddy_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+
+        // A zone with less free memory than a few blocks can not be helped
+        u32 free = zone->get_free(zone) / 4096;
+        if (free < (4 << COMPACT_IDLE_ORDER)) {
+            continue;
+        }
+
+        if (compact_frag_index(zone, COMPACT_IDLE_ORDER) > COMPACT_IDLE_INDEX) {
+            compact_zone(zone, COMPACT_IDLE_ORDER);
+        }
+    }
+
+    compact_busy = 0;
+}
+
+void compact_get_stats(struct compact_stats* stats)
+{
+    u32 atomic = __atomic_enter();
+    *stats = compact_stats;
+    __atomic_leave(atomic);
+}
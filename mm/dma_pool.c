@@ -0,0 +1,436 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/dma_pool.h>
+#include <citrus/mm.h>
+#include <citrus/page_alloc.h>
+#include <citrus/kmalloc.h>
+#include <citrus/slab.h>
+#include <citrus/cache.h>
+#include <citrus/align.h>
+#include <citrus/atomic.h>
+#include <citrus/mem.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// A section is one 1 MiB buddy block. The kernel maps the DDR with sections,
+// so the whole block is remapped at once
+#define DMA_SECTION_ORDER 8
+#define DMA_SECTION_SIZE 0x100000
+
+// One non-cacheable section. The bookkeeping is kept in cacheable memory
+struct dma_section {
+    struct list_node node;
+    struct page* page;
+    u32 start;
+    u32 free_cnt;
+
+    // Used pages, and the page descriptor owning every used page
+    u32 map[DMA_SECTION_PAGES / 32];
+    struct dma_page* owner[DMA_SECTION_PAGES];
+};
+
+// A run of pages within a section. A run of one page can be split into
+// objects by a pool, while bigger runs are handed out by dma_alloc as is
+struct dma_page {
+    struct list_node node;
+    struct dma_pool* pool;
+    struct dma_section* section;
+    u32 va;
+    u32 pages;
+
+    // Free objects if the page belongs to a pool
+    u32 inuse;
+    u32 free_map[DMA_PAGE_MAX_OBJS / 32];
+};
+
+static struct list_node dma_sections;
+static u32 dma_free_sections;
+
+static struct kmem_cache* dma_page_cache;
+
+// Built-in pools used by dma_alloc
+static struct dma_pool dma_pools[DMA_POOL_CLASSES];
+
+static const char* dma_pool_names[DMA_POOL_CLASSES] = {
+    "dma-32",
+    "dma-64",
+    "dma-128",
+    "dma-256",
+    "dma-512",
+    "dma-1024",
+    "dma-2048"
+};
+
+// Remaps a section in the kernel page table
+static void dma_section_set_mem(u32 start, u32 mem)
+{
+    struct ste_attr attr = {
+        .access = STE_ACCESS_FULL_ACC,
+        .mem = mem,
+        .domain = 15,
+        .nG = 0,
+        .xn = 0
+    };
+    mm_change_kernel_pt_attr((u32 *)start, &attr);
+}
+
+// Borrows a section from the buddy allocator and makes it non-cacheable. The
+// caches might still hold lines from the previous owner, which must not be
+// written back over the DMA memory later
+static struct dma_section* dma_section_alloc(void)
+{
+    struct page* page = alloc_pages(DMA_SECTION_ORDER);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    u32 start = (u32)page_to_va(page);
+    assert((start & (DMA_SECTION_SIZE - 1)) == 0);
+
+    struct dma_section* section = kzmalloc(sizeof(struct dma_section));
+    if (section == NULL) {
+        free_pages(page);
+        return NULL;
+    }
+
+    dma_section_set_mem(start, STE_MEM_NON_CACHE);
+    clean_inv_range(start, start + DMA_SECTION_SIZE);
+
+    section->page = page;
+    section->start = start;
+    section->free_cnt = DMA_SECTION_PAGES;
+
+    list_add_last(&section->node, &dma_sections);
+    dma_free_sections++;
+    return section;
+}
+
+// Gives a completely free section back to the buddy allocator. Nothing has
+// been cached through the non-cacheable mapping, so the section can be mapped
+// as normal memory again right away
+static void dma_section_release(struct dma_section* section)
+{
+    dma_section_set_mem(section->start, STE_MEM_WRITE_BACK);
+
+    list_delete_node(&section->node);
+    dma_free_sections--;
+
+    free_pages(section->page);
+    kfree(section);
+}
+
+// Finds the first run of free pages in a section. Returns the page index or
+// -1 if there is no such run
+static i32 dma_section_find(struct dma_section* section, u32 pages)
+{
+    u32 run = 0;
+    for (u32 i = 0; i < DMA_SECTION_PAGES; i++) {
+        if (section->map[i / 32] & (1 << (i % 32))) {
+            run = 0;
+        } else if (++run == pages) {
+            return i + 1 - pages;
+        }
+    }
+    return -1;
+}
+
+// Allocates a run of pages from the first section which has room for it. A new
+// section is added if none has. The caller must have interrupts masked
+static struct dma_page* dma_page_alloc(u32 pages)
+{
+    struct dma_section* section = NULL;
+    i32 index = -1;
+
+    struct list_node* node;
+    list_iterate(node, &dma_sections) {
+        struct dma_section* tmp = list_get_entry(node, struct dma_section, node);
+        if (tmp->free_cnt >= pages) {
+            index = dma_section_find(tmp, pages);
+            if (index >= 0) {
+                section = tmp;
+                break;
+            }
+        }
+    }
+
+    if (section == NULL) {
+        section = dma_section_alloc();
+        if (section == NULL) {
+            return NULL;
+        }
+        index = 0;
+    }
+
+    struct dma_page* desc = kmem_cache_alloc(dma_page_cache);
+    if (desc == NULL) {
+        return NULL;
+    }
+
+    if (section->free_cnt == DMA_SECTION_PAGES) {
+        dma_free_sections--;
+    }
+    section->free_cnt -= pages;
+
+    for (u32 i = (u32)index; i < (u32)index + pages; i++) {
+        section->map[i / 32] |= (1 << (i % 32));
+        section->owner[i] = desc;
+    }
+
+    mem_set(desc, 0, sizeof(struct dma_page));
+    desc->pool = NULL;
+    desc->section = section;
+    desc->va = section->start + index * 4096;
+    desc->pages = pages;
+    return desc;
+}
+
+// Returns a run of pages to its section. The caller must have interrupts
+// masked
+static void dma_page_release(struct dma_page* desc)
+{
+    struct dma_section* section = desc->section;
+    u32 index = (desc->va - section->start) / 4096;
+
+    for (u32 i = index; i < index + desc->pages; i++) {
+        section->map[i / 32] &= ~(1 << (i % 32));
+        section->owner[i] = NULL;
+    }
+    section->free_cnt += desc->pages;
+    kmem_cache_free(dma_page_cache, desc);
+
+    if (section->free_cnt == DMA_SECTION_PAGES) {
+        if (++dma_free_sections > DMA_SECTION_MAX_FREE) {
+            dma_section_release(section);
+        }
+    }
+}
+
+// Returns the page descriptor owning a pointer, or NULL if the pointer is not
+// in a DMA section
+static struct dma_page* dma_find_page(void* ptr)
+{
+    struct list_node* node;
+    list_iterate(node, &dma_sections) {
+        struct dma_section* section = list_get_entry(node, struct dma_section,
+            node);
+
+        u32 offset = (u32)ptr - section->start;
+        if (offset < DMA_SECTION_SIZE) {
+            return section->owner[offset / 4096];
+        }
+    }
+    return NULL;
+}
+
+static void dma_pool_setup(struct dma_pool* pool, const char* name, u32 size,
+    u32 align)
+{
+    if (align < CACHE_LINE) {
+        align = CACHE_LINE;
+    }
+    assert(align <= 4096 && (align & (align - 1)) == 0);
+
+    pool->name = name;
+    pool->size = size;
+    pool->stride = align_up(size, align);
+    assert(pool->stride <= 4096);
+    pool->obj_per_page = 4096 / pool->stride;
+
+    list_init(&pool->partial);
+    list_init(&pool->full);
+    pool->used = 0;
+    pool->page_cnt = 0;
+}
+
+// Reclaim hook giving back the completely free sections
+static u32 dma_reclaim(u32 order)
+{
+    u32 atomic = __atomic_enter();
+    u32 pages = 0;
+
+    struct list_node* node = dma_sections.next;
+    while (node != &dma_sections) {
+        struct dma_section* section = list_get_entry(node, struct dma_section,
+            node);
+        node = node->next;
+
+        if (section->free_cnt == DMA_SECTION_PAGES) {
+            dma_section_release(section);
+            pages += DMA_SECTION_PAGES;
+        }
+    }
+
+    __atomic_leave(atomic);
+    return pages;
+}
+
+static struct mm_reclaim dma_reclaim_hook = {
+    .reclaim = dma_reclaim
+};
+
+// Sets up the built-in pools. The sections are added on demand
+void dma_pool_init(void)
+{
+    list_init(&dma_sections);
+    dma_free_sections = 0;
+
+    dma_page_cache = kmem_cache_create("dma_page", sizeof(struct dma_page), 0,
+        NULL);
+    assert(dma_page_cache);
+
+    for (u32 i = 0; i < DMA_POOL_CLASSES; i++) {
+        u32 size = 1 << (i + DMA_POOL_MIN_SHIFT);
+        dma_pool_setup(&dma_pools[i], dma_pool_names[i], size, size);
+    }
+
+    mm_add_reclaim(&dma_reclaim_hook);
+}
+
+struct dma_pool* dma_pool_create(const char* name, u32 size, u32 align)
+{
+    struct dma_pool* pool = kmalloc(sizeof(struct dma_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    dma_pool_setup(pool, name, size, align);
+    return pool;
+}
+
+void* dma_pool_alloc(struct dma_pool* pool)
+{
+    u32 atomic = __atomic_enter();
+
+    if (list_is_empty(&pool->partial)) {
+        struct dma_page* desc = dma_page_alloc(1);
+        if (desc == NULL) {
+            __atomic_leave(atomic);
+            return NULL;
+        }
+
+        desc->pool = pool;
+        for (u32 i = 0; i < pool->obj_per_page; i++) {
+            desc->free_map[i / 32] |= (1 << (i % 32));
+        }
+        list_add_first(&desc->node, &pool->partial);
+        pool->page_cnt++;
+    }
+
+    struct dma_page* desc = list_get_entry(list_get_first(&pool->partial),
+        struct dma_page, node);
+
+    // Take the first free object
+    u32 obj = 0;
+    for (u32 i = 0; i < DMA_PAGE_MAX_OBJS / 32; i++) {
+        if (desc->free_map[i]) {
+            u32 bit = __builtin_ctz(desc->free_map[i]);
+            desc->free_map[i] &= ~(1 << bit);
+            obj = i * 32 + bit;
+            break;
+        }
+    }
+
+    desc->inuse++;
+    pool->used++;
+
+    if (desc->inuse == pool->obj_per_page) {
+        list_delete_node(&desc->node);
+        list_add_first(&desc->node, &pool->full);
+    }
+
+    __atomic_leave(atomic);
+    return (void *)(desc->va + obj * pool->stride);
+}
+
+// Returns an object to the pool. Pages with no used objects are given back to
+// the section right away
+void dma_pool_free(struct dma_pool* pool, void* ptr)
+{
+    u32 atomic = __atomic_enter();
+
+    struct dma_page* desc = dma_find_page(ptr);
+    if (desc == NULL || desc->pool != pool) {
+        panic("Non-tracked DMA pointer freed!");
+    }
+
+    u32 offset = (u32)ptr - desc->va;
+    u32 obj = offset / pool->stride;
+    if (offset % pool->stride || desc->free_map[obj / 32] & (1 << (obj % 32))) {
+        panic("DMA object freed twice");
+    }
+
+    desc->free_map[obj / 32] |= (1 << (obj % 32));
+    pool->used--;
+
+    // A full page has now one free object
+    if (desc->inuse-- == pool->obj_per_page) {
+        list_delete_node(&desc->node);
+        list_add_first(&desc->node, &pool->partial);
+    }
+
+    if (desc->inuse == 0) {
+        list_delete_node(&desc->node);
+        pool->page_cnt--;
+        dma_page_release(desc);
+    }
+
+    __atomic_leave(atomic);
+}
+
+// Allocates coherent memory. Small sizes are served by the power-of-two pools
+// while bigger sizes get a run of whole pages
+void* dma_alloc(u32 size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size <= (1 << DMA_POOL_MAX_SHIFT)) {
+        u32 index = 0;
+        if (size > (1 << DMA_POOL_MIN_SHIFT)) {
+            index = 32 - __builtin_clz(size - 1) - DMA_POOL_MIN_SHIFT;
+        }
+        return dma_pool_alloc(&dma_pools[index]);
+    }
+
+    u32 pages = align_up(size, 4096) / 4096;
+    if (pages > DMA_SECTION_PAGES) {
+        return NULL;
+    }
+
+    u32 atomic = __atomic_enter();
+    struct dma_page* desc = dma_page_alloc(pages);
+    __atomic_leave(atomic);
+
+    return (desc) ? (void *)desc->va : NULL;
+}
+
+void* dma_zalloc(u32 size)
+{
+    void* ptr = dma_alloc(size);
+    if (ptr) {
+        mem_set(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void dma_free(void* ptr)
+{
+    u32 atomic = __atomic_enter();
+
+    struct dma_page* desc = dma_find_page(ptr);
+    if (desc == NULL) {
+        panic("Non-tracked DMA pointer freed!");
+    }
+
+    if (desc->pool) {
+        dma_pool_free(desc->pool, ptr);
+    } else {
+        if ((u32)ptr != desc->va) {
+            panic("Non-tracked DMA pointer freed!");
+        }
+        dma_page_release(desc);
+    }
+
+    __atomic_leave(atomic);
+}
@@ -0,0 +1,179 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/migrate.h>
+#include <citrus/mm.h>
+#include <citrus/page_alloc.h>
+#include <citrus/zram.h>
+#include <citrus/sched.h>
+#include <citrus/thread.h>
+#include <citrus/cache.h>
+#include <citrus/mem.h>
+#include <citrus/atomic.h>
+#include <stddef.h>
+
+extern struct rq rq;
+
+// Number of the last migration. A memory space is walked once per migration,
+// even if it is shared by many threads
+static u32 migrate_seq;
+
+// Allocates a page for a copy. Free pages inside the run are handed out by the
+// page allocator as well; these are held on a list and freed afterwards, so
+// that the run is not filled up again. Returns NULL if out of memory
+static struct page* migrate_alloc(struct page* start, u32 cnt,
+    struct list_node* held)
+{
+    while (1) {
+        struct page* page = alloc_page();
+        if (page == NULL || page < start || page >= start + cnt) {
+            return page;
+        }
+        list_add_last(&page->node, held);
+    }
+}
+
+// Points every user page table entry mapping a page in the run to the new copy
+// of the page. The references are moved along with the entries. If `self` is
+// set, the stack region is left alone. The interrupts are masked for one level
+// 2 table at a time
+static void migrate_mmap(struct mmap* mm, struct page* start, u32 cnt,
+    struct page** moves, u8 self)
+{
+    u32* ttbr_virt = pa_to_va(mm->ttbr_phys);
+
+    // The user space is the lower 2 GiB with TTBCR.N = 1
+    for (u32 i = 0; i < 2048; i++) {
+        u32 ste = ttbr_virt[i];
+        if ((ste & 0b11) != STE_PTR_MASK) {
+            continue;
+        }
+
+        u32 atomic = __atomic_enter();
+        u32* pt2_virt = pa_to_va((void *)STE_PTR_BASE(ste));
+        for (u32 j = 0; j < 256; j++) {
+            u32 pte = pt2_virt[j];
+
+            // Pages aged by zram are still owned by the entry
+            if ((pte & PTE_MASK) == 0 && !zram_pte_is_old(pte)) {
+                continue;
+            }
+
+            struct page* page = pa_to_page((void *)(pte & ~0xFFF));
+            if (page < start || page >= start + cnt) {
+                continue;
+            }
+
+            u32 virt_addr = (i << 20) | (j << 12);
+            if (self && virt_addr >= (u32)mm->stack_e &&
+                virt_addr < (u32)mm->stack_s) {
+                continue;
+            }
+
+            // Pages without a copy are left alone. The run will not be free
+            // afterwards
+            struct page* copy = moves[page - start];
+            if (copy == NULL) {
+                continue;
+            }
+
+            pt2_virt[j] = (pte & 0xFFF) | (u32)page_to_pa(copy);
+            clean_range((u32)&pt2_virt[j], (u32)&pt2_virt[j] + 4);
+
+            copy->ref++;
+            page->ref--;
+        }
+        __atomic_leave(atomic);
+    }
+}
+
+// Every copy is allocated up front, so that a failure leaves the user pages
+// untouched. The scheduler is disabled for the whole move, so no thread can
+// map, unmap or write a user page meanwhile. The interrupts are only masked
+// by the page allocator and while a page table is rewritten
+u32 migrate_user_pages(struct page* start, u32 cnt)
+{
+    // Table holding the new copy of every user page in the run
+    struct page* table = alloc_pages(bytes_to_order(cnt * sizeof(struct page *)));
+    if (table == NULL) {
+        return 0;
+    }
+    struct page** moves = page_to_va(table);
+
+    struct list_node held;
+    list_init(&held);
+
+    u32 sched = sched_disable();
+
+    u8 status = 1;
+    for (u32 i = 0; i < cnt; i++) {
+        moves[i] = NULL;
+        if (status == 0 || !page_is_movable(&start[i])) {
+            continue;
+        }
+
+        moves[i] = migrate_alloc(start, cnt, &held);
+        if (moves[i] == NULL) {
+            status = 0;
+            continue;
+        }
+        mem_copy(page_to_va(&start[i]), page_to_va(moves[i]), 4096);
+
+        // A user page can hold code. The copy must reach the point of
+        // unification, and no stale instruction cache line may be left for
+        // the new address, before any entry points to it
+        u32 copy_start = (u32)page_to_va(moves[i]);
+        icache_sync_range(copy_start, copy_start + 4096);
+    }
+
+    if (status) {
+        migrate_seq++;
+
+        // A syscall runs on the user stack of the caller, and this function
+        // keeps writing to its frame after the copy. Those writes would be
+        // lost, so the stack of the calling memory space stays in place
+        struct thread* curr = get_curr_thread();
+        struct mmap* self = (curr) ? curr->mmap : NULL;
+
+        struct list_node* node;
+        list_iterate(node, &rq.thread_list) {
+            struct thread* thread = list_get_entry(node, struct thread,
+                thread_node);
+
+            // Threads in a process share the memory map
+            struct mmap* mm = thread->mmap;
+            if (mm == NULL || mm->migrate_seq == migrate_seq) {
+                continue;
+            }
+            mm->migrate_seq = migrate_seq;
+            migrate_mmap(mm, start, cnt, moves, mm == self);
+        }
+        mm_tlb_invalidate();
+    }
+
+    // The copies nobody was pointed to are given back. An old page is freed
+    // when all of its references are moved
+    u32 freed = 0;
+    for (u32 i = 0; i < cnt; i++) {
+        if (moves[i] == NULL) {
+            continue;
+        }
+        if (moves[i]->ref == 0) {
+            free_pages(moves[i]);
+        } else if (start[i].ref == 0) {
+            free_pages(&start[i]);
+            freed++;
+        }
+    }
+
+    while (!list_is_empty(&held)) {
+        struct page* page = list_get_entry(list_get_first(&held), struct page,
+            node);
+        list_delete_node(&page->node);
+        free_pages(page);
+    }
+
+    sched_enable(sched);
+
+    free_pages(table);
+    return freed;
+}
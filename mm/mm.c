@@ -4,6 +4,7 @@
 #include <citrus/align.h>
 #include <citrus/kmalloc.h>
 #include <citrus/slob.h>
+#include <citrus/slab.h>
 #include <citrus/buddy_alloc.h>
 #include <citrus/mem.h>
 #include <citrus/boot_alloc.h>
@@ -12,22 +13,35 @@
 #include <citrus/thread.h>
 #include <citrus/cache.h>
 #include <citrus/panic.h>
-#include <citrus/lcd.h>
-#include <citrus/cache_alloc.h>
+#include <citrus/cma.h>
+#include <citrus/vmalloc.h>
+#include <citrus/zram.h>
+#include <citrus/compaction.h>
+#include <citrus/dma_pool.h>
+#include <citrus/page_alloc.h>
+#include <citrus/atomic.h>
+#include <citrus/mm_trace.h>
 
 // Hold the virtual end address of the kernel memory. Defined in the linker
 extern u32 _kernel_e;
 
-#define MM_ZONE_CNT 2
+// The SLOB allocator borrows blocks of at least this order from the buddy
+// allocator
+#define MM_SLOB_ZONE_ORDER 4
 
-// Allocate the memory zones
-struct mm_zone zones[MM_ZONE_CNT];
+// A SLOB zone is a block borrowed from the buddy allocator. The zone and the
+// allocator structure are allocated from the slab caches
+struct mm_slob_zone {
+    struct mm_zone zone;
+    struct slob_struct slob;
+};
 
 // Allocate the main memory manager object
 struct mm mm;
 
-// Allocate one kernel SLOB allocator
-struct slob_struct slob_allocator;
+// The buddy allocator covers the DDR below the contiguous memory area. All
+// other zones are borrowed from this one
+struct mm_zone buddy_zone;
 struct buddy_struct buddy_allocator;
 
 // Holds the pointer to the base address of the page array
@@ -50,6 +64,9 @@ static void mm_setup_page_array(void)
     // Initialize the page structures
     for (u32 i = 0; i < DDR_PAGES; i++) {
         list_node_init(&page_array[i].node);
+        page_array[i].order = 0;
+        page_array[i].slab = NULL;
+        page_array[i].ref = 0;
     }
 
     // Delete the memory
@@ -57,8 +74,40 @@ static void mm_setup_page_array(void)
     u32* ptr = align_up_ptr((void *)addr, 4);
 }
 
-// Starts up the custom allocators; binary buddy alloc for pages and the SLOB
-// list allocator for the kernel allocations
+// Adds a zone to the global zone list as well as the allocator zone list
+static void mm_add_zone(struct mm_zone* zone, struct list_node* alloc_list)
+{
+    list_add_last(&zone->zone_node, &mm.zones);
+    list_add_last(&zone->alloc_node, alloc_list);
+}
+
+// Removes a zone from the zone lists
+static void mm_delete_zone(struct mm_zone* zone)
+{
+    list_delete_node(&zone->zone_node);
+    list_delete_node(&zone->alloc_node);
+}
+
+// Returns the zone in the allocator zone list which contains the page. Returns
+// NULL if no zone contains the page
+static struct mm_zone* mm_find_zone(struct list_node* alloc_list,
+    struct page* page)
+{
+    struct list_node* node;
+    list_iterate(node, alloc_list) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+
+        if (page >= zone->start && page < zone->start + zone->page_cnt) {
+            return zone;
+        }
+    }
+    return NULL;
+}
+
+// Starts up the custom allocators. The binary buddy allocator gets all the
+// pages not used by the kernel, except for the contiguous memory area at the
+// top of the DDR which only takes movable pages. The slab caches and the SLOB allocator borrow
+// their memory from the buddy allocator on demand
 void mm_allocators_init(void)
 {
     // Find the first page_structure which is available for allocation
@@ -71,56 +120,67 @@ void mm_allocators_init(void)
     }
     u32 kernel_pages = kernel_used / 4096;
 
-    // Find how much memory should be partitioned into the buddy allocator
-    u32 buddy_pages = DDR_PAGES / 3;
-    buddy_pages = round_up_power_two(buddy_pages);
-
-    // SLOB allocator size
-    u32 slob_pages = DDR_PAGES - kernel_pages - buddy_pages;
+    // The buddy zone starts at the beginning of DDR so that every block is
+    // naturally aligned in physical memory. The kernel pages are reserved
+    buddy_zone.alloc = &buddy_allocator;
+    buddy_zone.start = page_array;
+    buddy_zone.page_cnt = DDR_PAGES - CMA_PAGES;
+    assert(buddy_alloc_init(&buddy_zone, kernel_pages));
+    mm_add_zone(&buddy_zone, &mm.buddy_zones);
 
-    // Make the kmalloc zone
-    zones[0].alloc = &slob_allocator;
-    zones[0].start = page_array + kernel_pages;
-    zones[0].page_cnt = slob_pages;
-    assert(slob_init(zones));
+    mm_add_zone(cma_init(page_array + DDR_PAGES - CMA_PAGES),
+        &mm.movable_zones);
 
-    // Make the buddy allocator
-    buddy_allocator.max_orders = 15;  // Fix this
-    zones[1].alloc = &buddy_allocator;
-    zones[1].start = page_array + kernel_pages + slob_pages;
-    zones[1].page_cnt = buddy_pages;
-    assert(buddy_alloc_init(zones + 1));
+    // The slab caches takes their pages from the buddy allocator
+    kmem_cache_init();
 }
 
-// Iterates trough all the zones and returns the number of used bytes by the
-// allocators
+// Returns the total number of bytes used. The SLOB zones are part of the used
+// memory in the buddy allocator, so the free space in the SLOB zones is
+// subtracted
 u32 mm_get_total_used(void)
 {
     u32 used = 0;
-    for (u32 i = 0; i < MM_ZONE_CNT; i++) {
-        struct mm_zone* zone = &zones[i];
+    u32 slob_free = 0;
 
-        if (zone->get_used) {
-            used += zone->get_used(zone);
-        }
+    u32 atomic = __atomic_enter();
+
+    struct list_node* node;
+    list_iterate(node, &mm.buddy_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+        used += zone->get_used(zone);
+    }
+
+    list_iterate(node, &mm.movable_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+        used += zone->get_used(zone);
     }
 
-    return used;
+    list_iterate(node, &mm.slob_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+        slob_free += zone->get_free(zone);
+    }
+
+    __atomic_leave(atomic);
+    return used - slob_free;
 }
 
-// Iterates trough all the zones and returns the number of total bytes
-// available for allocation
+// Returns the number of total bytes available for allocation. Only the buddy
+// and the movable zones own memory
 u32 mm_get_total(void)
 {
     u32 total = 0;
-    for (u32 i = 0; i < MM_ZONE_CNT; i++) {
-        struct mm_zone* zone = &zones[i];
 
-        if (zone->get_total) {
-            total += zone->get_total(zone);
-        }
+    struct list_node* node;
+    list_iterate(node, &mm.buddy_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+        total += zone->get_total(zone);
     }
 
+    list_iterate(node, &mm.movable_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+        total += zone->get_total(zone);
+    }
     return total;
 }
 
@@ -129,6 +189,28 @@ static void mm_struct_init(struct mm* mm)
     list_init(&mm->zones);
     list_init(&mm->buddy_zones);
     list_init(&mm->slob_zones);
+    list_init(&mm->movable_zones);
+    list_init(&mm->reclaim_list);
+}
+
+// Adds a hook which is called when the page allocator runs out of memory
+void mm_add_reclaim(struct mm_reclaim* reclaim)
+{
+    list_add_last(&reclaim->node, &mm.reclaim_list);
+}
+
+// Runs all the reclaim hooks. Returns the number of pages given back to the
+// page allocator
+static u32 mm_reclaim(u32 order)
+{
+    u32 pages = 0;
+
+    struct list_node* node;
+    list_iterate(node, &mm.reclaim_list) {
+        struct mm_reclaim* r = list_get_entry(node, struct mm_reclaim, node);
+        pages += r->reclaim(order);
+    }
+    return pages;
 }
 
 // Early memory manager init routine
@@ -147,59 +229,256 @@ void mm_init(void)
     // Make sure the memory is setup correctly
     mm_early_init();
 
-    // Call the display subsystem to allocate buffers for the display. This is
-    // done here because it needs to be non-cacheable and allocate several MB
-    lcd_layers_alloc();
-
-    // Add a temporarily cache allocator here
-    cache_alloc_init();
-
     // Retire the boot allocator before the main allocators are enabled
     boot_alloc_retire();
     mm_allocators_init();
+
+    pt_cache_init();
+    zero_pool_init();
+    dma_pool_init();
+    vmalloc_init();
+    zram_init();
+}
+
+// Borrows a block from the buddy allocator and sets it up as a new SLOB zone.
+// The block is big enough to hold an allocation of `size` bytes. The caller
+// must have interrupts masked
+static struct mm_zone* mm_slob_zone_alloc(u32 size)
+{
+    // Make room for the SLOB block header, the end node and the alignment
+    u32 order = bytes_to_order(size + 3 * sizeof(struct slob_node));
+    if (order < MM_SLOB_ZONE_ORDER) {
+        order = MM_SLOB_ZONE_ORDER;
+    }
+
+    struct mm_slob_zone* slob_zone = kmalloc(sizeof(struct mm_slob_zone));
+    if (slob_zone == NULL) {
+        return NULL;
+    }
+
+    struct page* page = alloc_pages(order);
+    if (page == NULL) {
+        kfree(slob_zone);
+        return NULL;
+    }
+
+    struct mm_zone* zone = &slob_zone->zone;
+    zone->alloc = &slob_zone->slob;
+    zone->start = page;
+    zone->page_cnt = 1 << order;
+    zone->get_cache_hits = NULL;
+    zone->get_cache_misses = NULL;
+
+    if (!slob_init(zone)) {
+        free_pages(page);
+        kfree(slob_zone);
+        return NULL;
+    }
+
+    mm_add_zone(zone, &mm.slob_zones);
+    return zone;
+}
+
+// Returns a drained SLOB zone to the buddy allocator. The caller must have
+// interrupts masked
+static void mm_slob_zone_free(struct mm_zone* zone)
+{
+    mm_delete_zone(zone);
+    free_pages(zone->start);
+    kfree(list_get_entry(zone, struct mm_slob_zone, zone));
+}
+
+// Allocates from the first SLOB zone which can hold the request. A new zone is
+// borrowed from the buddy allocator if all the zones are full
+static void* mm_slob_alloc(u32 size)
+{
+    u32 atomic = __atomic_enter();
+
+    struct list_node* node;
+    list_iterate(node, &mm.slob_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+
+        void* ptr = slob_alloc(size, zone);
+        if (ptr) {
+            __atomic_leave(atomic);
+            return ptr;
+        }
+    }
+
+    void* ptr = NULL;
+    struct mm_zone* zone = mm_slob_zone_alloc(size);
+    if (zone) {
+        ptr = slob_alloc(size, zone);
+    }
+
+    __atomic_leave(atomic);
+    return ptr;
+}
+
+// Frees a SLOB allocation. The zone is given back to the buddy allocator when
+// it drains. The first zone is always kept to avoid bouncing a block back and
+// forth when the kernel allocates and frees one big buffer
+static void mm_slob_free(void* ptr)
+{
+    u32 atomic = __atomic_enter();
+
+    struct page* page = va_to_page(align_down_ptr(ptr, 4096));
+    struct mm_zone* zone = mm_find_zone(&mm.slob_zones, page);
+    if (zone == NULL) {
+        panic("Non-tracked pointer freed!");
+    }
+
+    slob_free(ptr, zone);
+
+    if (zone->get_used(zone) == 0 &&
+        &zone->alloc_node != list_get_first(&mm.slob_zones)) {
+        mm_slob_zone_free(zone);
+    }
+
+    __atomic_leave(atomic);
+}
+
+// Allocates from the slab caches or the SLOB allocator. The site is the
+// address of the caller of the kmalloc function, used by the allocation trace
+static void* __kmalloc(u32 size, u32 site)
+{
+    void* ptr;
+
+    struct kmem_cache* cache = kmalloc_get_cache(size);
+    if (cache) {
+        ptr = kmem_cache_alloc(cache);
+    } else {
+        ptr = mm_slob_alloc(size);
+    }
+
+    mm_trace_alloc(MM_TRACE_KMALLOC, site, ptr, size);
+    return ptr;
 }
 
 // Allocates a number of bytes for use by the kernel. This will return a 
-// kernel virtual address
+// kernel virtual address. Small allocations are served by the power-of-two
+// slab caches, while bigger allocations goes to the SLOB allocator
 void* kmalloc(u32 size)
 {
-    return slob_alloc(size, zones);
+    return __kmalloc(size, (u32)__builtin_return_address(0));
 }
 
 // Allocates a number of bytes for use by the kernel. This will return a 
 // kernel virtual address pointer to zeroed memory
 void* kzmalloc(u32 size) 
 {
-    u32* ptr = slob_alloc(size, zones);
-    mem_set(ptr, 0, size);
+    u32* ptr = __kmalloc(size, (u32)__builtin_return_address(0));
+    if (ptr) {
+        mem_set(ptr, 0, size);
+    }
     return ptr;
 }
 
-// Free a pointer allocated with the SLOB allocator
+// Free a pointer allocated with kmalloc
 void kfree(void* ptr)
 {
-    slob_free(ptr, zones);
+    mm_trace_free(MM_TRACE_KFREE, (u32)__builtin_return_address(0), ptr);
+
+    struct kmem_slab* slab = kmem_get_slab(ptr);
+    if (slab) {
+        kmem_cache_free(slab->cache, ptr);
+    } else {
+        mm_slob_free(ptr);
+    }
+}
+
+// Allocates a block from the first buddy zone which can hold it
+static struct page* mm_buddy_alloc(u32 order)
+{
+    struct list_node* node;
+    list_iterate(node, &mm.buddy_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+
+        struct page* page = buddy_alloc_pages(order, zone);
+        if (page) {
+            return page;
+        }
+    }
+    return NULL;
+}
+
+// Allocates from the buddy zones and runs the reclaim hooks if they are out of
+// memory. A high-order request may still fail on fragmentation, in which case
+// the zones are compacted. The site is the caller address used by the
+// allocation trace
+static struct page* __alloc_pages(u32 order, u32 site)
+{
+    struct page* page = mm_buddy_alloc(order);
+
+    if (page == NULL && mm_reclaim(order)) {
+        page = mm_buddy_alloc(order);
+    }
+    if (page == NULL && compact_pages(order)) {
+        page = mm_buddy_alloc(order);
+    }
+
+    mm_trace_alloc(MM_TRACE_ALLOC_PAGES, site, (page) ? page_to_va(page) : NULL,
+        4096 << order);
+    return page;
 }
 
 // Allocates a number of pages from the binary buddy using the given order.
 // This will allocate 2 ** order number of pages. Returns a pointer to a
-// virtual page structure
+// virtual page structure. If the buddy allocator is out of memory the reclaim
+// hooks are run before trying again. Returns NULL if this also fails
 struct page* alloc_pages(u32 order)
 {
-    return buddy_alloc_pages(order, zones + 1);
+    return __alloc_pages(order, (u32)__builtin_return_address(0));
 }
 
 // Allocates one page from the binary buddy. Returns a pointer to a virtual 
 // page structure
 struct page* alloc_page(void)
 {
-    return buddy_alloc_pages(0, zones + 1);
+    return __alloc_pages(0, (u32)__builtin_return_address(0));
 }
 
 // Frees one or more pages. The size is contains within internal structures
 void free_pages(struct page* page)
 {
-    buddy_free_pages(page, zones + 1);
+    struct mm_zone* zone = mm_find_zone(&mm.buddy_zones, page);
+    if (zone == NULL) {
+        zone = mm_find_zone(&mm.movable_zones, page);
+    }
+    if (zone == NULL) {
+        panic("Non-tracked page freed!");
+    }
+
+    mm_trace_free(MM_TRACE_FREE_PAGES, (u32)__builtin_return_address(0),
+        page_to_va(page));
+    buddy_free_pages(page, zone);
+}
+
+// Takes a reference to a user page
+void get_page(struct page* page)
+{
+    page->ref++;
+}
+
+// Drops a reference to a user page. The page is freed when the last memory
+// space unmaps it
+void put_page(struct page* page)
+{
+    if (page->ref == 0) {
+        panic("Page reference underflow");
+    }
+    if (--page->ref == 0) {
+        free_pages(page);
+    }
+}
+
+// Splits a block allocated with alloc_pages into single pages. The buddy
+// allocator merges the pages back when all of them are freed
+void split_pages(struct page* page, u32 order)
+{
+    for (u32 i = 0; i < (1 << order); i++) {
+        page[i].order = 0;
+    }
 }
 
 // Converts a number of bytes to an allocation order for the binary buddy
@@ -218,25 +497,6 @@ u32 pages_to_order(u32 pages)
     return __builtin_ctz(round_up_power_two(pages));
 }
 
-// Allocates a level 1 page table. Due the the kernel 2GB:2GB split this page
-// table is 2048 bytes and not 4096. Thus it will only cover 2BG of address
-// space. This returns a virtual page struct address
-struct page* lv1_pt_alloc(void)
-{
-    struct page* page = buddy_alloc_pages(1, zones + 1);
-    mem_set(page_to_va(page), 0, 4096 * 2);
-    return page;
-}
-
-// Allocates a level 2 page table. This is 4096 bytes in size. This returns a
-// virtual page struct address
-struct page* lv2_pt_alloc(void)
-{
-    struct page* page = buddy_alloc_pages(0, zones + 1);
-    mem_set(page_to_va(page), 0, 4096);
-    return page;
-}
-
 // Converts a page address to a kernel virtual address
 void* page_to_va(struct page* page)
 {
@@ -276,22 +536,10 @@ struct page* pa_to_page(void* page_addr)
     return page_array + page_index;
 }
 
-// Initializes the page used for secondary level page tables. One page contains
-// three level 2 page tables. A pt2 structure is place in the first 1 KiB of
-// the page. This will contain info about the status of the page tables
-void lv2_pt_init(struct page* page)
-{
-    struct pt2* pt = (struct pt2 *)page_to_va(page);
-    pt->bitmap = 0xFFFFFFFF;
-}
-
 // Initializes a thread_mm structure. This is allocated per process basis and
 // contains info about the process memory map
 void mm_process_init(struct mmap* mm)
 {
-    list_init(&mm->page_list);
-    mm->pt2_ptr = NULL;
-
     mm->data_e = 0;
     mm->data_s = 0;
 
@@ -302,6 +550,13 @@ void mm_process_init(struct mmap* mm)
     // The heap pointers are initialized to zero
     mm->heap_s = 0;
     mm->heap_e = 0;
+
+    mm->fault_cnt = 0;
+    mm->zram_seq = 0;
+    mm->migrate_seq = 0;
+
+    // The ASID is assigned the first time the memory map is scheduled
+    mm->context_id = 0;
 }
 
 // Returns the PTE entry value based on the physical address of the page and
@@ -371,6 +626,8 @@ static void mm_map_in_pt(u32* ttbr_virt, u32 phys_addr, u32 virt_addr, u8 domain
 
     // Map in the page table
     ttbr_virt[virt_addr >> 20] = ste;
+    clean_range((u32)&ttbr_virt[virt_addr >> 20],
+        (u32)&ttbr_virt[virt_addr >> 20] + 4);
 }
 
 // Maps in a page into the memory space pointed to by ttbr. The phys_addr holds
@@ -391,7 +648,9 @@ static void mm_map_in_page_unsafe(u32* ttbr_virt, u32 phys_addr, u32 virt_addr,
     // Get virtual address of the secondary level page table
     u32* pt2_virt = pa_to_va(pt2_phys);
 
-    pt2_virt[(virt_addr >> 12) & 0xFF] = mm_get_pte(phys_addr, attr);
+    u32* pte = &pt2_virt[(virt_addr >> 12) & 0xFF];
+    *pte = mm_get_pte(phys_addr, attr);
+    clean_range((u32)pte, (u32)pte + 4);
 }
 
 // Returns if the STE entry is empty (fault)
@@ -409,46 +668,10 @@ static inline u8 mm_has_ste_ptr_mapping(u32* ttbr_virt, u32 virt_addr)
     return (mm_is_ste_empty(ste)) ? 0 : 1;
 }
 
-// Returns a new level 2 page table. This might require a page allocation 
-// which will store the new page within the mm->pt2_ptr. This returns the 
-// virtual address of the new level 2 page table
-static u32* mm_get_l2_pt(struct mmap* mm)
-{
-    assert(mm);
-
-    if (mm->pt2_ptr) {
-        // Check if it can hold another one
-        struct pt2* pt = page_to_va(mm->pt2_ptr);
-
-        for (u32 i = 0; i < 3; i++) {
-            if (pt->bitmap & (1 << i)) {   
-                pt->bitmap |= (1 << i);
-
-                // If a bit is free return the address
-                return (u32 *)((u8 *)pt + 1024 * (i + 1));
-            }
-        }
-    }
-
-    // The mm->pt2_ptr is either NULL or full. Allocate a new page
-    struct page* pt2 = lv2_pt_alloc();
-
-    if (pt2 == NULL) {
-        return NULL;
-    }
-
-    // Add the page to the page list
-    mm->pt2_ptr = pt2;
-    mm_process_add_page(pt2, mm);
-
-    return (u32 *)((u8 *)page_to_va(pt2) + 1024);
-}
-
-// Maps in a number of pages into the virtual address space specified by ttbr.
-// This takes in the virtual address that the pages should be mapped to. It 
-// returns 1 if success and 0 if an alocation failure has occured
-u8 mm_map_in_pages(struct mmap* mm, struct page* page, u32 page_cnt, 
-    u32 virt_addr, struct pte_attr* attr)
+// Maps in a number of pages without doing any cache maintenance. Returns 1 if
+// success and 0 if an allocation failure has occured
+static u8 mm_map_in_pages_core(struct mmap* mm, struct page* page,
+    u32 page_cnt, u32 virt_addr, struct pte_attr* attr)
 {
     // The virtual address must be aligned at a 4 KiB boundary
     assert((virt_addr & 0xFFF) == 0);
@@ -460,7 +683,7 @@ u8 mm_map_in_pages(struct mmap* mm, struct page* page, u32 page_cnt,
         if (mm_has_ste_ptr_mapping(ttbr_virt, virt_addr) == 0) {
 
             // Map in a new level 2 page table
-            u32* pt2_virt = mm_get_l2_pt(mm);
+            u32* pt2_virt = lv2_pt_alloc();
 
             // Allocation failed
             if (pt2_virt == NULL) {
@@ -478,26 +701,326 @@ u8 mm_map_in_pages(struct mmap* mm, struct page* page, u32 page_cnt,
         page++;
         virt_addr += 4096;
     }
+    return 1;
+}
+
+// Maps in a number of pages into the virtual address space specified by ttbr.
+// This takes in the virtual address that the pages should be mapped to. It 
+// returns 1 if success and 0 if an alocation failure has occured
+u8 mm_map_in_pages(struct mmap* mm, struct page* page, u32 page_cnt, 
+    u32 virt_addr, struct pte_attr* attr)
+{
+    if (mm_map_in_pages_core(mm, page, page_cnt, virt_addr, attr) == 0) {
+        return 0;
+    }
+
+    // Every table entry written is cleaned to memory. Wait for the cleaning to
+    // complete before the mapping is used
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+
+    return 1;
+}
+
+// Returns 1 if the user address is inside the reserved heap or stack region
+static inline u8 mm_is_anon_addr(struct mmap* mm, u32 addr)
+{
+    if (addr >= (u32)mm->heap_s && addr < (u32)mm->heap_e) {
+        return 1;
+    }
+    if (addr >= (u32)mm->stack_e && addr < (u32)mm->stack_s) {
+        return 1;
+    }
+    return 0;
+}
+
+// Handles a translation fault on a user address. The heap and the stack are
+// only reserved in the memory map, and a zeroed page is mapped in the first
+// time a page is touched. Returns 1 if the fault was handled and the access
+// can be restarted, and 0 if this is a real fault
+u8 mm_handle_fault(struct mmap* mm, u32 addr)
+{
+    if (mm == NULL || addr >= KERNEL_START || !mm_is_anon_addr(mm, addr)) {
+        return 0;
+    }
+
+    // The page might have been aged or compressed by zram
+    u32* pte = mm_get_pte_ptr(mm, addr);
+    if (pte && (zram_pte_is_old(*pte) || zram_pte_is_swap(*pte))) {
+        return zram_fault(mm, addr, pte);
+    }
+
+    struct page* page = alloc_zeroed_movable_page();
+    if (page == NULL) {
+        return 0;
+    }
+
+    struct pte_attr attr = {
+        .access = PTE_ACCESS_FULL_ACC,
+        .mem    = PTE_MEM_WRITE_ALLOC,
+        .domain = 15,
+        .nG     = 1,
+        .xn     = 0
+    };
+
+    u32 virt_addr = addr & ~0xFFF;
+    if (mm_map_in_pages_core(mm, page, 1, virt_addr, &attr) == 0) {
+        free_pages(page);
+        return 0;
+    }
+    page->ref = 1;
+    curr_thread_add_pages(1);
+    mm->fault_cnt++;
+
+    // The table entries are cleaned by the mapping code. The translation was
+    // invalid before, so no TLB maintenance is needed
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+
+    return 1;
+}
+
+// Returns the level 2 page table entry for a user address. Returns NULL if no
+// level 2 page table covers the address
+u32* mm_get_pte_ptr(struct mmap* mm, u32 virt_addr)
+{
+    u32* ttbr_virt = pa_to_va(mm->ttbr_phys);
+    u32 ste = ttbr_virt[virt_addr >> 20];
+
+    if ((ste & 0b11) != STE_PTR_MASK) {
+        return NULL;
+    }
+
+    u32* pt2_virt = pa_to_va((void *)STE_PTR_BASE(ste));
+    return &pt2_virt[(virt_addr >> 12) & 0xFF];
+}
+
+// Writes a page table entry back to memory so the table walk can see it
+static inline void mm_sync_pte(u32* pte)
+{
+    clean_range((u32)pte, (u32)pte + 4);
+}
+
+// Returns the page mapped by a valid page table entry
+static inline struct page* mm_pte_to_page(u32 pte)
+{
+    return pa_to_page((void *)(pte & ~0xFFF));
+}
+
+// Handles a write permission fault on a user address. After a clone all user
+// pages are mapped read-only, so every read-only user page is treated as a
+// copy-on-write page. A shared page is copied, while the last user of a page
+// simply gets the write permission back. Returns 1 if the fault was handled
+u8 mm_handle_cow_fault(struct mmap* mm, u32 addr)
+{
+    if (mm == NULL || addr >= KERNEL_START) {
+        return 0;
+    }
+
+    u32 atomic = __atomic_enter();
+
+    u32* pte = mm_get_pte_ptr(mm, addr);
+    if (pte == NULL || (*pte & PTE_MASK) == 0 ||
+        (*pte & PTE_ACCESS_MSK) != PTE_ACCESS_READ) {
+        
+        __atomic_leave(atomic);
+        return 0;
+    }
+
+    struct page* page = mm_pte_to_page(*pte);
+
+    if (page->ref > 1) {
+        struct page* copy = alloc_movable_page();
+        if (copy == NULL) {
+            __atomic_leave(atomic);
+            return 0;
+        }
+        mem_copy(page_to_va(page), page_to_va(copy), 4096);
+
+        // The copy can hold code, so it must reach the point of unification
+        // and the stale instruction cache lines must go before it is mapped
+        u32 copy_start = (u32)page_to_va(copy);
+        icache_sync_range(copy_start, copy_start + 4096);
+
+        copy->ref = 1;
+        page->ref--;
+        page = copy;
+
+        curr_thread_add_pages(1);
+    }
+
+    // Map the private page with write permission. The old entry might be in
+    // the TLB so it has to be invalidated
+    u32 entry = *pte & ~(PTE_ACCESS_MSK | 0xFFFFF000);
+    *pte = entry | PTE_ACCESS_FULL_ACC | (u32)page_to_pa(page);
+
+    mm_sync_pte(pte);
+    mm_tlb_invalidate_va(addr, mm->context_id);
+    mm->fault_cnt++;
+
+    __atomic_leave(atomic);
+    return 1;
+}
+
+// Makes `dst` a copy-on-write copy of the `src` memory space. The user pages
+// are shared and mapped read-only in both memory spaces, so that the first
+// write fault gives the writer its own copy. The destination must be newly
+// initialized. Returns 0 if a page table allocation fails; the destination is
+// still consistent and can be freed normally
+u8 mm_clone(struct mmap* dst, struct mmap* src)
+{
+    u32 atomic = __atomic_enter();
+
+    dst->data_s = src->data_s;
+    dst->data_e = src->data_e;
+    dst->heap_s = src->heap_s;
+    dst->heap_e = src->heap_e;
+    dst->stack_s = src->stack_s;
+    dst->stack_e = src->stack_e;
+    dst->page_cnt = src->page_cnt;
+
+    u32* src_lv1 = pa_to_va(src->ttbr_phys);
+    u32* dst_lv1 = pa_to_va(dst->ttbr_phys);
+
+    // The user space covers the first 2048 entries in the level 1 table
+    for (u32 i = 0; i < 2048; i++) {
+        u32 ste = src_lv1[i];
+        if ((ste & 0b11) != STE_PTR_MASK) {
+            continue;
+        }
+
+        u32* dst_pt2 = lv2_pt_alloc();
+        if (dst_pt2 == NULL) {
+            __atomic_leave(atomic);
+            return 0;
+        }
+        u32* src_pt2 = pa_to_va((void *)STE_PTR_BASE(ste));
+
+        for (u32 j = 0; j < 256; j++) {
+            u32 pte = src_pt2[j];
+
+            // Compressed pages share the slot. Aged pages are mapped in again
+            // and shared like any other page
+            if (zram_pte_is_swap(pte)) {
+                dst_pt2[j] = pte;
+                zram_pte_get(pte);
+                continue;
+            }
+            if (zram_pte_is_old(pte)) {
+                pte = zram_pte_restore(pte);
+                src_pt2[j] = pte;
+                mm_sync_pte(&src_pt2[j]);
+            }
+            if ((pte & PTE_MASK) == 0) {
+                continue;
+            }
 
-    dcache_clean();
-    icache_invalidate();
+            // Remove the write permission in the source memory space
+            if ((pte & PTE_ACCESS_MSK) != PTE_ACCESS_READ) {
+                pte = (pte & ~PTE_ACCESS_MSK) | PTE_ACCESS_READ;
+                src_pt2[j] = pte;
+
+                mm_sync_pte(&src_pt2[j]);
+                mm_tlb_invalidate_va((i << 20) | (j << 12), src->context_id);
+            }
+
+            dst_pt2[j] = pte;
+            get_page(mm_pte_to_page(pte));
+        }
+
+        // The new page table must be in memory before it is linked in
+        clean_range((u32)dst_pt2, (u32)dst_pt2 + 1024);
+        mm_map_in_pt(dst_lv1, (u32)va_to_pa(dst_pt2), i << 20,
+            (ste >> 5) & 0xF);
+    }
+    asm volatile ("dsb" : : : "memory");
 
+    __atomic_leave(atomic);
     return 1;
 }
 
-// Extends the heap limit in a user process memory space. This will move the 
-// heap break up.
-u32* set_break(u32 bytes)
+// Drops the reference to every page mapped in the user memory space and gives
+// the level 2 page tables back to the page table cache. The level 1 page table
+// must be freed by the caller. The memory space must not be active
+void mm_release_pages(struct mmap* mm)
+{
+    u32 atomic = __atomic_enter();
+
+    u32* lv1 = pa_to_va(mm->ttbr_phys);
+
+    for (u32 i = 0; i < 2048; i++) {
+        if ((lv1[i] & 0b11) != STE_PTR_MASK) {
+            continue;
+        }
+
+        u32* pt2 = pa_to_va((void *)STE_PTR_BASE(lv1[i]));
+        for (u32 j = 0; j < 256; j++) {
+            if ((pt2[j] & PTE_MASK) || zram_pte_is_old(pt2[j])) {
+                put_page(mm_pte_to_page(pt2[j]));
+            } else if (zram_pte_is_swap(pt2[j])) {
+                zram_pte_put(pt2[j]);
+            }
+        }
+
+        lv1[i] = 0;
+        lv2_pt_free(pt2);
+    }
+
+    __atomic_leave(atomic);
+}
+
+// Unmaps a page aligned range of a user memory space and drops the pages. The
+// pages compressed by zram are dropped from the store. Returns the number of
+// pages which were resident
+static u32 mm_unmap_user_range(struct mmap* mm, u32 start, u32 end)
+{
+    u32 pages = 0;
+    u32 atomic = __atomic_enter();
+
+    for (u32 virt_addr = start; virt_addr < end; virt_addr += 4096) {
+        u32* pte = mm_get_pte_ptr(mm, virt_addr);
+        if (pte == NULL) {
+            // Skip to the next section
+            virt_addr = (virt_addr | 0xFFFFF) - 0xFFF;
+            continue;
+        }
+
+        u32 entry = *pte;
+        if ((entry & PTE_MASK) || zram_pte_is_old(entry)) {
+            put_page(mm_pte_to_page(entry));
+            pages++;
+        } else if (zram_pte_is_swap(entry)) {
+            zram_pte_put(entry);
+        } else {
+            continue;
+        }
+
+        *pte = 0;
+        mm_sync_pte(pte);
+        mm_tlb_invalidate_va(virt_addr, mm->context_id);
+    }
+
+    __atomic_leave(atomic);
+    return pages;
+}
+
+// Moves the heap break in a user process memory space. The heap is only
+// reserved when it grows; the pages are mapped in by the data abort handler
+// the first time they are touched. The break always sits on a page boundary,
+// so growing rounds up to whole pages, while shrinking only gives back the
+// whole pages covered by the request
+u32* set_break(i32 bytes)
 {
     struct mmap* mm = get_curr_mm_process();
 
     if (mm->heap_e == 0) {
 
-        // Heap is not mapped
-        mm->heap_s = mm->data_e;
-
-        // Align the addresses with a page
-        align_up_ptr(mm->heap_s, 4096);
+        // Heap is not mapped. The first page is kept out of the heap so that
+        // NULL pointer accesses still fault
+        mm->heap_s = align_up_ptr(mm->data_e, 4096);
+        if ((u32)mm->heap_s < 4096) {
+            mm->heap_s = (u32 *)4096;
+        }
         mm->heap_e = mm->heap_s;
     }
 
@@ -505,29 +1028,33 @@ u32* set_break(u32 bytes)
         return mm->heap_e;
     }
 
-    u32 pages = align_up(bytes, 4096) / 4096;
-    u32 order = pages_to_order(pages);
+    if (bytes < 0) {
+        u32 size = align_down(-(u32)bytes, 4096);
+        u32 heap_size = (u32)mm->heap_e - (u32)mm->heap_s;
+        if (size > heap_size) {
+            size = heap_size;
+        }
 
-    struct page* page_ptr = alloc_pages(order);
+        // The break is moved first, so that no thread faults the range in
+        // again while it is unmapped
+        u32 old_e = (u32)mm->heap_e;
+        mm->heap_e = (u32 *)(old_e - size);
 
-    if (!page_ptr) {
+        u32 pages = mm_unmap_user_range(mm, (u32)mm->heap_e, old_e);
+        curr_thread_sub_pages(pages);
         return mm->heap_e;
     }
 
-    curr_thread_add_pages(page_ptr, 1 << order);
-
-    struct pte_attr attr = {
-        .access = PTE_ACCESS_FULL_ACC,
-        .mem    = PTE_MEM_WRITE_THROUGH,
-        .domain = 15,
-        .nG     = 0,
-        .xn     = 0
-    };
+    // The heap can not grow into the stack region
+    u32 size = align_up(bytes, 4096);
+    u32 heap_e = (u32)mm->heap_e + size;
 
-    assert(mm_map_in_pages(mm, page_ptr, 1 << order, (u32)mm->heap_e, &attr));
+    if (size < (u32)bytes || heap_e < size || heap_e > (u32)mm->stack_e) {
+        return mm->heap_e;
+    }
 
     // Extend the heap region
-    mm->heap_e += 4096 * (1 << order);
+    mm->heap_e = (u32 *)heap_e;
 
     return mm->heap_e;
 }
@@ -551,8 +1078,56 @@ void mm_change_kernel_pt_attr(u32* virt_addr, struct ste_attr* attr)
     u32 entry = mm_get_ste_sect((u32)va_to_pa(virt_addr), attr);
     u32* kernel_pt = mm_get_kernel_pt();
 
-    // Update the entry
-    kernel_pt[(u32)virt_addr >> 20] = entry;
-    asm volatile ("dmb");
+    // Update the entry. The table walk does not look in the data cache
+    u32* ste = &kernel_pt[(u32)virt_addr >> 20];
+    *ste = entry;
+    clean_range((u32)ste, (u32)(ste + 1));
     mm_tlb_invalidate();
 }
+
+// Maps one page into the kernel page table outside the linear map. The level 2
+// page table of the section is allocated on first use and never freed, since
+// the kernel page table is shared by every memory space. Returns 0 if out of
+// memory
+u8 mm_map_kernel_page(struct page* page, u32 virt_addr, struct pte_attr* attr)
+{
+    u32* kernel_pt = mm_get_kernel_pt();
+    u32 atomic = __atomic_enter();
+
+    if (!mm_has_ste_ptr_mapping(kernel_pt, virt_addr)) {
+        u32* pt = lv2_pt_alloc();
+        if (pt == NULL) {
+            __atomic_leave(atomic);
+            return 0;
+        }
+        mm_map_in_pt(kernel_pt, (u32)va_to_pa(pt), virt_addr & ~0xFFFFF,
+            attr->domain);
+    }
+    mm_map_in_page_unsafe(kernel_pt, (u32)page_to_pa(page), virt_addr, attr);
+
+    __atomic_leave(atomic);
+    return 1;
+}
+
+// Removes a page mapped with mm_map_kernel_page. Returns the page or NULL if
+// nothing was mapped. The caller must invalidate the TLB
+struct page* mm_unmap_kernel_page(u32 virt_addr)
+{
+    u32* kernel_pt = mm_get_kernel_pt();
+    u32 ste = kernel_pt[virt_addr >> 20];
+
+    if ((ste & 0b11) != STE_PTR_MASK) {
+        return NULL;
+    }
+
+    u32* pt2_virt = pa_to_va((void *)STE_PTR_BASE(ste));
+    u32* pte = &pt2_virt[(virt_addr >> 12) & 0xFF];
+    if ((*pte & PTE_MASK) == 0) {
+        return NULL;
+    }
+
+    struct page* page = mm_pte_to_page(*pte);
+    *pte = 0;
+    mm_sync_pte(pte);
+    return page;
+}
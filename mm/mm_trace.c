@@ -0,0 +1,366 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/mm_trace.h>
+#include <citrus/mm.h>
+#include <citrus/page_alloc.h>
+#include <citrus/buddy_alloc.h>
+#include <citrus/slob.h>
+#include <citrus/sched.h>
+#include <citrus/thread.h>
+#include <citrus/syscall.h>
+#include <citrus/atomic.h>
+#include <citrus/print.h>
+#include <stddef.h>
+
+// The print buffer does not handle overflow, so the dump sleeps after every
+// batch of lines to let the DMA drain it
+#define MM_TRACE_BATCH 8
+#define MM_TRACE_BATCH_MS 50
+
+// Live allocations are kept in a open addressing hash table which is never
+// filled above 3/4
+#define MM_TRACE_LIVE_MAX (MM_TRACE_LIVE * 3 / 4)
+
+extern struct mm mm;
+
+#if MM_TRACE_ENABLE
+
+struct mm_trace_live {
+    u32 ptr;
+    u32 size;
+    u32 site;
+};
+
+static struct mm_trace_event trace_ring[MM_TRACE_RING];
+static u32 trace_head;
+static u32 trace_cnt;
+
+static struct mm_trace_site trace_sites[MM_TRACE_SITES];
+static struct mm_trace_live trace_live[MM_TRACE_LIVE];
+static u32 trace_live_cnt;
+static u32 trace_dropped;
+
+// The capture buffer is allocated when a capture starts and is kept until the
+// next one so that it can be dumped
+static struct page* capture_page;
+static struct mm_trace_event* capture_buf;
+static u32 capture_cnt;
+static u32 capture_max;
+static u32 capture_lost;
+static u8 capture_on;
+
+// Fibonacci hash of a pointer into a power of two sized table. The top bits of
+// the product are used, since the low bits do not depend on the high bits of
+// the key and every page aligned pointer would share a slot
+static inline u32 mm_trace_hash(u32 key, u32 size)
+{
+    return (key * 2654435761u) >> (32 - __builtin_ctz(size));
+}
+
+// Returns the index of the callsite entry. All callsites beyond the table size
+// share the last entry
+static u32 mm_trace_get_site(u32 site)
+{
+    u32 i = mm_trace_hash(site, MM_TRACE_SITES);
+
+    for (u32 n = 0; n < MM_TRACE_SITES - 1; n++) {
+        if (trace_sites[i].site == site) {
+            return i;
+        }
+        if (trace_sites[i].site == 0) {
+            trace_sites[i].site = site;
+            return i;
+        }
+        i = (i + 1) & (MM_TRACE_SITES - 1);
+    }
+    return MM_TRACE_SITES - 1;
+}
+
+// Adds a live allocation. Returns 0 if the table is full, in which case the
+// allocation is counted as dropped
+static u8 mm_trace_live_insert(u32 ptr, u32 size, u32 site)
+{
+    if (trace_live_cnt >= MM_TRACE_LIVE_MAX) {
+        trace_dropped++;
+        return 0;
+    }
+
+    u32 i = mm_trace_hash(ptr, MM_TRACE_LIVE);
+    while (trace_live[i].ptr) {
+        i = (i + 1) & (MM_TRACE_LIVE - 1);
+    }
+
+    trace_live[i].ptr = ptr;
+    trace_live[i].size = size;
+    trace_live[i].site = site;
+    trace_live_cnt++;
+    return 1;
+}
+
+// Removes a live allocation and returns a copy of it. Returns 0 if the
+// allocation is not tracked. The following entries are shifted back so that
+// the probe sequences stay unbroken
+static u8 mm_trace_live_remove(u32 ptr, struct mm_trace_live* entry)
+{
+    if (ptr == 0) {
+        return 0;
+    }
+
+    u32 i = mm_trace_hash(ptr, MM_TRACE_LIVE);
+    while (trace_live[i].ptr != ptr) {
+        if (trace_live[i].ptr == 0) {
+            return 0;
+        }
+        i = (i + 1) & (MM_TRACE_LIVE - 1);
+    }
+    *entry = trace_live[i];
+
+    u32 j = i;
+    while (1) {
+        j = (j + 1) & (MM_TRACE_LIVE - 1);
+        if (trace_live[j].ptr == 0) {
+            break;
+        }
+
+        // Move the entry if its home slot is not between the hole and itself
+        u32 home = mm_trace_hash(trace_live[j].ptr, MM_TRACE_LIVE);
+        if (((j - home) & (MM_TRACE_LIVE - 1)) >=
+            ((j - i) & (MM_TRACE_LIVE - 1))) {
+            trace_live[i] = trace_live[j];
+            i = j;
+        }
+    }
+
+    trace_live[i].ptr = 0;
+    trace_live_cnt--;
+    return 1;
+}
+
+static void mm_trace_event(u32 type, u32 site, u32 ptr, u32 size)
+{
+    struct thread* curr = get_curr_thread();
+    struct mm_trace_event* event = &trace_ring[trace_head];
+
+    event->site = site;
+    event->ptr = ptr;
+    event->size = size;
+    event->pid = (curr) ? curr->pid : 0;
+    event->type = type;
+
+    trace_head = (trace_head + 1) % MM_TRACE_RING;
+    trace_cnt++;
+
+    if (capture_on) {
+        if (capture_cnt < capture_max) {
+            capture_buf[capture_cnt++] = *event;
+        } else {
+            capture_lost++;
+        }
+    }
+}
+
+// Records an allocation. Failed allocations are recorded with a NULL pointer,
+// but do not count towards the live totals. Neither do allocations dropped by
+// a full live table
+void mm_trace_alloc(u32 type, u32 site, void* ptr, u32 size)
+{
+    u32 atomic = __atomic_enter();
+
+    mm_trace_event(type, site, (u32)ptr, size);
+
+    if (ptr) {
+        u32 index = mm_trace_get_site(site);
+        trace_sites[index].alloc_cnt++;
+
+        // The free can only be matched if the allocation is in the table
+        if (mm_trace_live_insert((u32)ptr, size, index)) {
+            trace_sites[index].live_bytes += size;
+            trace_sites[index].live_cnt++;
+        }
+    }
+
+    __atomic_leave(atomic);
+}
+
+// Records a free. The size and the owning callsite are found from the live
+// allocation table
+void mm_trace_free(u32 type, u32 site, void* ptr)
+{
+    u32 atomic = __atomic_enter();
+
+    struct mm_trace_live entry = { 0 };
+    if (mm_trace_live_remove((u32)ptr, &entry)) {
+        trace_sites[entry.site].live_bytes -= entry.size;
+        trace_sites[entry.site].live_cnt--;
+    }
+    mm_trace_event(type, site, (u32)ptr, entry.size);
+
+    __atomic_leave(atomic);
+}
+
+// Starts a new capture. The allocation of the buffer itself is not captured
+void mm_trace_capture_start(void)
+{
+    u32 atomic = __atomic_enter();
+    struct page* old = capture_page;
+    capture_on = 0;
+    capture_page = NULL;
+    __atomic_leave(atomic);
+
+    if (old) {
+        free_pages(old);
+    }
+
+    struct page* page = alloc_pages(MM_TRACE_CAPTURE_ORDER);
+    if (page == NULL) {
+        print("mmtrace: no memory for the capture\n");
+        return;
+    }
+
+    atomic = __atomic_enter();
+    capture_page = page;
+    capture_buf = page_to_va(page);
+    capture_max = (4096 << MM_TRACE_CAPTURE_ORDER) /
+        sizeof(struct mm_trace_event);
+    capture_cnt = 0;
+    capture_lost = 0;
+    capture_on = 1;
+    __atomic_leave(atomic);
+}
+
+void mm_trace_capture_stop(void)
+{
+    capture_on = 0;
+}
+
+#endif
+
+// Lets the print buffer drain after every batch of lines
+static inline void mm_trace_throttle(u32* lines)
+{
+    if (++(*lines) % MM_TRACE_BATCH == 0) {
+        syscall_thread_sleep(MM_TRACE_BATCH_MS);
+    }
+}
+
+// Prints the free block histogram of the buddy zones and the biggest free
+// block in the SLOB zones
+static void mm_trace_dump_free(u32* lines)
+{
+    for (u32 order = 0; order < 32; order++) {
+        u32 blocks = 0;
+        u32 atomic = __atomic_enter();
+
+        struct list_node* node;
+        list_iterate(node, &mm.buddy_zones) {
+            struct mm_zone* zone = list_get_entry(node, struct mm_zone,
+                alloc_node);
+            blocks += buddy_get_free_blocks(zone, order);
+        }
+        __atomic_leave(atomic);
+
+        if (blocks) {
+            print("mmtrace,buddy,%d,%d\n", order, blocks);
+            mm_trace_throttle(lines);
+        }
+    }
+
+    u32 largest = 0;
+    u32 free = 0;
+    u32 atomic = __atomic_enter();
+
+    struct list_node* node;
+    list_iterate(node, &mm.slob_zones) {
+        struct mm_zone* zone = list_get_entry(node, struct mm_zone, alloc_node);
+        u32 tmp = slob_get_largest(zone);
+        if (tmp > largest) {
+            largest = tmp;
+        }
+        free += zone->get_free(zone);
+    }
+    __atomic_leave(atomic);
+
+    print("mmtrace,slob,%d,%d\n", largest, free);
+    mm_trace_throttle(lines);
+}
+
+// Prints the allocation profile as comma separated lines. This sleeps while
+// the print buffer drains, so it must be called from a thread
+void mm_trace_dump(void)
+{
+    u32 lines = 0;
+    print("mmtrace,begin\n");
+
+#if MM_TRACE_ENABLE
+    for (u32 i = 0; i < MM_TRACE_SITES; i++) {
+        u32 atomic = __atomic_enter();
+        struct mm_trace_site site = trace_sites[i];
+        __atomic_leave(atomic);
+
+        if (site.site == 0) {
+            continue;
+        }
+        print("mmtrace,site,%08x,%d,%d,%d\n", site.site, site.live_bytes,
+            site.live_cnt, site.alloc_cnt);
+        mm_trace_throttle(&lines);
+    }
+#endif
+
+    mm_trace_dump_free(&lines);
+
+#if MM_TRACE_ENABLE
+    // Print the ring from the oldest event
+    u32 cnt = (trace_cnt < MM_TRACE_RING) ? trace_cnt : MM_TRACE_RING;
+    u32 start = (trace_head + MM_TRACE_RING - cnt) % MM_TRACE_RING;
+
+    for (u32 i = 0; i < cnt; i++) {
+        u32 atomic = __atomic_enter();
+        struct mm_trace_event event = trace_ring[(start + i) % MM_TRACE_RING];
+        __atomic_leave(atomic);
+
+        print("mmtrace,event,%d,%08x,%08x,%d,%d\n", event.type, event.site,
+            event.ptr, event.size, event.pid);
+        mm_trace_throttle(&lines);
+    }
+    print("mmtrace,dropped,%d\n", trace_dropped);
+#endif
+
+    print("mmtrace,end\n");
+}
+
+#if MM_TRACE_ENABLE
+
+// Prints the captured events as comma separated lines with the event type, the
+// pointer and the size. The host replay tool pairs the frees with the
+// allocations using the pointer. Events which did not fit in the buffer are
+// reported as lost
+void mm_trace_capture_dump(void)
+{
+    u32 lines = 0;
+    u32 atomic = __atomic_enter();
+    struct page* page = capture_page;
+    u32 cnt = capture_cnt;
+    __atomic_leave(atomic);
+
+    print("mmcap,begin\n");
+
+    for (u32 i = 0; i < cnt; i++) {
+        atomic = __atomic_enter();
+
+        // A new capture might have replaced the buffer while sleeping
+        if (capture_page != page) {
+            __atomic_leave(atomic);
+            break;
+        }
+        struct mm_trace_event event = capture_buf[i];
+        __atomic_leave(atomic);
+
+        print("mmcap,%d,%x,%x\n", event.type, event.ptr, event.size);
+        mm_trace_throttle(&lines);
+    }
+
+    print("mmcap,lost,%d\n", capture_lost);
+    print("mmcap,end\n");
+}
+
+#endif
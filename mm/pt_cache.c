@@ -0,0 +1,290 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/mm.h>
+#include <citrus/page_alloc.h>
+#include <citrus/align.h>
+#include <citrus/atomic.h>
+#include <citrus/cache.h>
+#include <citrus/mem.h>
+#include <citrus/panic.h>
+#include <citrus/thread.h>
+#include <citrus/syscall.h>
+#include <stddef.h>
+
+// A level 2 page table covers 1 MiB and is 1 KiB in size, so one page holds
+// four of them. The pt_map field in the page struct tracks the slots; the low
+// nibble marks the used tables and the high nibble marks free tables which
+// have not been zeroed yet
+#define PT2_PER_PAGE 4
+#define PT2_SIZE 1024
+#define PT2_USED_MSK 0x0F
+#define PT2_DIRTY_SHIFT 4
+
+// The background thread keeps at least this many zeroed tables ready, and
+// pages which are completely free are given back above the high mark
+#define PT2_LOW_WATER 16
+#define PT2_HIGH_WATER 32
+
+// Period of the background zeroing thread
+#define PT2_ZERO_PERIOD_MS 100
+
+// Pages with at least one free table. Pages with zeroed free tables are kept
+// first so that the allocation seldom has to zero a table itself
+static struct list_node pt2_pages;
+static u32 pt2_free_cnt;
+static u32 pt2_dirty_cnt;
+
+static inline u32* pt2_slot(struct page* page, u32 slot)
+{
+    return (u32 *)((u8 *)page_to_va(page) + slot * PT2_SIZE);
+}
+
+// Zeroes a table and writes it to memory. The table walk does not look in
+// the caches
+static inline void pt2_zero(u32* pt)
+{
+    mem_set(pt, 0, PT2_SIZE);
+    clean_range((u32)pt, (u32)pt + PT2_SIZE);
+}
+
+// Allocates a zeroed level 1 page table. Due the the kernel 2GB:2GB split this
+// page table is 8 KiB and covers 2 GiB of address space. Returns the page
+// struct of the table
+struct page* lv1_pt_alloc(void)
+{
+    return alloc_zeroed_pages(1);
+}
+
+void lv1_pt_free(struct page* page)
+{
+    free_pages(page);
+}
+
+// Allocates a page with all four tables zeroed. Returns NULL if out of memory
+static inline struct page* lv2_pt_new_page(void)
+{
+    return alloc_zeroed_page();
+}
+
+// Adds a new page of zeroed tables to the cache. The caller must have
+// interrupts masked
+static void lv2_pt_add_page(struct page* page)
+{
+    page->order |= PAGE_PT_TABLE;
+    page->pt_map = 0;
+    list_add_first(&page->node, &pt2_pages);
+    pt2_free_cnt += PT2_PER_PAGE;
+}
+
+// Gives a page back to the page allocator. The caller must have interrupts
+// masked and the page must have no used tables
+static void lv2_pt_release_page(struct page* page)
+{
+    u32 dirty = page->pt_map >> PT2_DIRTY_SHIFT;
+
+    list_delete_node(&page->node);
+    pt2_free_cnt -= PT2_PER_PAGE;
+    pt2_dirty_cnt -= __builtin_popcount(dirty);
+
+    page->pt_map = 0;
+    page->order &= ~PAGE_PT_TABLE;
+    free_pages(page);
+}
+
+// Allocates a zeroed level 2 page table and returns the kernel virtual address.
+// The table is already in memory. Returns NULL if out of memory
+u32* lv2_pt_alloc(void)
+{
+    u32 atomic = __atomic_enter();
+
+    if (list_is_empty(&pt2_pages)) {
+        struct page* page = lv2_pt_new_page();
+        if (page == NULL) {
+            __atomic_leave(atomic);
+            return NULL;
+        }
+        lv2_pt_add_page(page);
+    }
+
+    struct page* page = list_get_entry(list_get_first(&pt2_pages),
+        struct page, node);
+
+    // Prefer a zeroed table
+    u32 free = ~page->pt_map & PT2_USED_MSK;
+    u32 dirty = (page->pt_map >> PT2_DIRTY_SHIFT) & free;
+    u32 clean = free & ~dirty;
+    u32 slot = __builtin_ctz(clean ? clean : free);
+
+    page->pt_map |= (1 << slot);
+    pt2_free_cnt--;
+
+    if ((page->pt_map & PT2_USED_MSK) == PT2_USED_MSK) {
+        list_delete_node(&page->node);
+    }
+
+    u32* pt = pt2_slot(page, slot);
+    if (dirty & (1 << slot)) {
+        page->pt_map &= ~(1 << (slot + PT2_DIRTY_SHIFT));
+        pt2_dirty_cnt--;
+        pt2_zero(pt);
+    }
+
+    __atomic_leave(atomic);
+    return pt;
+}
+
+// Returns a level 2 page table to the cache. The table must not be linked into
+// any level 1 page table. It is zeroed later by the background thread
+void lv2_pt_free(u32* pt)
+{
+    struct page* page = va_to_page(align_down_ptr(pt, 4096));
+    u32 slot = ((u32)pt / PT2_SIZE) % PT2_PER_PAGE;
+
+    u32 atomic = __atomic_enter();
+
+    if ((page->pt_map & (1 << slot)) == 0) {
+        panic("Page table freed twice");
+    }
+
+    // A full page is not in the list
+    if ((page->pt_map & PT2_USED_MSK) == PT2_USED_MSK) {
+        list_add_last(&page->node, &pt2_pages);
+    }
+
+    page->pt_map &= ~(1 << slot);
+    page->pt_map |= (1 << (slot + PT2_DIRTY_SHIFT));
+    pt2_free_cnt++;
+    pt2_dirty_cnt++;
+
+    if ((page->pt_map & PT2_USED_MSK) == 0 && pt2_free_cnt > PT2_HIGH_WATER) {
+        lv2_pt_release_page(page);
+    }
+
+    __atomic_leave(atomic);
+}
+
+// Zeroes one freed table. The table is marked as used while it is zeroed so
+// that it can not be handed out. Returns 0 if there is no dirty table
+static u8 lv2_pt_zero_one(void)
+{
+    u32 atomic = __atomic_enter();
+
+    if (pt2_dirty_cnt == 0) {
+        __atomic_leave(atomic);
+        return 0;
+    }
+
+    struct page* page = NULL;
+    struct list_node* node;
+    list_iterate(node, &pt2_pages) {
+        struct page* tmp = list_get_entry(node, struct page, node);
+        if (tmp->pt_map >> PT2_DIRTY_SHIFT) {
+            page = tmp;
+            break;
+        }
+    }
+    assert(page);
+
+    u32 slot = __builtin_ctz(page->pt_map >> PT2_DIRTY_SHIFT);
+    page->pt_map &= ~(1 << (slot + PT2_DIRTY_SHIFT));
+    page->pt_map |= (1 << slot);
+    pt2_dirty_cnt--;
+    pt2_free_cnt--;
+
+    __atomic_leave(atomic);
+
+    pt2_zero(pt2_slot(page, slot));
+
+    atomic = __atomic_enter();
+
+    // The rest of the page might have been allocated in the meantime, in which
+    // case the page is no longer in the list
+    u8 full = (page->pt_map & PT2_USED_MSK) == PT2_USED_MSK;
+    page->pt_map &= ~(1 << slot);
+    pt2_free_cnt++;
+
+    // Move the page in front of the pages which still has to be zeroed
+    if (full) {
+        list_add_first(&page->node, &pt2_pages);
+    } else if ((page->pt_map >> PT2_DIRTY_SHIFT) == 0) {
+        list_delete_node(&page->node);
+        list_add_first(&page->node, &pt2_pages);
+    }
+
+    __atomic_leave(atomic);
+    return 1;
+}
+
+// Tops up the cache with zeroed tables. Returns 0 if the cache is full
+static u8 lv2_pt_refill(void)
+{
+    if (pt2_free_cnt - pt2_dirty_cnt >= PT2_LOW_WATER) {
+        return 0;
+    }
+
+    struct page* page = lv2_pt_new_page();
+    if (page == NULL) {
+        return 0;
+    }
+
+    u32 atomic = __atomic_enter();
+    lv2_pt_add_page(page);
+    __atomic_leave(atomic);
+
+    return 1;
+}
+
+// Background thread doing the zeroing outside of the mapping paths
+static i32 lv2_pt_zero_thread(void* arg)
+{
+    while (1) {
+        while (lv2_pt_zero_one());
+        while (lv2_pt_refill());
+
+        syscall_thread_sleep(PT2_ZERO_PERIOD_MS);
+    }
+    return 0;
+}
+
+// Reclaim hook giving back all the pages with no used tables
+static u32 pt_cache_reclaim(u32 order)
+{
+    u32 atomic = __atomic_enter();
+    u32 pages = 0;
+
+    struct list_node* node = pt2_pages.next;
+    while (node != &pt2_pages) {
+        struct page* page = list_get_entry(node, struct page, node);
+        node = node->next;
+
+        if ((page->pt_map & PT2_USED_MSK) == 0) {
+            lv2_pt_release_page(page);
+            pages++;
+        }
+    }
+
+    __atomic_leave(atomic);
+    return pages;
+}
+
+static struct mm_reclaim pt_cache_reclaim_hook = {
+    .reclaim = pt_cache_reclaim
+};
+
+// Sets up the page table cache. This must be called after the page allocator
+// is running
+void pt_cache_init(void)
+{
+    list_init(&pt2_pages);
+    pt2_free_cnt = 0;
+    pt2_dirty_cnt = 0;
+
+    mm_add_reclaim(&pt_cache_reclaim_hook);
+}
+
+// Starts the background zeroing. This must be called after the scheduler is
+// initialized
+void pt_cache_start(void)
+{
+    create_kthread(lv2_pt_zero_thread, 200, "ptzero", NULL, SCHED_BACK);
+}
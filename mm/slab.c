@@ -0,0 +1,315 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/slab.h>
+#include <citrus/mm.h>
+#include <citrus/page_alloc.h>
+#include <citrus/kmalloc.h>
+#include <citrus/align.h>
+#include <citrus/atomic.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// The kmalloc caches are statically allocated since they have to exist before
+// the first kmem_cache_create call
+static struct kmem_cache kmalloc_caches[KMALLOC_CLASSES];
+
+static const char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16",
+    "kmalloc-32",
+    "kmalloc-64",
+    "kmalloc-128",
+    "kmalloc-256",
+    "kmalloc-512",
+    "kmalloc-1024",
+    "kmalloc-2048"
+};
+
+// Set when the kmalloc caches are ready for use
+static u8 kmalloc_caches_ready = 0;
+
+// List of all the caches in the system
+static struct list_node cache_list;
+
+// Returns the free pointer embedded in a free object
+static inline void** kmem_free_ptr(struct kmem_cache* cache, void* obj)
+{
+    return (void **)((u8 *)obj + cache->free_offset);
+}
+
+// Finds the smallest slab order which wastes less than 1/8 of the slab. This
+// keeps the internal fragmentation low for the bigger objects
+static void kmem_cache_set_geometry(struct kmem_cache* cache, u32 align)
+{
+    cache->obj_offset = align_up(sizeof(struct kmem_slab), align);
+
+    for (u32 order = 0; order <= SLAB_MAX_ORDER; order++) {
+        u32 bytes = 4096 << order;
+        u32 cnt = (bytes - cache->obj_offset) / cache->obj_stride;
+        u32 waste = bytes - cache->obj_offset - cnt * cache->obj_stride;
+
+        cache->order = order;
+        cache->obj_per_slab = cnt;
+
+        if (cnt && waste <= (bytes >> 3)) {
+            break;
+        }
+    }
+    assert(cache->obj_per_slab);
+}
+
+// Sets up a cache structure
+static void kmem_cache_setup(struct kmem_cache* cache, const char* name,
+    u32 size, u32 align, void (*ctor)(void *))
+{
+    if (align < SLAB_ALIGN) {
+        align = SLAB_ALIGN;
+    }
+
+    cache->name = name;
+    cache->ctor = ctor;
+    cache->obj_size = size;
+
+    // Objects with a constructor keeps the free pointer after the object
+    if (ctor) {
+        cache->free_offset = align_up(size, sizeof(void *));
+        cache->obj_stride = align_up(cache->free_offset + sizeof(void *), align);
+    } else {
+        cache->free_offset = 0;
+        cache->obj_stride = align_up(size, align);
+    }
+    kmem_cache_set_geometry(cache, align);
+
+    list_init(&cache->partial);
+    list_init(&cache->full);
+    list_init(&cache->empty);
+    cache->empty_cnt = 0;
+    cache->used = 0;
+    cache->slab_cnt = 0;
+
+    list_add_last(&cache->cache_node, &cache_list);
+}
+
+// Allocates a new slab from the buddy allocator and links all the objects into
+// the slab free list
+static struct kmem_slab* kmem_slab_alloc(struct kmem_cache* cache)
+{
+    struct page* page = alloc_pages(cache->order);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    struct kmem_slab* slab = page_to_va(page);
+    slab->cache = cache;
+    slab->page = page;
+    slab->inuse = 0;
+    slab->free = NULL;
+
+    // Build the free list backwards so that the first object is handed out
+    // first
+    u8* obj = (u8 *)slab + cache->obj_offset +
+        (cache->obj_per_slab - 1) * cache->obj_stride;
+
+    for (u32 i = 0; i < cache->obj_per_slab; i++) {
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *kmem_free_ptr(cache, obj) = slab->free;
+        slab->free = obj;
+        obj -= cache->obj_stride;
+    }
+
+    // Mark all the pages in the block so kfree can find the slab in O(1)
+    for (u32 i = 0; i < (1 << cache->order); i++) {
+        page[i].slab = slab;
+    }
+
+    cache->slab_cnt++;
+    return slab;
+}
+
+// Returns the slab pages to the buddy allocator
+static void kmem_slab_release(struct kmem_slab* slab)
+{
+    struct kmem_cache* cache = slab->cache;
+    struct page* page = slab->page;
+
+    for (u32 i = 0; i < (1 << cache->order); i++) {
+        page[i].slab = NULL;
+    }
+
+    cache->slab_cnt--;
+    free_pages(page);
+}
+
+// Returns all the empty slabs in a cache to the buddy allocator. Returns the
+// number of pages released
+u32 kmem_cache_shrink(struct kmem_cache* cache)
+{
+    u32 atomic = __atomic_enter();
+    u32 pages = 0;
+
+    while (!list_is_empty(&cache->empty)) {
+        struct kmem_slab* slab = list_get_entry(list_get_first(&cache->empty),
+            struct kmem_slab, node);
+
+        list_delete_node(&slab->node);
+        cache->empty_cnt--;
+        kmem_slab_release(slab);
+        pages += (1 << cache->order);
+    }
+
+    __atomic_leave(atomic);
+    return pages;
+}
+
+// Reclaim hook called by the page allocator when it runs out of memory
+static u32 kmem_reclaim(u32 order)
+{
+    u32 pages = 0;
+
+    struct list_node* node;
+    list_iterate(node, &cache_list) {
+        struct kmem_cache* cache = list_get_entry(node, struct kmem_cache,
+            cache_node);
+        pages += kmem_cache_shrink(cache);
+    }
+    return pages;
+}
+
+static struct mm_reclaim kmem_reclaim_hook = {
+    .reclaim = kmem_reclaim
+};
+
+// Initializes the kmalloc caches. This must be called after the buddy
+// allocator is running
+void kmem_cache_init(void)
+{
+    list_init(&cache_list);
+    mm_add_reclaim(&kmem_reclaim_hook);
+
+    for (u32 i = 0; i < KMALLOC_CLASSES; i++) {
+        u32 size = 1 << (i + KMALLOC_MIN_SHIFT);
+        kmem_cache_setup(&kmalloc_caches[i], kmalloc_names[i], size,
+            SLAB_ALIGN, NULL);
+    }
+
+    kmalloc_caches_ready = 1;
+}
+
+// Creates a new cache for objects of a fixed size. The constructor is optional
+// and is called once per object when a new slab is allocated. Freed objects
+// must be returned in the constructed state
+struct kmem_cache* kmem_cache_create(const char* name, u32 size, u32 align,
+    void (*ctor)(void *))
+{
+    struct kmem_cache* cache = kmalloc(sizeof(struct kmem_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    u32 atomic = __atomic_enter();
+    kmem_cache_setup(cache, name, size, align, ctor);
+    __atomic_leave(atomic);
+
+    return cache;
+}
+
+// Allocates one object from the cache. Returns NULL if the buddy allocator
+// cannot provide a new slab
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    u32 atomic = __atomic_enter();
+
+    struct kmem_slab* slab;
+    if (!list_is_empty(&cache->partial)) {
+        slab = list_get_entry(list_get_first(&cache->partial),
+            struct kmem_slab, node);
+    } else if (!list_is_empty(&cache->empty)) {
+        slab = list_get_entry(list_get_first(&cache->empty),
+            struct kmem_slab, node);
+        list_delete_node(&slab->node);
+        list_add_first(&slab->node, &cache->partial);
+        cache->empty_cnt--;
+    } else {
+        slab = kmem_slab_alloc(cache);
+        if (slab == NULL) {
+            __atomic_leave(atomic);
+            return NULL;
+        }
+        list_add_first(&slab->node, &cache->partial);
+    }
+
+    // Pop the first free object
+    void* obj = slab->free;
+    slab->free = *kmem_free_ptr(cache, obj);
+    slab->inuse++;
+    cache->used++;
+
+    if (slab->inuse == cache->obj_per_slab) {
+        list_delete_node(&slab->node);
+        list_add_first(&slab->node, &cache->full);
+    }
+
+    __atomic_leave(atomic);
+    return obj;
+}
+
+// Returns an object to the cache
+void kmem_cache_free(struct kmem_cache* cache, void* obj)
+{
+    u32 atomic = __atomic_enter();
+
+    struct kmem_slab* slab = kmem_get_slab(obj);
+    if (slab == NULL || slab->cache != cache) {
+        panic("Non-tracked pointer freed!");
+    }
+
+    *kmem_free_ptr(cache, obj) = slab->free;
+    slab->free = obj;
+    cache->used--;
+
+    // A full slab has now one free object
+    if (slab->inuse-- == cache->obj_per_slab) {
+        list_delete_node(&slab->node);
+        list_add_first(&slab->node, &cache->partial);
+    }
+
+    if (slab->inuse == 0) {
+        list_delete_node(&slab->node);
+
+        if (cache->empty_cnt < SLAB_MAX_EMPTY) {
+            list_add_first(&slab->node, &cache->empty);
+            cache->empty_cnt++;
+        } else {
+            kmem_slab_release(slab);
+        }
+    }
+
+    __atomic_leave(atomic);
+}
+
+// Returns the kmalloc cache for a given size
+struct kmem_cache* kmalloc_get_cache(u32 size)
+{
+    if (!kmalloc_caches_ready || size == 0 || size > KMALLOC_MAX_SLAB) {
+        return NULL;
+    }
+
+    if (size <= (1 << KMALLOC_MIN_SHIFT)) {
+        return &kmalloc_caches[0];
+    }
+
+    u32 shift = 32 - __builtin_clz(size - 1);
+    return &kmalloc_caches[shift - KMALLOC_MIN_SHIFT];
+}
+
+// Returns the slab which contains the object
+struct kmem_slab* kmem_get_slab(const void* obj)
+{
+    if ((u32)obj < KERNEL_START || (u32)obj >= KERNEL_START + DDR_SIZE) {
+        return NULL;
+    }
+
+    struct page* page = va_to_page(align_down_ptr((void *)obj, 4096));
+    return page->slab;
+}
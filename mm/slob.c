@@ -28,6 +28,24 @@ static u32 slob_get_total(struct mm_zone* zone)
     return slob->stats.total;
 }
 
+// Returns the biggest allocation the zone can serve in number of bytes
+u32 slob_get_largest(struct mm_zone* zone)
+{
+    struct slob_struct* slob = (struct slob_struct *)zone->alloc;
+    u32 largest = 0;
+
+    u32 atomic = __atomic_enter();
+    for (struct slob_node* it = slob->first_node->next; it; it = it->next) {
+        if (it->size > largest) {
+            largest = it->size;
+        }
+    }
+    __atomic_leave(atomic);
+
+    return (largest > sizeof(struct slob_node)) ?
+        largest - sizeof(struct slob_node) : 0;
+}
+
 // Initailzie the zone structure used for the buddy allocator
 static void slob_init_zone(struct mm_zone* zone)
 {
@@ -65,15 +83,15 @@ u8 slob_init(struct mm_zone* zone)
 
     // Make the first and last node 
     struct slob_node* tmp_node = (struct slob_node *)slob->start_addr;
-    slob->last_node = (struct slob_node *)slob->end_addr -
-        sizeof(struct slob_node);
+    slob->last_node = (struct slob_node *)
+        (slob->end_addr - sizeof(struct slob_node));
 
     // Setup the links and the size fields 
     slob->node.size = 0;
     slob->node.next = tmp_node;
     slob->first_node = &slob->node;
 
-    tmp_node->size = (u8 *)slob->last_node - (u8 *)slob->first_node;
+    tmp_node->size = (u8 *)slob->last_node - (u8 *)tmp_node;
     tmp_node->next = slob->last_node;
 
     slob->last_node->next = NULL;
@@ -131,47 +149,6 @@ static u8 slob_insert_free(struct slob_node* first, struct slob_node* last,
     return 1;
 }
 
-// Extend the memory region covered by the SLOB allocator
-void slob_extend(struct mm_zone* zone, u32 pages)
-{
-    u32 atomic = __atomic_enter();
-
-    struct slob_struct* slob = (struct slob_struct *)zone->alloc;
-    u32 prev_end = slob->end_addr;
-
-    struct slob_node* it = slob->first_node;
-    while (it->next != slob->last_node);
-
-    // It is pointing to the node before the last node
-    struct slob_node* tmp = slob->last_node;
-
-    slob->end_addr += pages * 4096;
-
-    slob->last_node = (struct slob_node *)
-        (slob->end_addr - sizeof(struct slob_node));
-    
-    // This is the new last nod
-    slob->last_node->next = NULL;
-    slob->last_node->size = 0;
-    
-    // The previous last node is now free
-    it->next = slob->last_node;
-
-    tmp->next = NULL;
-    tmp->size = pages * 4096;
-
-    // Merge any blocks if possible
-    slob_insert_free(slob->first_node, slob->last_node, tmp);
-
-    // Update the statistics
-    slob->stats.total += pages * 4096;
-
-    // Update the ZONE
-    zone->page_cnt += pages;
-
-    __atomic_leave(atomic);
-}
-
 // Allocates a physically and virtually continous memory region. This is based 
 // on the SLOB allocator (simple list of block)
 void* slob_alloc(u32 size, struct mm_zone* zone)
@@ -252,7 +229,7 @@ void slob_free(void* ptr, struct mm_zone* zone)
     }
 
     // Range check 
-    if (((u32)free < (u32)slob->first_node) ||
+    if (((u32)free < slob->start_addr) ||
         ((u32)free >= (u32)slob->last_node)) {
         panic("kmalloc free error!");
     }
@@ -0,0 +1,168 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/vmalloc.h>
+#include <citrus/mm.h>
+#include <citrus/kmalloc.h>
+#include <citrus/page_alloc.h>
+#include <citrus/atomic.h>
+#include <citrus/align.h>
+#include <citrus/mem.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+// A range of the virtual area given out by vmalloc. Every area is followed by
+// one unmapped guard page, so that an overrun faults instead of running into
+// the next area
+struct vm_area {
+    u32 start;
+    u32 pages;
+    struct list_node node;
+};
+
+// Areas sorted by the start address
+static struct list_node vm_areas;
+
+static struct pte_attr vm_attr = {
+    .access = PTE_ACCESS_PRIV_ACC,
+    .mem    = PTE_MEM_WRITE_BACK,
+    .domain = 15,
+    .nG     = 0,
+    .xn     = 1
+};
+
+void vmalloc_init(void)
+{
+    list_init(&vm_areas);
+}
+
+// Finds the first gap in the virtual area which fits the pages and the guard
+// page, and inserts the area there. The caller must have interrupts masked.
+// Returns 0 if the virtual area is full
+static u8 vm_area_insert(struct vm_area* area, u32 pages)
+{
+    u32 size = (pages + 1) * 4096;
+    u32 start = VMALLOC_START;
+
+    struct list_node* node;
+    list_iterate(node, &vm_areas) {
+        struct vm_area* curr = list_get_entry(node, struct vm_area, node);
+
+        if (curr->start - start >= size) {
+            area->start = start;
+            area->pages = pages;
+            list_add_before(&area->node, &curr->node);
+            return 1;
+        }
+        start = curr->start + (curr->pages + 1) * 4096;
+    }
+
+    if (VMALLOC_END - start < size) {
+        return 0;
+    }
+    area->start = start;
+    area->pages = pages;
+    list_add_last(&area->node, &vm_areas);
+    return 1;
+}
+
+// Returns the area starting at the address. Returns NULL if there is none. The
+// caller must have interrupts masked
+static struct vm_area* vm_area_find(u32 start)
+{
+    struct list_node* node;
+    list_iterate(node, &vm_areas) {
+        struct vm_area* area = list_get_entry(node, struct vm_area, node);
+
+        if (area->start == start) {
+            return area;
+        }
+    }
+    return NULL;
+}
+
+// Unmaps and frees the pages of an area before giving back the virtual range.
+// Pages which were never mapped are skipped
+static void vm_area_release(struct vm_area* area)
+{
+    for (u32 i = 0; i < area->pages; i++) {
+        struct page* page = mm_unmap_kernel_page(area->start + i * 4096);
+        if (page) {
+            free_pages(page);
+        }
+    }
+    mm_tlb_invalidate();
+
+    u32 atomic = __atomic_enter();
+    list_delete_node(&area->node);
+    __atomic_leave(atomic);
+
+    kfree(area);
+}
+
+void* vmalloc(u32 size)
+{
+    if (size == 0 || size > VMALLOC_END - VMALLOC_START) {
+        return NULL;
+    }
+    u32 pages = align_up(size, 4096) / 4096;
+
+    struct vm_area* area = kmalloc(sizeof(struct vm_area));
+    if (area == NULL) {
+        return NULL;
+    }
+
+    u32 atomic = __atomic_enter();
+    u8 status = vm_area_insert(area, pages);
+    __atomic_leave(atomic);
+
+    if (status == 0) {
+        kfree(area);
+        return NULL;
+    }
+
+    // The range is reserved, so the pages can be mapped in one at a time
+    for (u32 i = 0; i < pages; i++) {
+        struct page* page = alloc_page();
+        if (page == NULL) {
+            vm_area_release(area);
+            return NULL;
+        }
+
+        if (!mm_map_kernel_page(page, area->start + i * 4096, &vm_attr)) {
+            free_pages(page);
+            vm_area_release(area);
+            return NULL;
+        }
+    }
+
+    // The entries were invalid before, so no TLB maintenance is needed
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+
+    return (void *)area->start;
+}
+
+void* vzmalloc(u32 size)
+{
+    void* ptr = vmalloc(size);
+    if (ptr) {
+        mem_set(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void vfree(void* ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    u32 atomic = __atomic_enter();
+    struct vm_area* area = vm_area_find((u32)ptr);
+    __atomic_leave(atomic);
+
+    if (area == NULL) {
+        panic("vfree on a non-vmalloc address");
+    }
+    vm_area_release(area);
+}
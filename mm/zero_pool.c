@@ -0,0 +1,196 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/mm.h>
+#include <citrus/page_alloc.h>
+#include <citrus/cma.h>
+#include <citrus/atomic.h>
+#include <citrus/cache.h>
+#include <citrus/mem.h>
+#include <stddef.h>
+
+// The pool keeps zeroed blocks of the orders used by the page tables and the
+// user page faults. Level 1 page tables are order 1
+#define ZERO_POOL_ORDERS 2
+
+// Number of zeroed blocks kept per order
+static const u32 zero_pool_high[ZERO_POOL_ORDERS] = { 32, 8 };
+
+// Number of zeroed movable pages kept for the user page faults
+#define ZERO_POOL_MOVABLE_HIGH 32
+
+struct zero_pool {
+    struct list_node pages;
+    u32 cnt;
+};
+
+static struct zero_pool zero_pools[ZERO_POOL_ORDERS];
+
+// The movable pages are taken from the contiguous memory area, and must be
+// given back before the area is searched for a contiguous block
+static struct zero_pool zero_movable_pool;
+
+// Zeroes a block and writes it to memory, so that it can be used as a page
+// table right away
+static void zero_pool_clear(struct page* page, u32 order)
+{
+    u32 start = (u32)page_to_va(page);
+    u32 size = 4096 << order;
+
+    mem_set((void *)start, 0, size);
+    clean_range(start, start + size);
+}
+
+// Takes a block from a pool. Returns NULL if the pool is empty
+static struct page* zero_pool_get(struct zero_pool* pool)
+{
+    struct page* page = NULL;
+    u32 atomic = __atomic_enter();
+
+    if (pool->cnt) {
+        page = list_get_entry(list_get_first(&pool->pages), struct page, node);
+        list_delete_node(&page->node);
+        pool->cnt--;
+    }
+
+    __atomic_leave(atomic);
+    return page;
+}
+
+static void zero_pool_put(struct zero_pool* pool, struct page* page)
+{
+    u32 atomic = __atomic_enter();
+    list_add_last(&page->node, &pool->pages);
+    pool->cnt++;
+    __atomic_leave(atomic);
+}
+
+// Gives every block in a pool back to the page allocator. Returns the number
+// of pages freed
+static u32 zero_pool_empty(struct zero_pool* pool, u32 order)
+{
+    u32 pages = 0;
+    struct page* page;
+
+    while ((page = zero_pool_get(pool))) {
+        free_pages(page);
+        pages += (1 << order);
+    }
+    return pages;
+}
+
+// Allocates a block which is zeroed and written to memory. The block is taken
+// from the pool if possible, and zeroed inline if not. Returns NULL if out of
+// memory
+struct page* alloc_zeroed_pages(u32 order)
+{
+    if (order < ZERO_POOL_ORDERS) {
+        struct page* page = zero_pool_get(&zero_pools[order]);
+        if (page) {
+            return page;
+        }
+    }
+
+    struct page* page = alloc_pages(order);
+    if (page) {
+        zero_pool_clear(page, order);
+    }
+    return page;
+}
+
+struct page* alloc_zeroed_page(void)
+{
+    return alloc_zeroed_pages(0);
+}
+
+// Allocates a zeroed page for a user mapping. A pre-zeroed movable page is
+// preferred, then any pre-zeroed page, before a page is zeroed inline
+struct page* alloc_zeroed_movable_page(void)
+{
+    struct page* page = zero_pool_get(&zero_movable_pool);
+    if (page) {
+        return page;
+    }
+
+    page = zero_pool_get(&zero_pools[0]);
+    if (page) {
+        return page;
+    }
+
+    page = alloc_movable_page();
+    if (page) {
+        zero_pool_clear(page, 0);
+    }
+    return page;
+}
+
+// Zeroes one block for the first pool which is below its limit. This is called
+// by the idle thread. Returns 0 if all the pools are full or if the page
+// allocator is out of memory
+u8 zero_pool_refill(void)
+{
+    for (u32 order = 0; order < ZERO_POOL_ORDERS; order++) {
+        struct zero_pool* pool = &zero_pools[order];
+        if (pool->cnt >= zero_pool_high[order]) {
+            continue;
+        }
+
+        struct page* page = alloc_pages(order);
+        if (page == NULL) {
+            return 0;
+        }
+        zero_pool_clear(page, order);
+        zero_pool_put(pool, page);
+
+        return 1;
+    }
+
+    if (zero_movable_pool.cnt < ZERO_POOL_MOVABLE_HIGH) {
+        struct page* page = alloc_movable_page();
+        if (page == NULL) {
+            return 0;
+        }
+        zero_pool_clear(page, 0);
+        zero_pool_put(&zero_movable_pool, page);
+
+        return 1;
+    }
+    return 0;
+}
+
+// Gives the movable pages back so that the contiguous memory area can use them
+void zero_pool_drain_movable(void)
+{
+    zero_pool_empty(&zero_movable_pool, 0);
+}
+
+// Reclaim hook giving back all the zeroed blocks
+static u32 zero_pool_reclaim(u32 order)
+{
+    u32 pages = zero_pool_empty(&zero_movable_pool, 0);
+
+    for (u32 i = 0; i < ZERO_POOL_ORDERS; i++) {
+        pages += zero_pool_empty(&zero_pools[i], i);
+    }
+    return pages;
+}
+
+static struct mm_reclaim zero_pool_reclaim_hook = {
+    .reclaim = zero_pool_reclaim
+};
+
+static void zero_pool_struct_init(struct zero_pool* pool)
+{
+    list_init(&pool->pages);
+    pool->cnt = 0;
+}
+
+// Sets up the empty pools. They are filled by the idle thread once the
+// scheduler is running
+void zero_pool_init(void)
+{
+    for (u32 i = 0; i < ZERO_POOL_ORDERS; i++) {
+        zero_pool_struct_init(&zero_pools[i]);
+    }
+    zero_pool_struct_init(&zero_movable_pool);
+    mm_add_reclaim(&zero_pool_reclaim_hook);
+}
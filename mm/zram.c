@@ -0,0 +1,414 @@
+// Copyright (C) strawberryhacker
+
+#include <citrus/zram.h>
+#include <citrus/mm.h>
+#include <citrus/lz4.h>
+#include <citrus/vmalloc.h>
+#include <citrus/kmalloc.h>
+#include <citrus/page_alloc.h>
+#include <citrus/cma.h>
+#include <citrus/sched.h>
+#include <citrus/thread.h>
+#include <citrus/syscall.h>
+#include <citrus/benchmark.h>
+#include <citrus/atomic.h>
+#include <citrus/cache.h>
+#include <citrus/mem.h>
+#include <citrus/panic.h>
+#include <stddef.h>
+
+#define ZRAM_NO_SLOT 0xFFFFFFFF
+
+// One compressed page. A zero size means that the page was all zero, and no
+// data is stored. Free slots are linked through the `next` index
+struct zram_slot {
+    union {
+        void* data;
+        u32 next;
+    };
+    u16 size;
+    u16 ref;
+};
+
+static struct zram_slot* zram_slots;
+static u32 zram_free_slot;
+
+// The compressor state is shared, so only one page is compressed at a time.
+// This is guarded by the busy flag below
+static u16 zram_hash_table[LZ4_HASH_SIZE];
+static u8 zram_buffer[ZRAM_MAX_SIZE];
+
+static struct zram_stats zram_stats;
+
+// Pass number used to visit every memory space once per pass, since the
+// threads in a process share the memory map
+static u32 zram_seq;
+
+// Set while a pass runs, so that the reclaim hook does not start a new pass
+// from an allocation inside the pass
+static u8 zram_busy;
+
+extern struct rq rq;
+
+static u32 zram_slot_alloc(void)
+{
+    u32 index = zram_free_slot;
+    if (index != ZRAM_NO_SLOT) {
+        zram_free_slot = zram_slots[index].next;
+    }
+    return index;
+}
+
+// Drops a reference to a slot and frees the compressed page with the last
+// one. The caller must have interrupts masked
+static void zram_slot_put(u32 index)
+{
+    struct zram_slot* slot = &zram_slots[index];
+    if (slot->ref == 0) {
+        panic("zram slot reference underflow");
+    }
+    if (--slot->ref) {
+        return;
+    }
+
+    zram_stats.stored--;
+    if (slot->size) {
+        zram_stats.comp_bytes -= slot->size;
+        kfree(slot->data);
+    } else {
+        zram_stats.zero--;
+    }
+
+    slot->next = zram_free_slot;
+    zram_free_slot = index;
+}
+
+u32 zram_pte_restore(u32 pte)
+{
+    return (pte & ~0xFFF) | (pte & PTE_ACCESS_MSK) | PTE_MEM_WRITE_ALLOC |
+        PTE_nG | PTE_MASK;
+}
+
+void zram_pte_get(u32 pte)
+{
+    zram_slots[pte >> 12].ref++;
+}
+
+void zram_pte_put(u32 pte)
+{
+    zram_slot_put(pte >> 12);
+}
+
+static inline void zram_sync_pte(u32* pte)
+{
+    clean_range((u32)pte, (u32)pte + 4);
+}
+
+static u8 zram_is_zero(const u32* data)
+{
+    for (u32 i = 0; i < 4096 / 4; i++) {
+        if (data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Unmaps a private page, so that the next access shows that it is in use. The
+// caller must have interrupts masked
+static void zram_age(struct mmap* mm, u32* pte, u32 virt_addr)
+{
+    u32 entry = *pte;
+    struct page* page = pa_to_page((void *)(entry & ~0xFFF));
+    if (page->ref != 1) {
+        return;
+    }
+
+    *pte = (entry & ~0xFFF) | (entry & PTE_ACCESS_MSK) | ZRAM_PTE_OLD;
+    zram_sync_pte(pte);
+    mm_tlb_invalidate_va(virt_addr, mm->context_id);
+}
+
+// Compresses an old page into the store and frees it. The entry was unmapped
+// when the page was aged, so the user can not write the page meanwhile. The
+// compression runs with interrupts enabled, and the entry is only replaced if
+// it did not change in the meantime. Returns 1 if the page was freed
+static u8 zram_swap_out(struct mmap* mm, u32 virt_addr, u32 entry)
+{
+    struct page* page = pa_to_page((void *)(entry & ~0xFFF));
+    const u32* data = page_to_va(page);
+
+    u8 zero = zram_is_zero(data);
+    u32 size = 0;
+    void* comp = NULL;
+
+    if (!zero) {
+        size = lz4_compress(data, 4096, zram_buffer, ZRAM_MAX_SIZE,
+            zram_hash_table);
+
+        if (size) {
+            comp = kmalloc(size);
+        }
+        if (comp) {
+            mem_copy(zram_buffer, comp, size);
+        }
+    }
+
+    u32 atomic = __atomic_enter();
+
+    // The page might have been faulted in or unmapped while it was compressed
+    u32* pte = mm_get_pte_ptr(mm, virt_addr);
+    if (pte == NULL || *pte != entry) {
+        __atomic_leave(atomic);
+        kfree(comp);
+        return 0;
+    }
+
+    u32 index = ZRAM_NO_SLOT;
+    if (zero || comp) {
+        index = zram_slot_alloc();
+    }
+
+    if (index == ZRAM_NO_SLOT) {
+        // Incompressible or out of memory. The page is mapped in again
+        if (!zero && comp == NULL) {
+            zram_stats.rejected++;
+        }
+        *pte = zram_pte_restore(entry);
+        zram_sync_pte(pte);
+
+        __atomic_leave(atomic);
+        kfree(comp);
+        return 0;
+    }
+
+    struct zram_slot* slot = &zram_slots[index];
+    slot->data = comp;
+    slot->size = size;
+    slot->ref = 1;
+
+    *pte = (index << 12) | ZRAM_PTE_SWAP;
+    zram_sync_pte(pte);
+
+    zram_stats.stored++;
+    zram_stats.swap_outs++;
+    if (size) {
+        zram_stats.comp_bytes += size;
+    } else {
+        zram_stats.zero++;
+    }
+
+    page->ref = 0;
+    free_pages(page);
+
+    __atomic_leave(atomic);
+    return 1;
+}
+
+// Ages the mapped pages in a range and compresses the pages which were aged in
+// the last pass. The interrupts are masked for one entry at a time. Returns
+// the number of pages freed
+static u32 zram_scan_range(struct mmap* mm, u32 start, u32 end, u32* budget)
+{
+    u32 freed = 0;
+
+    for (u32 virt_addr = start; virt_addr < end; virt_addr += 4096) {
+        u32 atomic = __atomic_enter();
+
+        u32* pte = mm_get_pte_ptr(mm, virt_addr);
+        if (pte == NULL) {
+            __atomic_leave(atomic);
+
+            // Skip to the next section
+            virt_addr = (virt_addr | 0xFFFFF) - 0xFFF;
+            continue;
+        }
+
+        u32 entry = *pte;
+        if (entry & PTE_MASK) {
+            zram_age(mm, pte, virt_addr);
+        }
+        __atomic_leave(atomic);
+
+        if (zram_pte_is_old(entry) && *budget) {
+            (*budget)--;
+            freed += zram_swap_out(mm, virt_addr, entry);
+        }
+    }
+    return freed;
+}
+
+// Returns the next memory space which has not been visited in this pass, or
+// NULL if all have been
+static struct mmap* zram_next_mmap(void)
+{
+    u32 atomic = __atomic_enter();
+
+    struct list_node* node;
+    list_iterate(node, &rq.thread_list) {
+        struct thread* thread = list_get_entry(node, struct thread,
+            thread_node);
+
+        struct mmap* mm = thread->mmap;
+        if (mm && mm->zram_seq != zram_seq) {
+            mm->zram_seq = zram_seq;
+            __atomic_leave(atomic);
+            return mm;
+        }
+    }
+
+    __atomic_leave(atomic);
+    return NULL;
+}
+
+// Runs one pass over the heap and the stack of every memory space. At most
+// `budget` pages are compressed. The scheduler is disabled while a memory
+// space is scanned, so that it stays in place, and other threads can run
+// between the memory spaces. Returns the number of pages freed
+static u32 zram_scan(u32 budget)
+{
+    u32 atomic = __atomic_enter();
+
+    if (zram_busy) {
+        __atomic_leave(atomic);
+        return 0;
+    }
+    zram_busy = 1;
+    zram_seq++;
+
+    __atomic_leave(atomic);
+
+    u32 freed = 0;
+    while (1) {
+        u32 sched = sched_disable();
+
+        struct mmap* mm = zram_next_mmap();
+        if (mm) {
+            freed += zram_scan_range(mm, (u32)mm->heap_s, (u32)mm->heap_e,
+                &budget);
+            freed += zram_scan_range(mm, (u32)mm->stack_e, (u32)mm->stack_s,
+                &budget);
+        }
+
+        sched_enable(sched);
+        if (mm == NULL) {
+            break;
+        }
+    }
+
+    zram_busy = 0;
+    return freed;
+}
+
+// Maps in an old page again, or decompresses a swapped page into a new page.
+// The entry is read again with interrupts masked, since a pass might have
+// changed it since the fault
+u8 zram_fault(struct mmap* mm, u32 addr, u32* pte)
+{
+    u32 atomic = __atomic_enter();
+    u32 entry = *pte;
+
+    if (zram_pte_is_old(entry)) {
+        *pte = zram_pte_restore(entry);
+        zram_sync_pte(pte);
+        zram_stats.minor_faults++;
+
+    } else if (zram_pte_is_swap(entry)) {
+        u32 start = cycle_counter_read();
+
+        struct page* page = alloc_movable_page();
+        if (page == NULL) {
+            __atomic_leave(atomic);
+            return 0;
+        }
+
+        u32 index = entry >> 12;
+        struct zram_slot* slot = &zram_slots[index];
+        void* data = page_to_va(page);
+
+        if (slot->size == 0) {
+            mem_set(data, 0, 4096);
+        } else if (lz4_decompress(slot->data, slot->size, data, 4096) != 4096) {
+            panic("zram: corrupt page");
+        }
+
+        // Every memory space sharing the slot gets its own copy, so the page
+        // is private and writable
+        page->ref = 1;
+        *pte = zram_pte_restore((u32)page_to_pa(page) | PTE_ACCESS_FULL_ACC);
+        zram_sync_pte(pte);
+        zram_slot_put(index);
+
+        u32 cycles = cycle_counter_read() - start;
+        zram_stats.swap_ins++;
+        zram_stats.fault_cycles += cycles;
+        if (cycles > zram_stats.fault_cycles_max) {
+            zram_stats.fault_cycles_max = cycles;
+        }
+        mm->fault_cnt++;
+    }
+
+    // The entry was invalid, so no TLB maintenance is needed
+    asm volatile ("dsb" : : : "memory");
+    asm volatile ("isb" : : : "memory");
+
+    __atomic_leave(atomic);
+    return 1;
+}
+
+void zram_get_stats(struct zram_stats* stats)
+{
+    u32 atomic = __atomic_enter();
+    *stats = zram_stats;
+    __atomic_leave(atomic);
+}
+
+// Reclaim hook compressing the pages aged in the last pass
+static u32 zram_reclaim(u32 order)
+{
+    return zram_scan(ZRAM_BATCH);
+}
+
+static struct mm_reclaim zram_reclaim_hook = {
+    .reclaim = zram_reclaim
+};
+
+// Background thread aging and compressing pages while memory is low
+static i32 zram_thread(void* arg)
+{
+    while (1) {
+        syscall_thread_sleep(ZRAM_PERIOD_MS);
+
+        u32 free = (mm_get_total() - mm_get_total_used()) / 4096;
+        if (free < ZRAM_LOW_PAGES) {
+            zram_scan(ZRAM_BATCH);
+        }
+    }
+    return 0;
+}
+
+void zram_init(void)
+{
+    zram_slots = vmalloc(ZRAM_SLOTS * sizeof(struct zram_slot));
+    if (zram_slots == NULL) {
+        panic("Cannot allocate the zram slots");
+    }
+
+    for (u32 i = 0; i < ZRAM_SLOTS; i++) {
+        zram_slots[i].next = (i + 1 < ZRAM_SLOTS) ? i + 1 : ZRAM_NO_SLOT;
+        zram_slots[i].size = 0;
+        zram_slots[i].ref = 0;
+    }
+    zram_free_slot = 0;
+
+    mem_set(&zram_stats, 0, sizeof(zram_stats));
+    cycle_counter_enable();
+}
+
+// The passes walk the thread list, so nothing is reclaimed before the
+// scheduler is running
+void zram_start(void)
+{
+    mm_add_reclaim(&zram_reclaim_hook);
+    create_kthread(zram_thread, 200, "zram", NULL, SCHED_BACK);
+}
@@ -7,6 +7,7 @@
 #include <citrus/thread.h>
 #include <citrus/mem.h>
 #include <citrus/panic.h>
+#include <citrus/syscall.h>
 
 static struct arp_table arp_table;
 
@@ -16,7 +17,7 @@ void arp_init(void)
 {
     list_init(&arp_table.arp_list);
 
-    create_kthread(arp_thread, 5000, "arp thread", NULL, SCHED_RT);
+    create_kthread(arp_thread, 5000, "net rx", NULL, SCHED_RT);
 }
 
 i32 arp_alloc_mapping(u32 ip)
@@ -149,11 +150,15 @@ void arp_request(u32 dest_ip, u32 src_ip)
     mac_broadcast(buf, 0x0806);
 }
 
+// Network receive thread. Every frame is passed up the stack from here, and
+// the readers block on their UDP ports. The GMAC interrupts are not used, so
+// the receive queue is polled every ms while it is empty
 i32 arp_thread(void* arg)
 {
-    while (1) {        
-        // We have a new packet
-        //mac_receive();
+    while (1) {
+        if (mac_receive()) {
+            syscall_thread_sleep(1);
+        }
     }
     return 0;
 }
@@ -361,6 +361,9 @@ void dhcp_send_request(u32 tid, u32 server_ip, u32 granted_ip)
     udp_send_from(buf, 0xFFFFFFFF, 0x00000000, 68, 67, MAC_BROADCAST);
 }
 
+// Time to wait for a reply before the discover is sent again
+#define DHCP_TIMEOUT_MS 2000
+
 // Main DHCP thread
 i32 dhcp_thread(void* arg)
 {
@@ -376,37 +379,43 @@ i32 dhcp_thread(void* arg)
         u32 tid = 0xC0DEBABE;
         dhcp_send_discover(tid);
 
-        while (1) {
+        i32 err = -ENOENT;
+        while (err) {
             // Rec from the DHCP client port
-            struct netbuf* buf = udp_rec(68);
-
-            if (buf) {
-                print("Got a DHCP response\n");
-                i32 err = dhcp_parse_offer(buf, tid, &ip_struct);
-                free_netbuf(buf);
-                if (err == 0) {
-                    break;
-                }
+            struct netbuf* buf = udp_rec_timeout(68, DHCP_TIMEOUT_MS);
+            if (buf == NULL) {
+                break;
             }
 
-            // Do this for 2 sec. then send another discover
+            print("Got a DHCP response\n");
+            err = dhcp_parse_offer(buf, tid, &ip_struct);
+            free_netbuf(buf);
+        }
+
+        // No offer in time, so send another discover
+        if (err) {
+            continue;
         }
 
         assert(ip_struct.server_cnt);
         dhcp_send_request(tid, ip_struct.server_ip[0], ip_struct.our_ip);
 
-        while (1) {
+        err = -ENOENT;
+        while (err) {
             // Rec from the DHCP client port
-            struct netbuf* buf = udp_rec(68);
-
-            if (buf) {
-                print("Got a DHCP response\n");
-                i32 err = dhcp_parse_ack(buf, tid);
-                free_netbuf(buf);
-                if (err == 0) {
-                    break;
-                }
+            struct netbuf* buf = udp_rec_timeout(68, DHCP_TIMEOUT_MS);
+            if (buf == NULL) {
+                break;
             }
+
+            print("Got a DHCP response\n");
+            err = dhcp_parse_ack(buf, tid);
+            free_netbuf(buf);
+        }
+
+        // The server did not acknowledge, so start over
+        if (err) {
+            continue;
         }
         
         set_ip_struct(&ip_struct);
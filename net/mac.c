@@ -38,14 +38,14 @@ void mac_unqueue(u32 ip)
     }
 }
 
-void mac_receive(void)
+i32 mac_receive(void)
 {
     struct netbuf* buf;
 
     i32 err = gmac_rec_raw(&buf);
 
     if (err)
-        return;
+        return err;
 
     // Skip the source and destination MAC
     buf->ptr += 12;
@@ -65,6 +65,7 @@ void mac_receive(void)
     } else if (type == 0x0800) {
         ip_receive(buf);
     }
+    return 0;
 }
 
 // Fill in the MAC frame and get the dest MAC address form the ARP module
@@ -1,5 +1,6 @@
 #include <net/netbuf.h>
 #include <citrus/kmalloc.h>
+#include <citrus/slab.h>
 #include <citrus/print.h>
 #include <citrus/panic.h>
 #include <citrus/atomic.h>
@@ -8,14 +9,21 @@
 
 struct list_node netbuf_pool;
 
+// Netbufs have their own cache since they do not fit any kmalloc size class
+static struct kmem_cache* netbuf_cache;
+
 void netbuf_init(void)
 {
     list_init(&netbuf_pool);
 
     assert(netbuf_pool.next == &netbuf_pool);
+
+    netbuf_cache = kmem_cache_create("netbuf", sizeof(struct netbuf), 32, NULL);
+    if (netbuf_cache == NULL)
+        panic("Mem error");
     
     for (u32 i = 0; i < 1024; i++) {
-        struct netbuf* buf = kmalloc(sizeof(struct netbuf));
+        struct netbuf* buf = kmem_cache_alloc(netbuf_cache);
 
         if (buf == NULL)
             panic("Mem error");
@@ -9,6 +9,7 @@
 #include <citrus/panic.h>
 #include <citrus/mem.h>
 #include <citrus/atomic.h>
+#include <citrus/wait.h>
 
 // Global UDP module
 static struct udp udp;
@@ -18,8 +19,8 @@ void udp_init(void)
     list_init(&udp.ports);
 }
 
-// This will add a new packet last in the port buffer
-void add_netbuf_to_port(struct netbuf* buf, u16 port)
+// Returns the port structure for a port number, or NULL if nobody listens
+static struct udp_port* udp_find_port(u16 port)
 {
     struct list_node* node;
     list_iterate(node, &udp.ports) {
@@ -27,55 +28,81 @@ void add_netbuf_to_port(struct netbuf* buf, u16 port)
         struct udp_port* p = list_get_entry(node, struct udp_port, node);
 
         if (p->port == port) {
-            list_add_last(&buf->node, &p->packets);
+            return p;
         }
     }
+    return NULL;
+}
+
+// Pops the oldest packet from a port queue. The caller must have interrupts
+// masked
+static struct netbuf* udp_pop(struct udp_port* p)
+{
+    if (list_is_empty(&p->packets))
+        return NULL;
+
+    struct list_node* first_node = p->packets.next;
+    list_delete_first(&p->packets);
+    return list_get_entry(first_node, struct netbuf, node);
 }
 
-// This will pop the most recent packet from the port queue
+// This will add a new packet last in the port buffer and wake a reader. This is
+// called by the network receive thread
+void add_netbuf_to_port(struct netbuf* buf, u16 port)
+{
+    struct thread* reader = NULL;
+
+    u32 atomic = __atomic_enter();
+    struct udp_port* p = udp_find_port(port);
+    if (p) {
+        list_add_last(&buf->node, &p->packets);
+        reader = wait_queue_wake_one(&p->wait);
+    }
+    __atomic_leave(atomic);
+
+    wait_preempt(reader);
+}
+
+// This will pop the oldest packet from the port queue without blocking
 struct netbuf* get_netbuf_from_port(u16 port)
 {
-    struct list_node* node;
-    list_iterate(node, &udp.ports) {
+    struct netbuf* buf = NULL;
 
-        struct udp_port* p = list_get_entry(node, struct udp_port, node);
+    u32 atomic = __atomic_enter();
+    struct udp_port* p = udp_find_port(port);
+    if (p) {
+        buf = udp_pop(p);
+    }
+    __atomic_leave(atomic);
 
-        if (p->port == port) {
+    return buf;
+}
 
-            if (p->packets.next == &p->packets)
-                return NULL;
+// This is called by the application. The packets are passed up the stack by
+// the network receive thread, so the reader sleeps on the port until one
+// arrives
+struct netbuf* udp_rec_timeout(u16 port, u32 ms)
+{
+    struct netbuf* buf = NULL;
 
-            struct list_node* first_node = p->packets.next;
-            list_delete_first(&p->packets);
-            return list_get_entry(first_node, struct netbuf, node);
+    u32 atomic = __atomic_enter();
+    struct udp_port* p = udp_find_port(port);
+    if (p) {
+        while (list_is_empty(&p->packets)) {
+            if (!wait_queue_wait_timeout(&p->wait, ms)) {
+                break;
+            }
         }
+        buf = udp_pop(p);
     }
-    return NULL;
+    __atomic_leave(atomic);
+
+    return buf;
 }
 
-// This is called by the application. This will check the port buffer first, 
-// if non-enpty buffer it will reurn the first element. If the buffer is 
-// empty is will do a mac_receive call. This will propagate the packet up the 
-// stack and maybe end up in the port packet buffer. Then it will try to read
-// again. 
 struct netbuf* udp_rec(u16 port)
 {
-    // Check packet buffer
-    struct netbuf* buf = get_netbuf_from_port(port);
-    if (buf) {
-        return buf;
-    }
-    
-    // Do a raw read
-    mac_receive();
-
-    // Check packet buffer again
-    buf = get_netbuf_from_port(port);
-    if (buf) {
-        return buf;
-    }
-
-    return NULL;
+    return udp_rec_timeout(port, 0);
 }
 
 // Final step if this is a UDP packet
@@ -113,24 +140,21 @@ void udp_get_free_port(u16* port)
 // Make a new port link
 void udp_listen(u16 port)
 {
-    struct list_node* node;
-    list_iterate(node, &udp.ports) {
-        struct udp_port* p = list_get_entry(node, struct udp_port, node);
-
-        if (p->port == port) {
-            panic("UDP port error\n");
-        } 
+    if (udp_find_port(port)) {
+        panic("UDP port error\n");
     }
 
     struct udp_port* udp_port = kmalloc(sizeof(struct udp_port));
 
     // Initialize the port packet list
     list_init(&udp_port->packets);
+    wait_queue_init(&udp_port->wait);
+    udp_port->port = port;
 
     // Add the port to the global UDP structure
+    u32 atomic = __atomic_enter();
     list_add_first(&udp_port->node, &udp.ports);
-
-    udp_port->port = port;
+    __atomic_leave(atomic);
 }
 
 // This takes in a packet buffer. The frame_length field in the netbuf should
@@ -0,0 +1,36 @@
+# Copyright (C) strawberryhacker
+
+import sys
+import serial
+
+from citrus import citrus_packet
+
+# Runs a benchmark on the CitrusOS. The results are printed on the console
+#
+# Usage:
+#   python3 bench.py ctx      memory map switch with a TLB flush against ASIDs
+#   python3 bench.py sched    real-time pick-next cost
+
+# Must match entry/dma_receive.c
+BENCHMARKS = {
+    "ctx"   : 0,
+    "sched" : 1
+}
+
+def main():
+    if len(sys.argv) != 2 or sys.argv[1] not in BENCHMARKS:
+        print("Check parameters")
+        sys.exit()
+
+    try:
+        s = serial.Serial("/dev/ttyS4", \
+            baudrate=921600, timeout=1)
+
+    except serial.SerialException as e:
+        print("Cannot open COM port - ", e)
+        sys.exit()
+
+    packet = citrus_packet(s)
+    packet.send_packet(bytes([BENCHMARKS[sys.argv[1]]]), packet.CMD_BENCH)
+
+main()
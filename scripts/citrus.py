@@ -21,6 +21,10 @@ class citrus_packet:
     CMD_SIZE  = 0x01
     CMD_RESET = 0x02
     CMD_KILL  = 0x03
+    CMD_MM_DUMP = 0x04
+    CMD_MM_CAPTURE = 0x05
+    CMD_REPLAY_SIZE = 0x06
+    CMD_BENCH = 0x07
     CMD_MOUSE = 0x11
 
     # Error response indicating transmission retry
@@ -74,7 +78,7 @@ class citrus_file:
         self.packet = packet_object
         self.loading = loading_object
 
-    def send_file(self, path):
+    def send_file(self, path, size_cmd = citrus_packet.CMD_SIZE):
         size = os.path.getsize(path)
         size_bytes = size.to_bytes(4, byteorder = "little")
 
@@ -82,7 +86,7 @@ class citrus_file:
         self.loading.set_total(size)
 
         # Issue an allocate memory command
-        if self.packet.send_packet(size_bytes, self.packet.CMD_SIZE) == None:
+        if self.packet.send_packet(size_bytes, size_cmd) == None:
             sys.exit()
 
         f = open(path, 'rb')
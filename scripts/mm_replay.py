@@ -0,0 +1,176 @@
+# Copyright (C) strawberryhacker
+
+import os
+import sys
+import struct
+import subprocess
+import serial
+
+from citrus import citrus_packet
+from citrus import citrus_file
+from loading import loading_simple
+
+# Captures the allocations done by a real workload on the CitrusOS and replays
+# them against the allocators on the board. The capture needs a kernel built
+# with `make MM_TRACE=1`
+#
+# Usage:
+#   python3 mm_replay.py start                    start a new capture
+#   python3 mm_replay.py stop                     stop and print the capture
+#   python3 mm_replay.py convert <log> <trace>    make a trace from the log
+#   python3 mm_replay.py replay <trace>           replay the trace
+#   python3 mm_replay.py host <trace>             replay the trace on the host
+#   python3 mm_replay.py report <log> [cpu MHz]   print the replay results
+
+# Must match kernel/alloc_replay.c
+REPLAY_MAGIC = 0x50524D4D
+HEADER_FORMAT = "<IIII"
+OP_FORMAT = "<HHII"
+
+# Must match the mm trace event types
+KMALLOC = 0
+KFREE = 1
+ALLOC_PAGES = 2
+FREE_PAGES = 3
+
+CPU_MHZ = 498
+
+def open_port():
+    try:
+        s = serial.Serial("/dev/ttyS4", \
+            baudrate=921600, timeout=1)
+
+    except serial.SerialException as e:
+        print("Cannot open COM port - ", e)
+        sys.exit()
+
+    return citrus_packet(s)
+
+def capture(start):
+    packet = open_port()
+    packet.send_packet(bytearray([1 if start else 0]), packet.CMD_MM_CAPTURE)
+
+# Reads the events of the last capture in a console log
+def read_capture(log_path):
+    events = []
+    lost = 0
+    with open(log_path, "r", errors = "ignore") as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if len(fields) < 2 or fields[0] != "mmcap":
+                continue
+
+            if fields[1] == "begin":
+                events, lost = [], 0
+            elif fields[1] == "lost":
+                lost = int(fields[2])
+            elif len(fields) == 4:
+                events.append((int(fields[1]), int(fields[2], 16),
+                    int(fields[3], 16)))
+    return events, lost
+
+# The frees are matched with the allocations by pointer and refer to them by a
+# slot number. The slots are reused so that the board only needs room for the
+# peak number of live allocations. Frees of pointers allocated before the
+# capture started are dropped, and so are failed allocations
+def convert(log_path, trace_path):
+    events, lost = read_capture(log_path)
+
+    ops = []
+    live = {}
+    free_slots = []
+    slot_cnt = 0
+    skipped = 0
+
+    for type, ptr, size in events:
+        if type == KMALLOC or type == ALLOC_PAGES:
+            if ptr == 0:
+                skipped += 1
+                continue
+            if free_slots:
+                slot = free_slots.pop()
+            else:
+                slot = slot_cnt
+                slot_cnt += 1
+            live[(type, ptr)] = slot
+            ops.append((type, slot, size))
+        else:
+            key = (KMALLOC if type == KFREE else ALLOC_PAGES, ptr)
+            if key not in live:
+                skipped += 1
+                continue
+            slot = live.pop(key)
+            free_slots.append(slot)
+            ops.append((type, slot, 0))
+
+    with open(trace_path, "wb") as f:
+        f.write(struct.pack(HEADER_FORMAT, REPLAY_MAGIC, len(ops), slot_cnt, 0))
+        for type, slot, size in ops:
+            f.write(struct.pack(OP_FORMAT, type, 0, slot, size))
+
+    print("%d operations, %d slots, %d skipped" % (len(ops), slot_cnt,
+        skipped))
+    if lost:
+        print("The capture buffer overflowed - %d events lost" % lost)
+
+def replay(trace_path):
+    packet = open_port()
+    loading = loading_simple()
+    loading.set_message("Downloading")
+    file = citrus_file(packet, loading)
+    file.send_file(trace_path, packet.CMD_REPLAY_SIZE)
+
+def report(log_path, cpu_mhz):
+    with open(log_path, "r", errors = "ignore") as f:
+        print_report(f, cpu_mhz)
+
+# Replays the trace with the allocators built for the host by make host. The
+# host replay counts in ns, which is the same as a 1000 MHz cycle counter
+def host_replay(trace_path):
+    tool = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+        "build", "host", "alloc_replay")
+    try:
+        out = subprocess.run([tool, trace_path], check = True,
+            stdout = subprocess.PIPE, universal_newlines = True).stdout
+    except (OSError, subprocess.CalledProcessError) as e:
+        print("Cannot run the host replay - run make host first -", e)
+        sys.exit()
+
+    print_report(out.splitlines(), 1000)
+
+def print_report(lines, cpu_mhz):
+    results = []
+    for line in lines:
+        fields = line.strip().split(",")
+        if len(fields) != 10 or fields[0] != "replay" or fields[1] == "name":
+            continue
+        results.append(fields[1:])
+
+    print("%-8s %8s %8s %8s %10s %10s %6s %6s" % ("alloc", "ops", "ns/op",
+        "failed", "peak live", "peak used", "frag", "end"))
+    for name, ops, cycles, _, failed, live, used, frag, end in results:
+        ops = int(ops)
+        ns = int(cycles) * 1000 / cpu_mhz / ops if ops else 0
+        print("%-8s %8d %8.1f %8s %10s %10s %5s%% %5s%%" % (name, ops, ns,
+            failed, live, used, frag, end))
+
+def main():
+    if len(sys.argv) < 2:
+        print("Check parameters")
+        sys.exit()
+
+    cmd = sys.argv[1]
+    if cmd == "start" or cmd == "stop":
+        capture(cmd == "start")
+    elif cmd == "convert" and len(sys.argv) == 4:
+        convert(sys.argv[2], sys.argv[3])
+    elif cmd == "replay" and len(sys.argv) == 3:
+        replay(sys.argv[2])
+    elif cmd == "host" and len(sys.argv) == 3:
+        host_replay(sys.argv[2])
+    elif cmd == "report" and len(sys.argv) >= 3:
+        report(sys.argv[2], int(sys.argv[3]) if len(sys.argv) > 3 else CPU_MHZ)
+    else:
+        print("Check parameters")
+
+main()
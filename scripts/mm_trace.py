@@ -0,0 +1,124 @@
+# Copyright (C) strawberryhacker
+
+import re
+import sys
+import bisect
+import serial
+
+from citrus import citrus_packet
+
+# Requests the allocation profile from the CitrusOS, or decodes a captured
+# console log containing the mmtrace lines. The callsites are symbolized using
+# the linker map file. The kernel must be built with `make MM_TRACE=1`
+#
+# Usage:
+#   python3 mm_trace.py request
+#   python3 mm_trace.py <console log> [map file]
+
+MAP_FILE = "build/citrus.map"
+
+EVENT_TYPES = ["kmalloc", "kfree", "alloc_pages", "free_pages"]
+
+# Global symbols in the map file looks like: 0x80001234    kmalloc
+SYMBOL_RE = re.compile(r"^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_][A-Za-z0-9_]*)\s*$")
+
+class symbol_table:
+    def __init__(self, path):
+        symbols = []
+        try:
+            with open(path, "r") as f:
+                for line in f:
+                    match = SYMBOL_RE.match(line)
+                    if match:
+                        symbols.append((int(match.group(1), 16), match.group(2)))
+        except OSError as e:
+            print("Cannot open map file - ", e)
+
+        symbols.sort()
+        self.addrs = [s[0] for s in symbols]
+        self.names = [s[1] for s in symbols]
+
+    # Returns function+offset for an address. Static functions are not in the
+    # map file, so these resolve to the closest global symbol before them
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return "0x%08x" % addr
+        return "%s+0x%x" % (self.names[i], addr - self.addrs[i])
+
+def request():
+    try:
+        s = serial.Serial("/dev/ttyS4", \
+            baudrate=921600, timeout=1)
+
+    except serial.SerialException as e:
+        print("Cannot open COM port - ", e)
+        sys.exit()
+
+    packet = citrus_packet(s)
+    packet.send_packet(bytearray(), packet.CMD_MM_DUMP)
+
+def decode(log_path, map_path):
+    symbols = symbol_table(map_path)
+
+    sites = []
+    buddy = []
+    events = []
+    slob = None
+    dropped = 0
+
+    # Only the last dump in the log is decoded
+    with open(log_path, "r", errors = "ignore") as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if len(fields) < 2 or fields[0] != "mmtrace":
+                continue
+
+            kind = fields[1]
+            if kind == "begin":
+                sites, buddy, events, slob, dropped = [], [], [], None, 0
+            elif kind == "site":
+                sites.append((int(fields[2], 16), int(fields[3]),
+                    int(fields[4]), int(fields[5])))
+            elif kind == "buddy":
+                buddy.append((int(fields[2]), int(fields[3])))
+            elif kind == "slob":
+                slob = (int(fields[2]), int(fields[3]))
+            elif kind == "event":
+                events.append((int(fields[2]), int(fields[3], 16),
+                    int(fields[4], 16), int(fields[5]), int(fields[6])))
+            elif kind == "dropped":
+                dropped = int(fields[2])
+
+    print("Live allocations per callsite")
+    print("%-40s %10s %8s %8s" % ("callsite", "bytes", "live", "allocs"))
+    for site in sorted(sites, key = lambda s: s[1], reverse = True):
+        print("%-40s %10d %8d %8d" % (symbols.lookup(site[0]), site[1],
+            site[2], site[3]))
+    if dropped:
+        print("%d allocations were not tracked" % dropped)
+
+    print("\nFree buddy blocks per order")
+    for order, blocks in buddy:
+        print("order %2d %8d KiB %6d" % (order, 4 << order, blocks))
+
+    if slob:
+        print("\nLargest free SLOB block %d of %d free bytes" % slob)
+
+    print("\nLast events")
+    for type, site, ptr, size, pid in events:
+        name = EVENT_TYPES[type] if type < len(EVENT_TYPES) else str(type)
+        print("%-12s pid %-4d 0x%08x %8d %s" % (name, pid, ptr, size,
+            symbols.lookup(site)))
+
+def main():
+    if len(sys.argv) < 2:
+        print("Check parameters")
+        sys.exit()
+
+    if sys.argv[1] == "request":
+        request()
+    else:
+        decode(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else MAP_FILE)
+
+main()